@@ -0,0 +1,87 @@
+#include "cereal/messaging/block_codec.h"
+
+#include <cassert>
+#include <iostream>
+
+#include <lz4frame.h>
+#include <zstd.h>
+
+class ZstdCompressor : public BlockCompressor {
+ public:
+  ZstdCompressor(int level, int threads) {
+    cctx = ZSTD_createCCtx();
+    assert(cctx != nullptr);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+    if (threads > 0) {
+      // Small jobs, so a single block is split across the workers
+      ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, threads);
+      ZSTD_CCtx_setParameter(cctx, ZSTD_c_jobSize, LOG_BLOCK_SIZE / threads);
+    }
+  }
+  ~ZstdCompressor() {
+    ZSTD_freeCCtx(cctx);
+  }
+  bool compress(const std::string &in, std::string &out) override {
+    out.resize(ZSTD_compressBound(in.size()));
+    size_t size = ZSTD_compress2(cctx, out.data(), out.size(), in.data(), in.size());
+    if (ZSTD_isError(size)) {
+      std::cout << "ZSTD_compress2 error: " << ZSTD_getErrorName(size) << std::endl;
+      return false;
+    }
+    out.resize(size);
+    return true;
+  }
+
+ private:
+  ZSTD_CCtx *cctx = nullptr;
+};
+
+class Lz4Compressor : public BlockCompressor {
+ public:
+  Lz4Compressor(int compression_level) : level(compression_level) {}
+  bool compress(const std::string &in, std::string &out) override {
+    LZ4F_preferences_t prefs = {};
+    prefs.compressionLevel = level;
+    prefs.frameInfo.contentSize = in.size();
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+    out.resize(LZ4F_compressFrameBound(in.size(), &prefs));
+    size_t size = LZ4F_compressFrame(out.data(), out.size(), in.data(), in.size(), &prefs);
+    if (LZ4F_isError(size)) {
+      std::cout << "LZ4F_compressFrame error: " << LZ4F_getErrorName(size) << std::endl;
+      return false;
+    }
+    out.resize(size);
+    return true;
+  }
+
+ private:
+  int level;
+};
+
+std::unique_ptr<BlockCompressor> block_compressor_create(LogCodec codec, int level, int threads) {
+  switch (codec) {
+    case LogCodec::ZSTD: return std::make_unique<ZstdCompressor>(level, threads);
+    case LogCodec::LZ4: return std::make_unique<Lz4Compressor>(level);
+    default: return nullptr;
+  }
+}
+
+bool block_decompress(LogCodec codec, const char *data, size_t size, size_t raw_size, std::string &out) {
+  out.resize(raw_size);
+  if (codec == LogCodec::ZSTD) {
+    size_t ret = ZSTD_decompress(out.data(), out.size(), data, size);
+    return !ZSTD_isError(ret) && ret == raw_size;
+  } else if (codec == LogCodec::LZ4) {
+    LZ4F_dctx *dctx = nullptr;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) return false;
+
+    size_t out_size = out.size(), in_size = size;
+    size_t ret = LZ4F_decompress(dctx, out.data(), &out_size, data, &in_size, nullptr);
+    LZ4F_freeDecompressionContext(dctx);
+    // 0 once the whole frame, including its checksum, was decoded
+    return ret == 0 && in_size == size && out_size == raw_size;
+  }
+  return false;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Uncompressed size of the independently decodable blocks of zstd and lz4 logs.
+// Blocks always end on a message boundary, so a reader can start decoding at any of them
+#define LOG_BLOCK_SIZE (2 << 20)
+
+enum class LogCodec {
+  BZ2,
+  ZSTD,
+  LZ4,
+};
+
+class BlockCompressor {
+ public:
+  virtual ~BlockCompressor() {}
+  // Compresses in into a self contained frame, returns false on error
+  virtual bool compress(const std::string &in, std::string &out) = 0;
+};
+
+// Compressor for zstd or lz4 frames, nullptr for bz2, which has no self contained blocks.
+// threads only applies to zstd, 0 compresses on the calling thread
+std::unique_ptr<BlockCompressor> block_compressor_create(LogCodec codec, int level, int threads = 0);
+
+// Decodes a single frame of a BlockCompressor of the same codec into out.
+// Fails unless the frame is intact and decodes to exactly raw_size bytes
+bool block_decompress(LogCodec codec, const char *data, size_t size, size_t raw_size, std::string &out);
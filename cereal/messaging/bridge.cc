@@ -1,12 +1,21 @@
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <csignal>
+#include <cstdlib>
+#include <cstdio>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <zmq.h>
 
 typedef void (*sighandler_t)(int sig);
 
+#include "bridge_batch.h"
 #include "impl_msgq.h"
 #include "impl_zmq.h"
 #include "services.h"
@@ -16,25 +25,267 @@ void sigpipe_handler(int sig) {
   std::cout << "SIGPIPE received" << std::endl;
 }
 
-static std::vector<std::string> get_services(std::string whitelist_str, bool zmq_to_msgq) {
-  std::vector<std::string> service_list;
-  for (const auto& it : services) {
-    std::string name = it.name;
-    bool in_whitelist = whitelist_str.find(name) != std::string::npos;
-    if (name == "plusFrame" || name == "uiLayoutState" || (zmq_to_msgq && !in_whitelist)) {
+static void usage(const char *name) {
+  std::cout << "usage: " << name << " [-b] [-z] [-c codec] [-f topics] [-s seconds] [ip [topics]]" << std::endl
+            << "  without topics: publishes msgq services over zmq" << std::endl
+            << "  ip and topics:  republishes these zmq services from ip as msgq" << std::endl
+            << "  -b          batch everything received in a poll cycle into one zmq message on port " << BRIDGE_BATCH_PORT << std::endl
+            << "              with -b, an ip receives the batches of the bridge at that ip" << std::endl
+            << "  -z          compress batches with zstd, implies -b" << std::endl
+            << "  -c codec    compress batches with \"zstd[:level]\" or \"lz4[:level]\", implies -b" << std::endl
+            << "  -f topics   only forward these topics, e.g. \"can:10,carState\" forwards can at 10 Hz" << std::endl
+            << "  -s seconds  print per-topic throughput and drops every n seconds" << std::endl;
+}
+
+static std::vector<int> get_services(const TopicFilter &filter, bool zmq_to_msgq) {
+  std::vector<int> service_list;
+  for (size_t i = 0; i < std::size(services); i++) {
+    std::string name = services[i].name;
+    // Never republish everything as msgq, that would clash with the local publishers
+    bool in_filter = zmq_to_msgq ? !filter.empty() && filter.contains(i) : filter.contains(i);
+    if (name == "plusFrame" || name == "uiLayoutState" || !in_filter) {
       continue;
     }
-    service_list.push_back(name);
+    service_list.push_back(i);
   }
   return service_list;
 }
 
+class BridgeStats {
+public:
+  BridgeStats(int interval) : interval_(interval), stats_(std::size(services)), last_print_(std::chrono::steady_clock::now()) {}
+  inline TopicStats &operator[](int service) { return stats_[service]; }
+  inline void add_wire_bytes(size_t size) { wire_bytes_ += size; }
+
+  void print_if_due() {
+    if (interval_ <= 0) return;
+
+    auto now = std::chrono::steady_clock::now();
+    double dt = std::chrono::duration<double>(now - last_print_).count();
+    if (dt < interval_) return;
+
+    uint64_t total_bytes = 0;
+    for (size_t i = 0; i < stats_.size(); i++) {
+      TopicStats &s = stats_[i];
+      if (s.msgs + s.decimated + s.dropped == 0) continue;
+
+      printf("%-28s %8.1f msg/s %10.1f kB/s  decimated %-8lu dropped %lu\n", services[i].name,
+             s.msgs / dt, s.bytes / dt / 1024., (unsigned long)s.decimated, (unsigned long)s.dropped);
+      total_bytes += s.bytes;
+      s = {};
+    }
+    if (wire_bytes_ > 0) {
+      printf("total %.1f kB/s, %.1f kB/s on the wire\n", total_bytes / dt / 1024., wire_bytes_ / dt / 1024.);
+    }
+    fflush(stdout);
+
+    wire_bytes_ = 0;
+    last_print_ = now;
+  }
+
+private:
+  int interval_;
+  std::vector<TopicStats> stats_;
+  uint64_t wire_bytes_ = 0;
+  std::chrono::steady_clock::time_point last_print_;
+};
+
+static uint64_t nanos_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// "zstd[:level]" or "lz4[:level]", the levels default to the fastest
+static bool parse_codec(const std::string &spec, uint32_t &codec, int &level) {
+  size_t sep = spec.find(':');
+  std::string name = spec.substr(0, sep);
+  if (name == "zstd") {
+    codec = BRIDGE_BATCH_ZSTD;
+    level = 1;
+  } else if (name == "lz4") {
+    codec = BRIDGE_BATCH_LZ4;
+    level = 0;
+  } else {
+    return false;
+  }
+  if (sep != std::string::npos) level = atoi(spec.c_str() + sep + 1);
+  return true;
+}
+
+static int send_frame(void *sock, const void *data, size_t size, bool more) {
+  return zmq_send(sock, data, size, ZMQ_DONTWAIT | (more ? ZMQ_SNDMORE : 0));
+}
+
+// msgq -> zmq, one multipart message per poll cycle
+static void msgq_to_zmq_batched(TopicFilter &filter, uint32_t codec, int level, BridgeStats &stats) {
+  MSGQContext sub_context;
+  MSGQPoller poller;
+  std::map<SubSocket*, int> sub2service;
+  for (int service : get_services(filter, false)) {
+    SubSocket *sub_sock = new MSGQSubSocket();
+    sub_sock->connect(&sub_context, services[service].name, "127.0.0.1", false);
+    poller.registerSocket(sub_sock);
+    sub2service[sub_sock] = service;
+  }
+
+  void *zmq_context = zmq_ctx_new();
+  void *sock = zmq_socket(zmq_context, ZMQ_PUB);
+  std::string endpoint = "tcp://*:" + std::to_string(BRIDGE_BATCH_PORT);
+  assert(zmq_bind(sock, endpoint.c_str()) == 0);
+
+  BatchEncoder encoder(codec, level);
+  std::vector<SubSocket*> ready;
+  while (true) {
+    poller.poll(100, ready);
+    uint64_t t = nanos_now();
+    for (auto sub_sock : ready) {
+      int service = sub2service[sub_sock];
+      Message *msg;
+      while ((msg = sub_sock->receive(true)) != NULL) {
+        if (filter.forward(service, t)) {
+          encoder.add(service, msg->getData(), msg->getSize());
+        } else {
+          stats[service].decimated++;
+        }
+        delete msg;
+      }
+    }
+
+    if (!encoder.empty()) {
+      encoder.encode();
+      const auto &entries = encoder.entries();
+      const std::string &payload = encoder.payload();
+
+      bool sent = send_frame(sock, &encoder.header(), sizeof(bridge_batch_header_t), true) >= 0 &&
+                  send_frame(sock, entries.data(), entries.size() * sizeof(bridge_batch_entry_t), true) >= 0 &&
+                  send_frame(sock, payload.data(), payload.size(), false) >= 0;
+      for (const auto &e : entries) {
+        TopicStats &s = stats[e.service];
+        if (sent) {
+          s.msgs++;
+          s.bytes += e.size;
+        } else {
+          s.dropped++;
+        }
+      }
+      if (sent) stats.add_wire_bytes(payload.size());
+      encoder.clear();
+    }
+
+    stats.print_if_due();
+  }
+}
+
+// zmq -> msgq, unpacks the batches from msgq_to_zmq_batched
+static void zmq_to_msgq_batched(const std::string &ip, TopicFilter &filter, BridgeStats &stats) {
+  MSGQContext pub_context;
+  std::vector<PubSocket*> pub_socks(std::size(services), nullptr);
+
+  void *zmq_context = zmq_ctx_new();
+  void *sock = zmq_socket(zmq_context, ZMQ_SUB);
+  zmq_setsockopt(sock, ZMQ_SUBSCRIBE, "", 0);
+  int timeout = 100;
+  zmq_setsockopt(sock, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+  std::string endpoint = "tcp://" + ip + ":" + std::to_string(BRIDGE_BATCH_PORT);
+  assert(zmq_connect(sock, endpoint.c_str()) == 0);
+
+  BatchDecoder decoder;
+  std::vector<BatchDecoder::Msg> msgs;
+  zmq_msg_t frames[3];
+  for (auto &f : frames) zmq_msg_init(&f);
+
+  while (true) {
+    int num_frames = 0;
+    bool more = true;
+    while (more && zmq_msg_recv(&frames[std::min(num_frames, 2)], sock, 0) >= 0) {
+      more = zmq_msg_more(&frames[std::min(num_frames, 2)]);
+      num_frames++;
+    }
+
+    if (num_frames > 0) {
+      bool ok = num_frames == 3 && !more &&
+                decoder.decode(zmq_msg_data(&frames[0]), zmq_msg_size(&frames[0]),
+                               zmq_msg_data(&frames[1]), zmq_msg_size(&frames[1]),
+                               (const char *)zmq_msg_data(&frames[2]), zmq_msg_size(&frames[2]), msgs);
+      if (!ok) {
+        std::cout << "Dropping malformed or incompatible batch" << std::endl;
+        msgs.clear();
+      } else {
+        stats.add_wire_bytes(zmq_msg_size(&frames[2]));
+      }
+
+      uint64_t t = nanos_now();
+      for (const auto &m : msgs) {
+        TopicStats &s = stats[m.service];
+        if (!filter.forward(m.service, t)) {
+          s.decimated++;
+          continue;
+        }
+
+        PubSocket *&pub_sock = pub_socks[m.service];
+        if (pub_sock == nullptr) {
+          pub_sock = new MSGQPubSocket();
+          pub_sock->connect(&pub_context, services[m.service].name);
+        }
+        if (pub_sock->send((char *)m.data, m.size) < 0) {
+          s.dropped++;
+        } else {
+          s.msgs++;
+          s.bytes += m.size;
+        }
+      }
+      msgs.clear();
+    }
+
+    stats.print_if_due();
+  }
+}
+
 int main(int argc, char** argv) {
   signal(SIGPIPE, (sighandler_t)sigpipe_handler);
 
-  bool zmq_to_msgq = argc > 2;
-  std::string ip = zmq_to_msgq ? argv[1] : "127.0.0.1";
-  std::string whitelist_str = zmq_to_msgq ? std::string(argv[2]) : "";
+  bool batched = false;
+  uint32_t codec = BRIDGE_BATCH_RAW;
+  int level = 0;
+  std::string filter_spec;
+  int stats_interval = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "bzc:f:s:h")) != -1) {
+    switch (opt) {
+      case 'b': batched = true; break;
+      case 'z': batched = parse_codec("zstd", codec, level); break;
+      case 'c':
+        batched = true;
+        if (!parse_codec(optarg, codec, level)) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'f': filter_spec = optarg; break;
+      case 's': stats_interval = atoi(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  // Like before the options existed, "bridge <ip>" alone still publishes all msgq services over zmq.
+  // Batches have their own port, so there an ip is enough to receive them
+  bool has_topics = optind + 1 < argc || (optind < argc && !filter_spec.empty());
+  bool zmq_to_msgq = optind < argc && (batched || has_topics);
+  std::string ip = zmq_to_msgq ? argv[optind] : "127.0.0.1";
+  if (optind + 1 < argc) {
+    filter_spec += (filter_spec.empty() ? "" : ",") + std::string(argv[optind + 1]);
+  }
+
+  TopicFilter filter(filter_spec);
+  BridgeStats stats(stats_interval);
+
+  if (batched) {
+    if (zmq_to_msgq) {
+      zmq_to_msgq_batched(ip, filter, stats);
+    } else {
+      msgq_to_zmq_batched(filter, codec, level, stats);
+    }
+    return 0;
+  }
 
   Poller *poller;
   Context *pub_context;
@@ -49,8 +300,9 @@ int main(int argc, char** argv) {
     sub_context = new MSGQContext();
   }
 
-  std::map<SubSocket*, PubSocket*> sub2pub;
-  for (auto endpoint: get_services(whitelist_str, zmq_to_msgq)) {
+  std::map<SubSocket*, std::pair<PubSocket*, int>> sub2pub;
+  for (int service : get_services(filter, zmq_to_msgq)) {
+    std::string endpoint = services[service].name;
     PubSocket * pub_sock;
     SubSocket * sub_sock;
     if (zmq_to_msgq) {
@@ -64,16 +316,43 @@ int main(int argc, char** argv) {
     sub_sock->connect(sub_context, endpoint, ip, false);
 
     poller->registerSocket(sub_sock);
-    sub2pub[sub_sock] = pub_sock;
+    sub2pub[sub_sock] = {pub_sock, service};
   }
 
+  std::vector<Message *> batch;
+  std::vector<SubSocket*> ready;
   while (true) {
-    for (auto sub_sock : poller->poll(100)) {
-      Message * msg = sub_sock->receive();
-      if (msg == NULL) continue;
-      sub2pub[sub_sock]->sendMessage(msg);
-      delete msg;
+    poller->poll(100, ready);
+    uint64_t t = nanos_now();
+    for (auto sub_sock : ready) {
+      auto [pub_sock, service] = sub2pub[sub_sock];
+      TopicStats &s = stats[service];
+
+      // Forward everything that queued up since the last poll in one go
+      Message * msg;
+      size_t batch_bytes = 0;
+      while ((msg = sub_sock->receive(true)) != NULL) {
+        if (filter.forward(service, t)) {
+          batch.push_back(msg);
+          batch_bytes += msg->getSize();
+        } else {
+          s.decimated++;
+          delete msg;
+        }
+      }
+      if (batch.empty()) continue;
+
+      if (pub_sock->send_batch(batch) < 0) {
+        s.dropped += batch.size();
+      } else {
+        s.msgs += batch.size();
+        s.bytes += batch_bytes;
+      }
+      for (auto m : batch) delete m;
+      batch.clear();
     }
+
+    stats.print_if_due();
   }
   return 0;
 }
@@ -0,0 +1,131 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+#include "services.h"
+#include "bridge_batch.h"
+
+static int get_service_index(const std::string &name) {
+  for (size_t i = 0; i < std::size(services); i++) {
+    if (name == services[i].name) return i;
+  }
+  return -1;
+}
+
+static LogCodec log_codec(uint32_t codec) {
+  return codec == BRIDGE_BATCH_LZ4 ? LogCodec::LZ4 : LogCodec::ZSTD;
+}
+
+TopicFilter::TopicFilter(const std::string &spec) {
+  selected_.resize(std::size(services), false);
+  period_ns_.resize(std::size(services), 0);
+  next_ns_.resize(std::size(services), 0);
+
+  std::stringstream ss(spec);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty()) continue;
+    empty_ = false;
+
+    size_t sep = item.find(':');
+    std::string name = item.substr(0, sep);
+    int idx = get_service_index(name);
+    if (idx < 0) {
+      std::cout << "Warning, " << name << " is not in service list." << std::endl;
+      continue;
+    }
+
+    selected_[idx] = true;
+    if (sep != std::string::npos) {
+      double hz = std::stod(item.substr(sep + 1));
+      if (hz > 0 && services[idx].frequency > hz) {
+        period_ns_[idx] = 1e9 / hz;
+      }
+    }
+  }
+}
+
+bool TopicFilter::contains(int service) const {
+  return empty_ || selected_[service];
+}
+
+bool TopicFilter::forward(int service, uint64_t t_ns) {
+  if (empty_) return true;
+  if (!selected_[service]) return false;
+
+  uint64_t period = period_ns_[service];
+  if (period == 0) return true;
+  if (t_ns < next_ns_[service]) return false;
+
+  // Stays on the nominal schedule, unless it's more than a period behind
+  uint64_t next = next_ns_[service] + period;
+  next_ns_[service] = t_ns < next ? next : t_ns + period;
+  return true;
+}
+
+BatchEncoder::BatchEncoder(uint32_t codec, int level) : codec_(codec) {
+  if (codec != BRIDGE_BATCH_RAW) {
+    compressor_ = block_compressor_create(log_codec(codec), level);
+    assert(compressor_);
+  }
+}
+
+void BatchEncoder::add(int service, const char *data, size_t size) {
+  entries_.push_back({(uint32_t)service, (uint32_t)size});
+  payload_.append(data, size);
+}
+
+void BatchEncoder::encode() {
+  header_ = {
+    .version = BRIDGE_BATCH_VERSION,
+    .codec = codec_,
+    .num_services = (uint32_t)std::size(services),
+    .num_msgs = (uint32_t)entries_.size(),
+    .size = (uint32_t)payload_.size(),
+  };
+
+  if (compressor_) {
+    bool ok = compressor_->compress(payload_, compressed_);
+    assert(ok);
+  }
+}
+
+void BatchEncoder::clear() {
+  entries_.clear();
+  payload_.clear();
+  compressed_.clear();
+}
+
+bool BatchDecoder::decode(const void *header, size_t header_size, const void *entries, size_t entries_size,
+                          const char *payload, size_t payload_size, std::vector<Msg> &msgs) {
+  msgs.clear();
+
+  bridge_batch_header_t h;
+  if (header_size != sizeof(h)) return false;
+  memcpy(&h, header, sizeof(h));
+  if (h.version != BRIDGE_BATCH_VERSION || h.num_services != std::size(services)) return false;
+  if (entries_size != h.num_msgs * sizeof(bridge_batch_entry_t)) return false;
+
+  const char *data = payload;
+  if (h.codec == BRIDGE_BATCH_ZSTD || h.codec == BRIDGE_BATCH_LZ4) {
+    if (!block_decompress(log_codec(h.codec), payload, payload_size, h.size, decompressed_)) {
+      return false;
+    }
+    data = decompressed_.data();
+  } else if (h.codec != BRIDGE_BATCH_RAW || payload_size != h.size) {
+    return false;
+  }
+
+  size_t offset = 0;
+  for (uint32_t i = 0; i < h.num_msgs; i++) {
+    bridge_batch_entry_t e;
+    memcpy(&e, (const char *)entries + i * sizeof(e), sizeof(e));
+    if (e.service >= h.num_services || offset + e.size > h.size) return false;
+
+    msgs.push_back({(int)e.service, data + offset, e.size});
+    offset += e.size;
+  }
+  return offset == h.size;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/block_codec.h"
+
+// Batched bridge mode: everything received in one poll cycle goes out as a single
+// multipart zmq message [header, entries, payload] on BRIDGE_BATCH_PORT
+#define BRIDGE_BATCH_PORT 8099
+#define BRIDGE_BATCH_VERSION 2
+
+// Payload codecs, the zstd and lz4 frames of the log writer
+#define BRIDGE_BATCH_RAW 0
+#define BRIDGE_BATCH_ZSTD 1
+#define BRIDGE_BATCH_LZ4 2
+
+struct bridge_batch_header_t {
+  uint32_t version;
+  uint32_t codec;
+  uint32_t num_services;  // both ends need the same services.h
+  uint32_t num_msgs;
+  uint32_t size;          // uncompressed payload size
+};
+
+struct bridge_batch_entry_t {
+  uint32_t service;  // index in services[]
+  uint32_t size;
+};
+
+// Which services to forward and how often. "can:10,carState" forwards can at 10 Hz
+// and every carState message. Names have to match exactly. An empty spec matches everything
+class TopicFilter {
+public:
+  TopicFilter(const std::string &spec = "");
+  inline bool empty() const { return empty_; }
+  bool contains(int service) const;
+  // Returns false if a message received at t_ns is decimated away. Rates are kept by time,
+  // so bursts and jitter don't change the forwarded rate
+  bool forward(int service, uint64_t t_ns);
+
+private:
+  bool empty_ = true;
+  std::vector<bool> selected_;
+  std::vector<uint64_t> period_ns_;  // 0 forwards every message
+  std::vector<uint64_t> next_ns_;
+};
+
+struct TopicStats {
+  uint64_t msgs = 0, bytes = 0, decimated = 0, dropped = 0;
+};
+
+class BatchEncoder {
+public:
+  // level is the zstd or lz4 compression level, ignored for raw batches
+  BatchEncoder(uint32_t codec = BRIDGE_BATCH_RAW, int level = 1);
+  void add(int service, const char *data, size_t size);
+  inline bool empty() const { return entries_.empty(); }
+  inline const std::vector<bridge_batch_entry_t> &entries() const { return entries_; }
+  // Finishes the batch, the frames stay valid until the next clear()
+  void encode();
+  inline const bridge_batch_header_t &header() const { return header_; }
+  inline const std::string &payload() const { return compressor_ ? compressed_ : payload_; }
+  void clear();
+
+private:
+  uint32_t codec_;
+  std::unique_ptr<BlockCompressor> compressor_;
+  bridge_batch_header_t header_ = {};
+  std::vector<bridge_batch_entry_t> entries_;
+  std::string payload_, compressed_;
+};
+
+class BatchDecoder {
+public:
+  struct Msg {
+    int service;
+    const char *data;
+    size_t size;
+  };
+  // Returns false if the frames are malformed or from an incompatible bridge.
+  // The messages point into the decoder and stay valid until the next decode()
+  bool decode(const void *header, size_t header_size, const void *entries, size_t entries_size,
+              const char *payload, size_t payload_size, std::vector<Msg> &msgs);
+
+private:
+  std::string decompressed_;
+};
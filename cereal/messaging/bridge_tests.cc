@@ -0,0 +1,106 @@
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "bridge_batch.h"
+#include "services.h"
+
+static int service_index(const char *name) {
+  for (size_t i = 0; i < std::size(services); i++) {
+    if (std::string(services[i].name) == name) return i;
+  }
+  return -1;
+}
+
+TEST_CASE("TopicFilter matches exact names and decimates"){
+  int can = service_index("can");
+  int car_state = service_index("carState");
+  int sendcan = service_index("sendcan");
+
+  TopicFilter filter("can:10,carState");
+  REQUIRE(filter.contains(can));
+  REQUIRE(filter.contains(car_state));
+  REQUIRE(!filter.contains(sendcan));
+
+  // can runs at 100 Hz, forwarded at 10 Hz by receive time, with jitter and a burst
+  const uint64_t ms = 1000 * 1000;
+  int forwarded = 0;
+  for (int i = 0; i < 100; i++) {
+    uint64_t t = (1000 + i * 10 + (i % 3) * 4) * ms;
+    forwarded += filter.forward(can, t);
+    REQUIRE(filter.forward(car_state, t));
+    REQUIRE(!filter.forward(sendcan, t));
+  }
+  for (int i = 0; i < 20; i++) {
+    forwarded += filter.forward(can, 2000 * ms);
+  }
+  REQUIRE(forwarded == 11);
+
+  // After a gap it doesn't catch up with a burst
+  REQUIRE(filter.forward(can, 5000 * ms));
+  REQUIRE(!filter.forward(can, 5050 * ms));
+  REQUIRE(filter.forward(can, 5100 * ms));
+
+  // Substrings are not enough
+  TopicFilter substring_filter("carStat");
+  REQUIRE(!substring_filter.contains(car_state));
+
+  TopicFilter everything("");
+  REQUIRE(everything.empty());
+  REQUIRE(everything.contains(sendcan));
+  REQUIRE(everything.forward(sendcan, 0));
+}
+
+TEST_CASE("BatchEncoder round trips through BatchDecoder"){
+  uint32_t codec = GENERATE(BRIDGE_BATCH_RAW, BRIDGE_BATCH_ZSTD, BRIDGE_BATCH_LZ4);
+
+  std::vector<std::string> data = {"first", std::string(10000, 'x'), "", "last"};
+  std::vector<int> ids = {service_index("can"), service_index("carState"), service_index("can"), service_index("modelV2")};
+
+  BatchEncoder encoder(codec);
+  for (size_t i = 0; i < data.size(); i++) {
+    encoder.add(ids[i], data[i].data(), data[i].size());
+  }
+  encoder.encode();
+
+  const auto &entries = encoder.entries();
+  const std::string &payload = encoder.payload();
+  if (codec != BRIDGE_BATCH_RAW) {
+    REQUIRE(payload.size() < 10000);
+  }
+
+  BatchDecoder decoder;
+  std::vector<BatchDecoder::Msg> msgs;
+  REQUIRE(decoder.decode(&encoder.header(), sizeof(bridge_batch_header_t),
+                         entries.data(), entries.size() * sizeof(bridge_batch_entry_t),
+                         payload.data(), payload.size(), msgs));
+  REQUIRE(msgs.size() == data.size());
+  for (size_t i = 0; i < data.size(); i++) {
+    REQUIRE(msgs[i].service == ids[i]);
+    REQUIRE(std::string(msgs[i].data, msgs[i].size) == data[i]);
+  }
+
+  // Truncated payload
+  REQUIRE(!decoder.decode(&encoder.header(), sizeof(bridge_batch_header_t),
+                          entries.data(), entries.size() * sizeof(bridge_batch_entry_t),
+                          payload.data(), payload.size() - 1, msgs));
+
+  // Corrupt payload
+  if (codec != BRIDGE_BATCH_RAW) {
+    std::string corrupt = payload;
+    corrupt[corrupt.size() / 2] ^= 0x55;
+    REQUIRE(!decoder.decode(&encoder.header(), sizeof(bridge_batch_header_t),
+                            entries.data(), entries.size() * sizeof(bridge_batch_entry_t),
+                            corrupt.data(), corrupt.size(), msgs));
+  }
+
+  // Incompatible version
+  bridge_batch_header_t header = encoder.header();
+  header.version++;
+  REQUIRE(!decoder.decode(&header, sizeof(header),
+                          entries.data(), entries.size() * sizeof(bridge_batch_entry_t),
+                          payload.data(), payload.size(), msgs));
+
+  encoder.clear();
+  REQUIRE(encoder.empty());
+}
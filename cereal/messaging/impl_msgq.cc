@@ -26,13 +26,23 @@ static bool service_exists(std::string path){
 }
 
 static size_t get_size(std::string endpoint){
-  size_t sz = DEFAULT_SEGMENT_SIZE;
-
-  if (endpoint == "roadCameraState" || endpoint == "driverCameraState" || endpoint == "wideRoadCameraState"){
-    sz *= 10;
+  // Sized in services.py from the message size and rate
+  for (const auto& it : services) {
+    if (it.name == endpoint) {
+      return it.queue_size;
+    }
   }
+  return DEFAULT_SEGMENT_SIZE;
+}
 
-  return sz;
+static size_t get_num_readers(std::string endpoint){
+  // Set in services.py, more for the services read by most processes
+  for (const auto& it : services) {
+    if (it.name == endpoint) {
+      return it.num_readers;
+    }
+  }
+  return DEFAULT_NUM_READERS;
 }
 
 
@@ -78,7 +88,7 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint));
   if (r != 0){
     return r;
   }
@@ -151,6 +161,25 @@ Message * MSGQSubSocket::receive(bool non_blocking){
   return (Message*)r;
 }
 
+kj::ArrayPtr<const capnp::word> MSGQSubSocket::receive_view(){
+  assert(view.size == 0); // Previous view must be released first
+
+  if (msgq_msg_peek(&view, q) <= 0){
+    view.size = 0;
+    return {};
+  }
+
+  // Messages start 8 byte aligned and are padded to a multiple of 8 bytes in the queue
+  return kj::ArrayPtr<const capnp::word>((const capnp::word*)view.data, ALIGN(view.size) / sizeof(capnp::word));
+}
+
+bool MSGQSubSocket::release_view(){
+  if (view.size == 0){
+    return true;
+  }
+  return msgq_msg_release(&view, q);
+}
+
 void MSGQSubSocket::setTimeout(int t){
   timeout = t;
 }
@@ -170,7 +199,7 @@ int MSGQPubSocket::connect(Context *context, std::string endpoint, bool check_en
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint), true);
   if (r != 0){
     return r;
   }
@@ -196,6 +225,31 @@ int MSGQPubSocket::send(char *data, size_t size){
   return msgq_msg_send(&msg, q);
 }
 
+int MSGQPubSocket::send_batch(const std::vector<Message *> &messages){
+  std::vector<msgq_msg_t> msgs(messages.size());
+  for (size_t i = 0; i < messages.size(); i++){
+    msgs[i].data = messages[i]->getData();
+    msgs[i].size = messages[i]->getSize();
+  }
+
+  return msgq_msg_sendv(msgs.data(), msgs.size(), q);
+}
+
+int MSGQPubSocket::send_segments(kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments){
+  size_t size = capnp::computeSerializedSizeInWords(segments) * sizeof(capnp::word);
+
+  msgq_msg_t msg;
+  int r = msgq_msg_reserve(&msg, size, q);
+  if (r < 0){
+    return r;
+  }
+
+  kj::ArrayOutputStream stream(kj::arrayPtr((kj::byte *)msg.data, size));
+  capnp::writeMessage(stream, segments);
+
+  return msgq_msg_commit(&msg, q);
+}
+
 bool MSGQPubSocket::all_readers_updated() {
   return msgq_all_readers_updated(q);
 }
@@ -208,23 +262,56 @@ MSGQPubSocket::~MSGQPubSocket(){
 }
 
 
+MSGQPoller::MSGQPoller(){
+  use_doorbell = msgq_poller_init(&poller) == 0;
+}
+
 void MSGQPoller::registerSocket(SubSocket * socket){
-  assert(num_polls + 1 < MAX_POLLERS);
+  assert(num_polls + 1 < MAX_MSGQ_POLLERS);
   polls[num_polls].q = (msgq_queue_t*)socket->getRawSocket();
 
+  if (use_doorbell){
+    int idx = msgq_poller_add(&poller, polls[num_polls].q);
+    assert(idx == (int)num_polls);
+  }
+
   sockets.push_back(socket);
   num_polls++;
 }
 
 std::vector<SubSocket*> MSGQPoller::poll(int timeout){
   std::vector<SubSocket*> r;
+  poll(timeout, r);
+  return r;
+}
+
+void MSGQPoller::poll(int timeout, std::vector<SubSocket*> &r){
+  poll(timeout, ready_idx);
+  r.clear();
+  for (int i : ready_idx){
+    r.push_back(sockets[i]);
+  }
+}
+
+void MSGQPoller::poll(int timeout, std::vector<int> &r){
+  r.clear();
+
+  if (use_doorbell){
+    int n = msgq_poller_poll(&poller, ready, timeout);
+    r.insert(r.end(), ready, ready + n);
+    return;
+  }
 
   msgq_poll(polls, num_polls, timeout);
   for (size_t i = 0; i < num_polls; i++){
     if (polls[i].revents){
-      r.push_back(sockets[i]);
+      r.push_back(i);
     }
   }
+}
 
-  return r;
+MSGQPoller::~MSGQPoller(){
+  if (use_doorbell){
+    msgq_poller_close(&poller);
+  }
 }
@@ -4,7 +4,7 @@
 #include <zmq.h>
 #include <string>
 
-#define MAX_POLLERS 128
+#define MAX_MSGQ_POLLERS MSGQ_DOORBELL_BITS
 
 class MSGQContext : public Context {
 private:
@@ -32,12 +32,15 @@ public:
 class MSGQSubSocket : public SubSocket {
 private:
   msgq_queue_t * q = NULL;
+  msgq_msg_t view = {};
   int timeout;
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return (void*)q;}
   Message *receive(bool non_blocking=false);
+  kj::ArrayPtr<const capnp::word> receive_view();
+  bool release_view();
   ~MSGQSubSocket();
 };
 
@@ -48,6 +51,8 @@ public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  int send_batch(const std::vector<Message *> &messages);
+  int send_segments(kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments);
   bool all_readers_updated();
   ~MSGQPubSocket();
 };
@@ -55,11 +60,20 @@ public:
 class MSGQPoller : public Poller {
 private:
   std::vector<SubSocket*> sockets;
-  msgq_pollitem_t polls[MAX_POLLERS];
+  msgq_pollitem_t polls[MAX_MSGQ_POLLERS];
   size_t num_polls = 0;
+  std::vector<int> ready_idx;
+
+  // Only checks the sockets that were published to, falls back to scanning all of them
+  msgq_poller_t poller;
+  bool use_doorbell = false;
+  int ready[MAX_MSGQ_POLLERS];
 
 public:
+  MSGQPoller();
   void registerSocket(SubSocket *socket);
   std::vector<SubSocket*> poll(int timeout);
-  ~MSGQPoller(){};
+  void poll(int timeout, std::vector<SubSocket*> &ready);
+  void poll(int timeout, std::vector<int> &ready);
+  ~MSGQPoller();
 };
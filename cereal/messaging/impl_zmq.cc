@@ -99,6 +99,21 @@ Message * ZMQSubSocket::receive(bool non_blocking){
   return r;
 }
 
+kj::ArrayPtr<const capnp::word> ZMQSubSocket::receive_view(){
+  zmq_msg_t msg;
+  assert(zmq_msg_init(&msg) == 0);
+
+  kj::ArrayPtr<const capnp::word> r;
+  int rc = zmq_msg_recv(&msg, sock, ZMQ_DONTWAIT);
+  if (rc >= 0){
+    // zmq gives no alignment guarantees, this needs a copy
+    r = view_buf.align((char*)zmq_msg_data(&msg), zmq_msg_size(&msg));
+  }
+
+  zmq_msg_close(&msg);
+  return r;
+}
+
 void ZMQSubSocket::setTimeout(int timeout){
   zmq_setsockopt(sock, ZMQ_RCVTIMEO, &timeout, sizeof(int));
 }
@@ -131,6 +146,31 @@ int ZMQPubSocket::send(char *data, size_t size){
   return zmq_send(sock, data, size, ZMQ_DONTWAIT);
 }
 
+int ZMQPubSocket::send_batch(const std::vector<Message *> &messages){
+  int total_size = 0;
+  for (auto m : messages){
+    int rc = zmq_send(sock, m->getData(), m->getSize(), ZMQ_DONTWAIT);
+    if (rc < 0){
+      return rc;
+    }
+    total_size += rc;
+  }
+  return total_size;
+}
+
+int ZMQPubSocket::send_segments(kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments){
+  // Serialize into a buffer that is kept between messages
+  size_t words = capnp::computeSerializedSizeInWords(segments);
+  if (segments_buf.size() < words){
+    segments_buf = kj::heapArray<capnp::word>(words);
+  }
+
+  kj::ArrayOutputStream stream(segments_buf.slice(0, words).asBytes());
+  capnp::writeMessage(stream, segments);
+
+  return zmq_send(sock, segments_buf.begin(), words * sizeof(capnp::word), ZMQ_DONTWAIT);
+}
+
 bool ZMQPubSocket::all_readers_updated() {
   assert(false); // TODO not implemented
   return false;
@@ -152,17 +192,29 @@ void ZMQPoller::registerSocket(SubSocket * socket){
 
 std::vector<SubSocket*> ZMQPoller::poll(int timeout){
   std::vector<SubSocket*> r;
+  poll(timeout, r);
+  return r;
+}
+
+void ZMQPoller::poll(int timeout, std::vector<SubSocket*> &r){
+  poll(timeout, ready_idx);
+  r.clear();
+  for (int i : ready_idx){
+    r.push_back(sockets[i]);
+  }
+}
+
+void ZMQPoller::poll(int timeout, std::vector<int> &r){
+  r.clear();
 
   int rc = zmq_poll(polls, num_polls, timeout);
   if (rc < 0){
-    return r;
+    return;
   }
 
   for (size_t i = 0; i < num_polls; i++){
     if (polls[i].revents){
-      r.push_back(sockets[i]);
+      r.push_back(i);
     }
   }
-
-  return r;
 }
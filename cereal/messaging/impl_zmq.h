@@ -31,11 +31,14 @@ class ZMQSubSocket : public SubSocket {
 private:
   void * sock;
   std::string full_endpoint;
+  AlignedBuffer view_buf;
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return sock;}
   Message *receive(bool non_blocking=false);
+  kj::ArrayPtr<const capnp::word> receive_view();
+  bool release_view() {return true;}
   ~ZMQSubSocket();
 };
 
@@ -43,10 +46,13 @@ class ZMQPubSocket : public PubSocket {
 private:
   void * sock;
   std::string full_endpoint;
+  kj::Array<capnp::word> segments_buf;
 public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  int send_batch(const std::vector<Message *> &messages);
+  int send_segments(kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments);
   bool all_readers_updated();
   ~ZMQPubSocket();
 };
@@ -56,9 +62,12 @@ private:
   std::vector<SubSocket*> sockets;
   zmq_pollitem_t polls[MAX_POLLERS];
   size_t num_polls = 0;
+  std::vector<int> ready_idx;
 
 public:
   void registerSocket(SubSocket *socket);
   std::vector<SubSocket*> poll(int timeout);
+  void poll(int timeout, std::vector<SubSocket*> &ready);
+  void poll(int timeout, std::vector<int> &ready);
   ~ZMQPoller(){};
 };
@@ -1,6 +1,7 @@
 #pragma once
 #include <cstddef>
 #include <map>
+#include <optional>
 #include <string>
 #include <vector>
 #include <capnp/serialize.h>
@@ -37,6 +38,10 @@ public:
   virtual int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true) = 0;
   virtual void setTimeout(int timeout) = 0;
   virtual Message *receive(bool non_blocking=false) = 0;
+  // Non blocking receive without copying where the transport allows it. The view stays
+  // valid until release_view(), which returns false if the data was overwritten meanwhile.
+  virtual kj::ArrayPtr<const capnp::word> receive_view() = 0;
+  virtual bool release_view() = 0;
   virtual void * getRawSocket() = 0;
   static SubSocket * create();
   static SubSocket * create(Context * context, std::string endpoint, std::string address="127.0.0.1", bool conflate=false, bool check_endpoint=true);
@@ -48,6 +53,9 @@ public:
   virtual int connect(Context *context, std::string endpoint, bool check_endpoint=true) = 0;
   virtual int sendMessage(Message *message) = 0;
   virtual int send(char *data, size_t size) = 0;
+  virtual int send_batch(const std::vector<Message *> &messages) = 0;
+  // Serializes a capnp message straight into the socket, without building a flat array first
+  virtual int send_segments(kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments) = 0;
   virtual bool all_readers_updated() = 0;
   static PubSocket * create();
   static PubSocket * create(Context * context, std::string endpoint, bool check_endpoint=true);
@@ -59,17 +67,44 @@ class Poller {
 public:
   virtual void registerSocket(SubSocket *socket) = 0;
   virtual std::vector<SubSocket*> poll(int timeout) = 0;
+  // Same as poll(), reusing the capacity of ready
+  virtual void poll(int timeout, std::vector<SubSocket*> &ready) = 0;
+  // Indexes of the ready sockets, in the order they were registered
+  virtual void poll(int timeout, std::vector<int> &ready) = 0;
   static Poller * create();
   static Poller * create(std::vector<SubSocket*> sockets);
   virtual ~Poller(){};
 };
 
+class AlignedBuffer {
+public:
+  kj::ArrayPtr<const capnp::word> align(const char *data, const size_t size) {
+    words_size = size / sizeof(capnp::word) + 1;
+    if (aligned_buf.size() < words_size) {
+      aligned_buf = kj::heapArray<capnp::word>(words_size < 512 ? 512 : words_size);
+    }
+    memcpy(aligned_buf.begin(), data, size);
+    return aligned_buf.slice(0, words_size);
+  }
+  inline kj::ArrayPtr<const capnp::word> align(Message *m) {
+    return align(m->getData(), m->getSize());
+  }
+private:
+  kj::Array<capnp::word> aligned_buf;
+  size_t words_size;
+};
+
+// Index of a service in the services list, defined in services.h
+enum class ServiceId : int;
+
 class SubMaster {
 public:
   SubMaster(const std::vector<const char *> &service_list,
             const char *address = nullptr, const std::vector<const char *> &ignore_alive = {});
+  SubMaster(const std::vector<ServiceId> &service_list,
+            const char *address = nullptr, const std::vector<ServiceId> &ignore_alive = {});
   void update(int timeout = 1000);
-  void update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages);
+  void update_msgs(uint64_t current_time, const std::vector<std::pair<ServiceId, cereal::Event::Reader>> &messages);
   inline bool allAlive(const std::vector<const char *> &service_list = {}) { return all_(service_list, false, true); }
   inline bool allValid(const std::vector<const char *> &service_list = {}) { return all_(service_list, true, false); }
   inline bool allAliveAndValid(const std::vector<const char *> &service_list = {}) { return all_(service_list, true, true); }
@@ -84,17 +119,35 @@ public:
   uint64_t rcv_time(const char *name) const;
   cereal::Event::Reader &operator[](const char *name) const;
 
+  // Array lookups instead of searching by name
+  bool updated(ServiceId id) const;
+  bool alive(ServiceId id) const;
+  bool valid(ServiceId id) const;
+  uint64_t rcv_frame(ServiceId id) const;
+  uint64_t rcv_time(ServiceId id) const;
+  cereal::Event::Reader &operator[](ServiceId id) const;
+
 private:
+  struct SubMessage;
   bool all_(const std::vector<const char *> &service_list, bool valid, bool alive);
+  SubMessage *get(const char *name) const;
+  SubMessage *get(ServiceId id) const;
+  void update_msg(SubMessage *m, uint64_t current_time, const cereal::Event::Reader &event);
+  void update_alive(uint64_t current_time);
   Poller *poller_ = nullptr;
-  struct SubMessage;
-  std::map<SubSocket *, SubMessage *> messages_;
-  std::map<std::string, SubMessage *> services_;
+  // In the order they were registered with the poller
+  std::vector<SubMessage *> messages_;
+  // Indexed by service id, nullptr for services that aren't subscribed
+  std::vector<SubMessage *> service_ids_;
+  std::vector<int> ready_;
+  AlignedBuffer scratch_buf_;
 };
 
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  // Builds into first_segment, which has to be zeroed. It is zeroed again when the builder is destroyed
+  MessageBuilder(kj::ArrayPtr<capnp::word> first_segment) : capnp::MallocMessageBuilder(first_segment) {}
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
@@ -115,31 +168,31 @@ private:
   kj::Array<capnp::word> heapArray_;
 };
 
-class PubMaster {
+// Reuses the same first segment for every message. Building a message that fits in it
+// and sending it with PubMaster::send doesn't allocate.
+class PooledMessageBuilder {
 public:
-  PubMaster(const std::vector<const char *> &service_list);
-  inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
-  int send(const char *name, MessageBuilder &msg);
-  ~PubMaster();
+  PooledMessageBuilder(size_t first_segment_words = 1024) : first_segment_(kj::heapArray<capnp::word>(first_segment_words)) {
+    memset(first_segment_.begin(), 0, first_segment_.size() * sizeof(capnp::word));
+  }
+  // Starts a new message, the previous one is discarded
+  MessageBuilder &next() {
+    return msg_.emplace(first_segment_);
+  }
 
 private:
-  std::map<std::string, PubSocket *> sockets_;
+  kj::Array<capnp::word> first_segment_;
+  std::optional<MessageBuilder> msg_;
 };
 
-class AlignedBuffer {
+class PubMaster {
 public:
-  kj::ArrayPtr<const capnp::word> align(const char *data, const size_t size) {
-    words_size = size / sizeof(capnp::word) + 1;
-    if (aligned_buf.size() < words_size) {
-      aligned_buf = kj::heapArray<capnp::word>(words_size < 512 ? 512 : words_size);
-    }
-    memcpy(aligned_buf.begin(), data, size);
-    return aligned_buf.slice(0, words_size);
-  }
-  inline kj::ArrayPtr<const capnp::word> align(Message *m) {
-    return align(m->getData(), m->getSize());
-  }
+  PubMaster(const std::vector<const char *> &service_list);
+  inline int send(const char *name, capnp::byte *data, size_t size) { return get(name)->send((char *)data, size); }
+  int send(const char *name, MessageBuilder &msg);
+  ~PubMaster();
+
 private:
-  kj::Array<capnp::word> aligned_buf;
-  size_t words_size;
+  PubSocket *get(const char *name) const;
+  std::map<std::string, PubSocket *, std::less<>> sockets_;
 };
@@ -0,0 +1,97 @@
+#include <atomic>
+#include <cstdlib>
+#include <string>
+
+#include <unistd.h>
+
+#include "catch2/catch.hpp"
+#include "messaging.h"
+
+// Count every heap allocation in the process (glibc)
+static std::atomic<size_t> allocations{0};
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size) noexcept {
+  allocations++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) noexcept {
+  allocations++;
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) noexcept {
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+static int publish(PubSocket *pub, MessageBuilder &msg, int i, int can_frames) {
+  auto event = msg.initEvent();
+  event.initCan(can_frames);
+  event.setLogMonoTime(i);
+  return pub->send_segments(msg.getSegmentsForOutput());
+}
+
+TEST_CASE("Publishing with PooledMessageBuilder does not allocate"){
+  if (messaging_use_zmq()) return;
+
+  // Not shared with the msgq tests, which create their queues with another size
+  const char *endpoint = "test_messaging_pool";
+  const std::string queue_path = std::string("/dev/shm/") + endpoint;
+  unlink(queue_path.c_str());
+
+  Context *ctx = Context::create();
+  PubSocket *pub = PubSocket::create(ctx, endpoint, false);
+  SubSocket *sub = SubSocket::create(ctx, endpoint, "127.0.0.1", false, false);
+  REQUIRE(pub != nullptr);
+  REQUIRE(sub != nullptr);
+
+  const int n = 100;
+  PooledMessageBuilder pool;
+
+  // Catch may allocate, check the results afterwards
+  size_t before = allocations;
+  int sent = 0;
+  for (int i = 0; i < n; i++){
+    sent += publish(pub, pool.next(), i, 10) > 0;
+  }
+  size_t pooled_allocations = allocations - before;
+
+  REQUIRE(sent == n);
+  REQUIRE(pooled_allocations == 0);
+
+  // Sanity check the counter, the default builder allocates its first segment
+  before = allocations;
+  {
+    MessageBuilder msg;
+    publish(pub, msg, n, 10);
+  }
+  REQUIRE(allocations > before);
+
+  // Larger than the first segment, falls back to allocating more segments
+  PooledMessageBuilder small_pool(16);
+  REQUIRE(publish(pub, small_pool.next(), n + 1, 100) > 0);
+  REQUIRE(publish(pub, small_pool.next(), n + 2, 1) > 0);
+
+  // Everything arrives intact
+  AlignedBuffer aligned_buf;
+  for (int i = 0; i < n + 3; i++){
+    Message *msg = sub->receive(true);
+    REQUIRE(msg != nullptr);
+
+    capnp::FlatArrayMessageReader reader(aligned_buf.align(msg));
+    auto event = reader.getRoot<cereal::Event>();
+    REQUIRE(event.getLogMonoTime() == i);
+    REQUIRE(event.getCan().size() == (i == n + 1 ? 100 : (i == n + 2 ? 1 : 10)));
+    delete msg;
+  }
+
+  delete sub;
+  delete pub;
+  delete ctx;
+  unlink(queue_path.c_str());
+}
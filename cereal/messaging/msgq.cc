@@ -11,6 +11,7 @@
 #include <random>
 
 #include <poll.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -19,6 +20,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
 #include <stdio.h>
 
 #include "msgq.h"
@@ -27,6 +32,36 @@ void sigusr2_handler(int signal) {
   assert(signal == SIGUSR2);
 }
 
+bool msgq_use_futex(){
+  #ifdef __linux__
+    static const bool use_futex = std::getenv("MSGQ_SIGNAL") == NULL;
+    return use_futex;
+  #else
+    return false;
+  #endif
+}
+
+int msgq_futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, const struct timespec *ts){
+  #ifdef __linux__
+    // Not FUTEX_PRIVATE_FLAG, the word lives in a mapping shared between processes
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, expected, ts, NULL, 0);
+  #else
+    return nanosleep(ts, NULL);
+  #endif
+}
+
+void msgq_futex_wake(std::atomic<uint32_t> *addr){
+  #ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, std::numeric_limits<int>::max(), NULL, NULL, 0);
+  #endif
+}
+
+static uint64_t msgq_nanos(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
 uint64_t msgq_get_uid(void){
   std::random_device rd("/dev/urandom");
   std::uniform_int_distribution<uint64_t> distribution(0,std::numeric_limits<uint32_t>::max());
@@ -82,29 +117,50 @@ void msgq_wait_for_subscriber(msgq_queue_t *q){
 }
 
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t max_readers, bool publisher){
   assert(size < 0xFFFFFFFF); // Buffer must be smaller than 2^32 bytes
+  assert(max_readers > 0);
   std::signal(SIGUSR2, sigusr2_handler);
 
-  const char * prefix = "/dev/shm/";
-  char * full_path = new char[strlen(path) + strlen(prefix) + 1];
-  strcpy(full_path, prefix);
-  strcat(full_path, path);
+  const std::string full_path = std::string("/dev/shm/") + path;
 
-  auto fd = open(full_path, O_RDWR | O_CREAT, 0664);
+  auto fd = open(full_path.c_str(), O_RDWR | O_CREAT, 0664);
   if (fd < 0) {
     std::cout << "Warning, could not open: " << full_path << std::endl;
-    delete[] full_path;
     return -1;
   }
-  delete[] full_path;
 
-  int rc = ftruncate(fd, size + sizeof(msgq_header_t));
+  // A publisher replaces a queue with another layout, left by an older build or from before a
+  // change of its size. Subscribers still mapping the old file see no more messages until they
+  // reconnect, but the queue works again for everyone that opens it from now on
+  auto replace = [&]() {
+    std::cout << "Warning, replacing " << path << std::endl;
+    unlink(full_path.c_str());
+    return msgq_new_queue(q, path, size, max_readers, false);
+  };
+
+  size_t header_size = sizeof(msgq_header_t) + NUM_READER_FIELDS * max_readers * sizeof(uint64_t);
+
+  // Only a new, empty file is sized. Resizing a queue other processes have mapped would make
+  // their accesses past the new end fault, so a queue with another layout is an error for a
+  // subscriber, and a publisher replaces it with a new file
+  flock(fd, LOCK_EX);
+  struct stat st = {};
+  int rc = fstat(fd, &st);
+  if (rc == 0 && st.st_size == 0){
+    rc = ftruncate(fd, size + header_size);
+  } else if (rc == 0 && (size_t)st.st_size != size + header_size){
+    std::cout << "Warning, " << path << " is " << st.st_size << " bytes, expected " << size + header_size << std::endl;
+    flock(fd, LOCK_UN);
+    close(fd);
+    return publisher ? replace() : -1;
+  }
+  flock(fd, LOCK_UN);
   if (rc < 0){
     close(fd);
     return -1;
   }
-  char * mem = (char*)mmap(NULL, size + sizeof(msgq_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  char * mem = (char*)mmap(NULL, size + header_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   close(fd);
 
   if (mem == NULL){
@@ -114,20 +170,44 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
 
   msgq_header_t *header = (msgq_header_t *)mem;
 
+  // The reader table size is part of the layout, all users of a queue need to agree on it
+  uint64_t expected = 0;
+  q->max_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->max_readers);
+  if (!std::atomic_compare_exchange_strong(q->max_readers, &expected, max_readers) && expected != max_readers){
+    std::cout << "Warning, " << path << " has " << expected << " reader slots, expected " << max_readers << std::endl;
+    munmap(mem, size + header_size);
+    return publisher ? replace() : -1;
+  }
+
   // Setup pointers to header segment
   q->num_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_readers);
+  q->num_evictions = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_evictions);
   q->write_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_pointer);
   q->write_uid = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_uid);
-
-  for (size_t i = 0; i < NUM_READERS; i++){
-    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_pointers[i]);
-    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_valids[i]);
-    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_uids[i]);
-  }
-
-  q->data = mem + sizeof(msgq_header_t);
+  q->futex = reinterpret_cast<std::atomic<uint32_t>*>(&header->futex);
+  q->futex_waiters = reinterpret_cast<std::atomic<uint32_t>*>(&header->futex_waiters);
+
+  // Setup pointers to reader table
+  std::atomic<uint64_t> *readers = reinterpret_cast<std::atomic<uint64_t>*>(mem + sizeof(msgq_header_t));
+  auto reader_field = [&](std::vector<std::atomic<uint64_t> *> &field, int idx) {
+    field.resize(max_readers);
+    for (size_t i = 0; i < max_readers; i++){
+      field[i] = readers + idx * max_readers + i;
+    }
+  };
+  reader_field(q->read_pointers, READ_POINTERS);
+  reader_field(q->read_valids, READ_VALIDS);
+  reader_field(q->read_uids, READ_UIDS);
+  reader_field(q->read_wakeups, READ_WAKEUPS);
+  reader_field(q->read_times, READ_TIMES);
+  reader_field(q->read_evictions, READ_EVICTIONS);
+  reader_field(q->read_doorbells, READ_DOORBELLS);
+
+  q->data = mem + header_size;
   q->size = size;
+  q->header_size = header_size;
   q->reader_id = -1;
+  q->read_doorbell_local = 0;
 
   q->endpoint = path;
   q->read_conflate = false;
@@ -137,7 +217,16 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
 
 void msgq_close_queue(msgq_queue_t *q){
   if (q->mmap_p != NULL){
-    munmap(q->mmap_p, q->size + sizeof(msgq_header_t));
+    // Free our reader slot, so the next subscriber doesn't need to evict anyone
+    int id = q->reader_id;
+    if (id >= 0 && q->read_uid_local == *q->read_uids[id]){
+      *q->read_valids[id] = false;
+      *q->read_times[id] = 0;
+      *q->read_doorbells[id] = 0;
+      *q->read_uids[id] = 0;
+    }
+
+    munmap(q->mmap_p, q->size + q->header_size);
   }
 }
 
@@ -149,10 +238,15 @@ void msgq_init_publisher(msgq_queue_t * q) {
   *q->write_uid = uid;
   *q->num_readers = 0;
 
-  for (size_t i = 0; i < NUM_READERS; i++){
+  for (size_t i = 0; i < q->read_uids.size(); i++){
     *q->read_valids[i] = false;
     *q->read_uids[i] = 0;
+    *q->read_wakeups[i] = MSGQ_WAKEUP_NONE;
+    *q->read_times[i] = 0;
+    *q->read_evictions[i] = 0;
+    *q->read_doorbells[i] = 0;
   }
+  *q->num_evictions = 0;
 
   q->write_uid_local = uid;
 }
@@ -166,33 +260,117 @@ static void thread_signal(uint32_t tid) {
   #endif
 }
 
+static msgq_doorbell_t *msgq_doorbells(){
+  static msgq_doorbell_t *doorbells = []() -> msgq_doorbell_t* {
+    size_t size = MSGQ_NUM_DOORBELLS * sizeof(msgq_doorbell_t);
+    int fd = open("/dev/shm/msgq_doorbells", O_RDWR | O_CREAT, 0664);
+    if (fd < 0 || ftruncate(fd, size) < 0){
+      std::cout << "Warning, could not open msgq doorbells" << std::endl;
+      if (fd >= 0) close(fd);
+      return NULL;
+    }
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (mem == MAP_FAILED) ? NULL : (msgq_doorbell_t *)mem;
+  }();
+  return doorbells;
+}
+
+// Reader slots store the doorbell as (slot + 1) << 32 | bit, 0 means none
+static void msgq_ring_doorbell(uint64_t doorbell){
+  msgq_doorbell_t *doorbells = msgq_doorbells();
+  if (doorbells == NULL) return;
+
+  uint32_t slot, bit;
+  UNPACK64(slot, bit, doorbell);
+  msgq_doorbell_t *d = &doorbells[slot - 1];
+
+  auto ready = reinterpret_cast<std::atomic<uint64_t>*>(&d->ready[bit / 64]);
+  ready->fetch_or(1ULL << (bit % 64));
+
+  auto futex = reinterpret_cast<std::atomic<uint32_t>*>(&d->futex);
+  futex->fetch_add(1);
+  if (*reinterpret_cast<std::atomic<uint32_t>*>(&d->futex_waiters) > 0){
+    msgq_futex_wake(futex);
+  }
+}
+
+static void msgq_notify_readers(msgq_queue_t *q, uint64_t num_readers){
+  // Futex waiters are all woken by a single syscall, skipped when nobody is waiting
+  q->futex->fetch_add(1);
+  if (*q->futex_waiters > 0){
+    msgq_futex_wake(q->futex);
+  }
+
+  for (uint64_t i = 0; i < num_readers; i++){
+    uint64_t reader_uid = *q->read_uids[i];
+    if (reader_uid == 0) continue;
+
+    uint64_t doorbell = *q->read_doorbells[i];
+    if (doorbell != 0){
+      msgq_ring_doorbell(doorbell);
+    }
+    if (*q->read_wakeups[i] == MSGQ_WAKEUP_SIGNAL){
+      thread_signal(reader_uid & 0xFFFFFFFF);
+    }
+  }
+}
+
 void msgq_init_subscriber(msgq_queue_t * q) {
   assert(q != NULL);
   assert(q->num_readers != NULL);
 
   uint64_t uid = msgq_get_uid();
+  uint64_t max_readers = q->read_uids.size();
 
   // Get reader id
   while (true){
     uint64_t cur_num_readers = *q->num_readers;
     uint64_t new_num_readers = cur_num_readers + 1;
 
-    // No more slots available. Reset all subscribers to kick out inactive ones
-    if (new_num_readers > NUM_READERS){
-      std::cout << "Warning, evicting all subscribers!" << std::endl;
-      *q->num_readers = 0;
+    // No more slots available. Take over the slot that was used least recently,
+    // closed readers leave their slot with time 0 so they are picked first
+    if (new_num_readers > max_readers){
+      uint64_t id = 0;
+      uint64_t oldest = *q->read_times[0];
+      for (uint64_t i = 1; i < max_readers; i++){
+        uint64_t t = *q->read_times[i];
+        if (t < oldest){
+          id = i;
+          oldest = t;
+        }
+      }
 
-      for (size_t i = 0; i < NUM_READERS; i++){
-        *q->read_valids[i] = false;
+      // Claim the slot, this fails if the reader became active or another subscriber took it
+      uint64_t now = msgq_nanos();
+      if (!std::atomic_compare_exchange_strong(q->read_times[id], &oldest, now)){
+        continue;
+      }
 
-        uint64_t old_uid = *q->read_uids[i];
-        *q->read_uids[i] = 0;
+      uint64_t old_uid = *q->read_uids[id];
+      *q->read_valids[id] = false;
+      *q->read_pointers[id] = 0;
+      *q->read_wakeups[id] = MSGQ_WAKEUP_NONE;
+      *q->read_doorbells[id] = q->read_doorbell_local;
+      *q->read_uids[id] = uid;
+
+      if (old_uid != 0){
+        if (now - oldest < MSGQ_READER_IDLE_NS){
+          std::cout << "Warning, no idle subscriber on " << q->endpoint << ", evicting an active one!" << std::endl;
+        }
+        q->num_evictions->fetch_add(1);
+        q->read_evictions[id]->fetch_add(1);
 
         // Wake up reader in case they are in a poll
         thread_signal(old_uid & 0xFFFFFFFF);
+        q->futex->fetch_add(1);
+        msgq_futex_wake(q->futex);
       }
 
-      continue;
+      q->reader_id = id;
+      q->read_uid_local = uid;
+      break;
     }
 
     // Use atomic compare and swap to handle race condition
@@ -208,6 +386,9 @@ void msgq_init_subscriber(msgq_queue_t * q) {
       *q->read_valids[cur_num_readers] = false;
       *q->read_pointers[cur_num_readers] = 0;
       *q->read_uids[cur_num_readers] = uid;
+      *q->read_wakeups[cur_num_readers] = MSGQ_WAKEUP_NONE;
+      *q->read_doorbells[cur_num_readers] = q->read_doorbell_local;
+      *q->read_times[cur_num_readers] = msgq_nanos();
       break;
     }
   }
@@ -216,7 +397,35 @@ void msgq_init_subscriber(msgq_queue_t * q) {
   msgq_reset_reader(q);
 }
 
+static void msgq_invalidate_readers(msgq_queue_t *q, uint64_t num_readers,
+                                    uint32_t start_cycles, uint32_t start, int64_t wrap_pointer,
+                                    uint32_t write_cycles, uint32_t write_pointer){
+  // TODO: should we handle the case where a new reader shows up while this is running?
+  for (uint64_t r = 0; r < num_readers; r++){
+    uint32_t read_cycles, read_pointer;
+    UNPACK64(read_cycles, read_pointer, *q->read_pointers[r]);
+
+    bool overwritten;
+    if (wrap_pointer == -1){
+      overwritten = (read_pointer >= start) && (read_pointer < write_pointer) && (read_cycles != write_cycles);
+    } else {
+      // Up to and beyond the wraparound tag, and the start of the queue after wrapping around
+      bool before_wrap = (read_pointer >= start) && (read_pointer != wrap_pointer) && (read_cycles != start_cycles);
+      bool after_wrap = (read_pointer < write_pointer) && (read_cycles != write_cycles);
+      overwritten = before_wrap || after_wrap;
+    }
+
+    if (overwritten){
+      *q->read_valids[r] = false;
+    }
+  }
+}
+
 int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+  return msgq_msg_sendv(msg, 1, q);
+}
+
+int msgq_msg_sendv(msgq_msg_t * msgs, size_t nmsgs, msgq_queue_t *q){
   // Die if we are no longer the active publisher
   if (q->write_uid_local != *q->write_uid){
     std::cout << "Killing old publisher: " << q->endpoint << std::endl;
@@ -224,78 +433,154 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
     return -1;
   }
 
-  uint64_t total_msg_size = ALIGN(msg->size + sizeof(int64_t));
+  int total_size = 0;
+  size_t i = 0;
 
-  // We need to fit at least three messages in the queue,
-  // then we can always safely access the last message
-  assert(3 * total_msg_size <= q->size);
+  while (i < nmsgs){
+    uint64_t num_readers = *q->num_readers;
 
-  uint64_t num_readers = *q->num_readers;
+    uint32_t write_cycles, write_pointer;
+    UNPACK64(write_cycles, write_pointer, *q->write_pointer);
 
-  uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+    uint32_t start_cycles = write_cycles;
+    uint32_t start = write_pointer;
+    int64_t wrap_pointer = -1;
 
-  char *p = q->data + write_pointer; // add base offset
+    // Find out where the batch ends up. Batches are limited to half the queue,
+    // then they wrap around at most once and never overwrite themselves
+    size_t batch_end = i;
+    uint64_t batch_size = 0;
+    for (; batch_end < nmsgs; batch_end++){
+      uint64_t total_msg_size = ALIGN(msgs[batch_end].size + sizeof(int64_t));
 
-  // Check remaining space
-  // Always leave space for a wraparound tag for the next message, including alignment
-  int64_t remaining_space = q->size - write_pointer - total_msg_size - sizeof(int64_t);
-  if (remaining_space <= 0){
-    // Write -1 size tag indicating wraparound
-    *(int64_t*)p = -1;
+      // We need to fit at least three messages in the queue,
+      // then we can always safely access the last message
+      assert(3 * total_msg_size <= q->size);
 
-    // Invalidate all readers that are beyond the write pointer
-    // TODO: should we handle the case where a new reader shows up while this is running?
-    for (uint64_t i = 0; i < num_readers; i++){
-      uint64_t read_pointer = *q->read_pointers[i];
-      uint64_t read_cycles = read_pointer >> 32;
-      read_pointer &= 0xFFFFFFFF;
+      if (batch_end > i && batch_size + total_msg_size > q->size / 2){
+        break;
+      }
 
-      if ((read_pointer > write_pointer) && (read_cycles != write_cycles)) {
-        *q->read_valids[i] = false;
+      // Check remaining space
+      // Always leave space for a wraparound tag for the next message, including alignment
+      int64_t remaining_space = q->size - write_pointer - total_msg_size - sizeof(int64_t);
+      if (remaining_space <= 0){
+        if (wrap_pointer != -1){
+          break;
+        }
+        wrap_pointer = write_pointer;
+        write_pointer = 0;
+        write_cycles = write_cycles + 1;
       }
+
+      write_pointer += total_msg_size;
+      batch_size += total_msg_size;
     }
 
-    // Update global and local copies of write pointer and write_cycles
-    write_pointer = 0;
-    write_cycles = write_cycles + 1;
+    // Invalidate readers that are in the area that will be written, in a single pass for the whole batch
+    msgq_invalidate_readers(q, num_readers, start_cycles, start, wrap_pointer, write_cycles, write_pointer);
+
+    uint32_t ptr = start;
+    for (size_t j = i; j < batch_end; j++){
+      msgq_msg_t *msg = &msgs[j];
+      uint64_t total_msg_size = ALIGN(msg->size + sizeof(int64_t));
+
+      int64_t remaining_space = q->size - ptr - total_msg_size - sizeof(int64_t);
+      if (remaining_space <= 0){
+        // Write -1 size tag indicating wraparound
+        *(int64_t*)(q->data + ptr) = -1;
+        ptr = 0;
+      }
+
+      char *p = q->data + ptr;
+
+      // Write size tag
+      std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
+      *size_p = msg->size;
+
+      // Copy data
+      memcpy(p + sizeof(int64_t), msg->data, msg->size);
+
+      ptr += total_msg_size;
+      total_size += msg->size;
+    }
+    assert(ptr == write_pointer);
+    __sync_synchronize();
+
+    // Update write pointer, this publishes the whole batch at once
     PACK64(*q->write_pointer, write_cycles, write_pointer);
 
-    // Set actual pointer to the beginning of the data segment
-    p = q->data;
+    // Notify readers
+    msgq_notify_readers(q, num_readers);
+
+    i = batch_end;
   }
 
-  // Invalidate readers that are in the area that will be written
-  uint64_t start = write_pointer;
-  uint64_t end = ALIGN(start + sizeof(int64_t) + msg->size);
+  return total_size;
+}
 
-  for (uint64_t i = 0; i < num_readers; i++){
-    uint32_t read_cycles, read_pointer;
-    UNPACK64(read_cycles, read_pointer, *q->read_pointers[i]);
 
-    if ((read_pointer >= start) && (read_pointer < end) && (read_cycles != write_cycles)) {
-      *q->read_valids[i] = false;
-    }
+int msgq_msg_reserve(msgq_msg_t *msg, size_t size, msgq_queue_t *q){
+  // Die if we are no longer the active publisher
+  if (q->write_uid_local != *q->write_uid){
+    std::cout << "Killing old publisher: " << q->endpoint << std::endl;
+    errno = EADDRINUSE;
+    return -1;
+  }
+
+  uint64_t num_readers = *q->num_readers;
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  uint32_t start_cycles = write_cycles;
+  uint32_t start = write_pointer;
+  int64_t wrap_pointer = -1;
+
+  uint64_t total_msg_size = ALIGN(size + sizeof(int64_t));
+  assert(3 * total_msg_size <= q->size);
+
+  int64_t remaining_space = q->size - write_pointer - total_msg_size - sizeof(int64_t);
+  if (remaining_space <= 0){
+    wrap_pointer = write_pointer;
+    write_pointer = 0;
+    write_cycles = write_cycles + 1;
   }
 
+  // Readers in the slot are invalidated now, before the caller starts writing into it
+  msgq_invalidate_readers(q, num_readers, start_cycles, start, wrap_pointer, write_cycles, write_pointer + total_msg_size);
+
+  if (wrap_pointer != -1){
+    // Write -1 size tag indicating wraparound
+    *(int64_t*)(q->data + wrap_pointer) = -1;
+  }
 
-  // Write size tag
+  char *p = q->data + write_pointer;
   std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
-  *size_p = msg->size;
+  *size_p = size;
 
-  // Copy data
-  memcpy(p + sizeof(int64_t), msg->data, msg->size);
-  __sync_synchronize();
+  msg->data = p + sizeof(int64_t);
+  msg->size = size;
+  return 0;
+}
 
-  // Update write pointer
-  uint32_t new_ptr = ALIGN(write_pointer + msg->size + sizeof(int64_t));
-  PACK64(*q->write_pointer, write_cycles, new_ptr);
+int msgq_msg_commit(msgq_msg_t *msg, msgq_queue_t *q){
+  uint64_t num_readers = *q->num_readers;
 
-  // Notify readers
-  for (uint64_t i = 0; i < num_readers; i++){
-    uint64_t reader_uid = *q->read_uids[i];
-    thread_signal(reader_uid & 0xFFFFFFFF);
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  // The slot is either at the write pointer or at the start of the queue after wrapping around
+  uint32_t ptr = msg->data - sizeof(int64_t) - q->data;
+  assert(ptr == write_pointer || ptr == 0);
+  if (ptr != write_pointer){
+    write_cycles = write_cycles + 1;
   }
+  write_pointer = ptr + ALIGN(msg->size + sizeof(int64_t));
+  __sync_synchronize();
+
+  PACK64(*q->write_pointer, write_cycles, write_pointer);
+  msgq_notify_readers(q, num_readers);
 
   return msg->size;
 }
@@ -318,17 +603,17 @@ int msgq_msg_ready(msgq_queue_t * q){
     goto start;
   }
 
-  uint32_t read_cycles, read_pointer;
-  UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
+  *q->read_times[id] = msgq_nanos();
 
-  uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+  // Only the pointers, the cycles don't matter here
+  uint32_t read_pointer = *q->read_pointers[id] & 0xFFFFFFFF;
+  uint32_t write_pointer = *q->write_pointer & 0xFFFFFFFF;
 
   // Check if new message is available
   return (read_pointer != write_pointer);
 }
 
-int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+int msgq_msg_peek(msgq_msg_t * msg, msgq_queue_t * q){
  start:
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
@@ -345,11 +630,12 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     goto start;
   }
 
+  *q->read_times[id] = msgq_nanos();
+
   uint32_t read_cycles, read_pointer;
   UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
 
-  uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+  uint32_t write_pointer = *q->write_pointer & 0xFFFFFFFF;
 
   char * p = q->data + read_pointer;
 
@@ -392,33 +678,112 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     }
   }
 
-  // Copy message
-  if (msgq_msg_init_size(msg, size) < 0)
-    return -1;
-
+  // Hand out the message in place, the read pointer stays on it until it is released
+  // so the publisher invalidates this reader if it overwrites the borrowed data
   __sync_synchronize();
-  memcpy(msg->data, p + sizeof(int64_t), size);
+  msg->data = p + sizeof(int64_t);
+  msg->size = size;
+  q->peek_read_pointer = ((uint64_t)read_cycles << 32) | new_read_pointer;
+
+  return msg->size;
+}
+
+bool msgq_msg_release(msgq_msg_t * msg, msgq_queue_t * q){
+  int id = q->reader_id;
+  assert(id >= 0); // Make sure subscriber is initialized
+  assert(msg->size > 0);
+
   __sync_synchronize();
 
   // Update read pointer
-  PACK64(*q->read_pointers[id], read_cycles, new_read_pointer);
+  *q->read_pointers[id] = q->peek_read_pointer;
 
-  // Check if the actual data that was copied is valid
-  if (!*q->read_valids[id]){
+  msg->data = NULL;
+  msg->size = 0;
+
+  // Check if the data that was read in place is still valid
+  if (q->read_uid_local != *q->read_uids[id] || !*q->read_valids[id]){
+    return false;
+  }
+  return true;
+}
+
+int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+  while (true) {
+    msgq_msg_t view;
+    int size = msgq_msg_peek(&view, q);
+    if (size <= 0){
+      msg->size = 0;
+      return size;
+    }
+
+    // Copy message
+    if (msgq_msg_init_size(msg, size) < 0)
+      return -1;
+
+    memcpy(msg->data, view.data, size);
+
+    // Check if the actual data that was copied is valid
+    if (msgq_msg_release(&view, q)){
+      return msg->size;
+    }
     msgq_msg_close(msg);
-    msgq_reset_reader(q);
-    goto start;
   }
+}
 
 
-  return msg->size;
+static void msgq_set_wakeup(msgq_queue_t *q, uint64_t wakeup){
+  int id = q->reader_id;
+  if (id >= 0 && q->read_uid_local == *q->read_uids[id] && *q->read_wakeups[id] != wakeup){
+    *q->read_wakeups[id] = wakeup;
+  }
 }
 
+static int msgq_poll_futex(msgq_pollitem_t * item, int timeout){
+  msgq_queue_t *q = item->q;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+  while (true) {
+    // Publishers check the wakeup mode after moving the write pointer,
+    // so either they wake the futex, or we see the message below
+    msgq_set_wakeup(q, MSGQ_WAKEUP_FUTEX);
+    uint32_t seq = *q->futex;
+
+    item->revents = msgq_msg_ready(q);
+    if (item->revents || timeout == 0) break;
+
+    // Wake up at least every 100 ms, like the signal based poll
+    int ms = 100;
+    if (timeout != -1){
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      if (remaining <= 0) break;
+      ms = std::min<int>(ms, remaining);
+    }
+
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000 * 1000;
 
+    q->futex_waiters->fetch_add(1);
+    msgq_futex_wait(q->futex, seq, &ts);
+    q->futex_waiters->fetch_sub(1);
+  }
+
+  return item->revents ? 1 : 0;
+}
 
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
+  // A futex can only wait on a single queue, polls over multiple queues rely on signals
+  if (nitems == 1 && msgq_use_futex()){
+    return msgq_poll_futex(&items[0], timeout);
+  }
+
   int num = 0;
 
+  for (size_t i = 0; i < nitems; i++) {
+    msgq_set_wakeup(items[i].q, MSGQ_WAKEUP_SIGNAL);
+  }
+
   // Check if messages ready
   for (size_t i = 0; i < nitems; i++) {
     items[i].revents = msgq_msg_ready(items[i].q);
@@ -450,6 +815,129 @@ int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
     }
   }
 
+  // Publishers only signal readers that are waiting in a poll
+  for (size_t i = 0; i < nitems; i++) {
+    msgq_set_wakeup(items[i].q, MSGQ_WAKEUP_NONE);
+  }
+
+  return num;
+}
+
+int msgq_poller_init(msgq_poller_t *p){
+  msgq_doorbell_t *doorbells = msgq_doorbells();
+  if (doorbells == NULL || !msgq_use_futex()){
+    return -1;
+  }
+
+  // Take a free doorbell, or one left behind by a process that died
+  uint64_t pid = getpid();
+  for (int i = 0; i < MSGQ_NUM_DOORBELLS; i++){
+    auto owner = reinterpret_cast<std::atomic<uint64_t>*>(&doorbells[i].owner);
+    uint64_t cur = *owner;
+    if (cur != 0 && (kill(cur, 0) == 0 || errno != ESRCH)){
+      continue;
+    }
+
+    if (std::atomic_compare_exchange_strong(owner, &cur, pid)){
+      p->slot = i;
+      p->doorbell = &doorbells[i];
+      for (int w = 0; w < MSGQ_DOORBELL_WORDS; w++){
+        reinterpret_cast<std::atomic<uint64_t>*>(&p->doorbell->ready[w])->store(0);
+        p->pending[w] = 0;
+      }
+      p->queues.clear();
+      p->last_scan = msgq_nanos();
+      return 0;
+    }
+  }
+
+  std::cout << "Warning, no free msgq doorbells" << std::endl;
+  return -1;
+}
+
+void msgq_poller_close(msgq_poller_t *p){
+  // Queues may already be closed, publishers ringing a released doorbell cause no harm
+  auto owner = reinterpret_cast<std::atomic<uint64_t>*>(&p->doorbell->owner);
+  owner->store(0);
+  p->doorbell = NULL;
+}
+
+int msgq_poller_add(msgq_poller_t *p, msgq_queue_t *q){
+  int idx = p->queues.size();
+  if (idx >= MSGQ_DOORBELL_BITS){
+    return -1;
+  }
+  assert(q->reader_id >= 0); // Make sure subscriber is initialized
+
+  q->read_doorbell_local = ((uint64_t)(p->slot + 1) << 32) | idx;
+  *q->read_doorbells[q->reader_id] = q->read_doorbell_local;
+  *q->read_wakeups[q->reader_id] = MSGQ_WAKEUP_NONE;
+
+  p->queues.push_back(q);
+
+  // Check it on the next poll, it might already have messages
+  p->pending[idx / 64] |= 1ULL << (idx % 64);
+  return idx;
+}
+
+int msgq_poller_poll(msgq_poller_t *p, int *ready, int timeout){
+  auto futex = reinterpret_cast<std::atomic<uint32_t>*>(&p->doorbell->futex);
+  auto futex_waiters = reinterpret_cast<std::atomic<uint32_t>*>(&p->doorbell->futex_waiters);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+  uint64_t candidates[MSGQ_DOORBELL_WORDS];
+  memcpy(candidates, p->pending, sizeof(candidates));
+
+  int num = 0;
+  while (true){
+    uint32_t seq = *futex;
+
+    for (int w = 0; w < MSGQ_DOORBELL_WORDS; w++){
+      candidates[w] |= reinterpret_cast<std::atomic<uint64_t>*>(&p->doorbell->ready[w])->exchange(0);
+    }
+
+    uint64_t now = msgq_nanos();
+    if (now - p->last_scan > 100 * 1000 * 1000ULL){
+      for (size_t i = 0; i < p->queues.size(); i++){
+        candidates[i / 64] |= 1ULL << (i % 64);
+      }
+      p->last_scan = now;
+    }
+
+    // Only the queues that were rung, or still had messages last time
+    for (int w = 0; w < MSGQ_DOORBELL_WORDS; w++){
+      p->pending[w] = 0;
+      while (candidates[w]){
+        int bit = __builtin_ctzll(candidates[w]);
+        candidates[w] &= candidates[w] - 1;
+
+        size_t idx = w * 64 + bit;
+        if (idx < p->queues.size() && msgq_msg_ready(p->queues[idx])){
+          ready[num++] = idx;
+          p->pending[w] |= 1ULL << bit;
+        }
+      }
+    }
+
+    if (num > 0 || timeout == 0) break;
+
+    // Wake up at least every 100 ms, like the signal based poll
+    int ms = 100;
+    if (timeout != -1){
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      if (remaining <= 0) break;
+      ms = std::min<int>(ms, remaining);
+    }
+
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000 * 1000;
+
+    futex_waiters->fetch_add(1);
+    msgq_futex_wait(futex, seq, &ts);
+    futex_waiters->fetch_sub(1);
+  }
+
   return num;
 }
 
@@ -462,3 +950,32 @@ bool msgq_all_readers_updated(msgq_queue_t *q) {
   }
   return num_readers > 0;
 }
+
+size_t msgq_get_reader_stats(msgq_queue_t *q, msgq_reader_stats_t *stats, size_t max_stats) {
+  uint64_t now = msgq_nanos();
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  size_t n = std::min<size_t>(*q->num_readers, max_stats);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t read_cycles, read_pointer;
+    UNPACK64(read_cycles, read_pointer, *q->read_pointers[i]);
+
+    msgq_reader_stats_t &s = stats[i];
+    s.uid = *q->read_uids[i];
+    s.valid = *q->read_valids[i];
+    s.evictions = *q->read_evictions[i];
+
+    uint64_t t = *q->read_times[i];
+    s.idle_ns = (t != 0 && now > t) ? now - t : 0;
+
+    if (read_cycles == write_cycles) {
+      s.lag_bytes = write_pointer - read_pointer;
+    } else if (read_cycles + 1 == write_cycles && read_pointer >= write_pointer) {
+      s.lag_bytes = q->size - read_pointer + write_pointer;
+    } else {
+      s.lag_bytes = q->size;
+    }
+  }
+  return n;
+}
@@ -1,11 +1,29 @@
 #pragma once
 #include <cstdint>
 #include <cstring>
+#include <ctime>
 #include <string>
 #include <atomic>
+#include <vector>
 
 #define DEFAULT_SEGMENT_SIZE (10 * 1024 * 1024)
-#define NUM_READERS 10
+#define DEFAULT_NUM_READERS 10
+
+// How a reader wants to be woken up when a new message is published. Readers that aren't
+// waiting in a poll, or are woken by their poller's doorbell, don't need a wakeup
+#define MSGQ_WAKEUP_SIGNAL 0
+#define MSGQ_WAKEUP_FUTEX 1
+#define MSGQ_WAKEUP_NONE 2
+
+// Pollers get a doorbell in a table shared by all processes, publishers mark their queue in it
+#define MSGQ_NUM_DOORBELLS 256
+#define MSGQ_DOORBELL_BITS 256
+#define MSGQ_DOORBELL_WORDS (MSGQ_DOORBELL_BITS / 64)
+
+// When all reader slots are taken, a new subscriber replaces the least recently used reader. It
+// warns if that reader read within this long, as it was likely still active
+#define MSGQ_READER_IDLE_NS (1000ULL * 1000 * 1000)
+
 #define ALIGN(n) ((n + (8 - 1)) & -8)
 
 #define UNPACK64(higher, lower, input) do {uint64_t tmp = input; higher = tmp >> 32; lower = tmp & 0xFFFFFFFF;} while (0)
@@ -13,26 +31,51 @@
 
 struct  msgq_header_t {
   uint64_t num_readers;
+  uint64_t max_readers;
   uint64_t write_pointer;
   uint64_t write_uid;
-  uint64_t read_pointers[NUM_READERS];
-  uint64_t read_valids[NUM_READERS];
-  uint64_t read_uids[NUM_READERS];
+  uint64_t num_evictions;
+  uint32_t futex;
+  uint32_t futex_waiters;
+  // Followed by the reader table, max_readers entries for each msgq_reader_fields
+};
+
+// Per reader fields stored after the header, each as an array of max_readers uint64_t
+enum msgq_reader_fields {
+  READ_POINTERS,
+  READ_VALIDS,
+  READ_UIDS,
+  READ_WAKEUPS,
+  READ_TIMES,
+  READ_EVICTIONS,
+  READ_DOORBELLS,
+  NUM_READER_FIELDS,
 };
 
 struct msgq_queue_t {
   std::atomic<uint64_t> *num_readers;
+  std::atomic<uint64_t> *max_readers;
   std::atomic<uint64_t> *write_pointer;
   std::atomic<uint64_t> *write_uid;
-  std::atomic<uint64_t> *read_pointers[NUM_READERS];
-  std::atomic<uint64_t> *read_valids[NUM_READERS];
-  std::atomic<uint64_t> *read_uids[NUM_READERS];
+  std::atomic<uint64_t> *num_evictions;
+  std::atomic<uint32_t> *futex;
+  std::atomic<uint32_t> *futex_waiters;
+  std::vector<std::atomic<uint64_t> *> read_pointers;
+  std::vector<std::atomic<uint64_t> *> read_valids;
+  std::vector<std::atomic<uint64_t> *> read_uids;
+  std::vector<std::atomic<uint64_t> *> read_wakeups;
+  std::vector<std::atomic<uint64_t> *> read_times;
+  std::vector<std::atomic<uint64_t> *> read_evictions;
+  std::vector<std::atomic<uint64_t> *> read_doorbells;
   char * mmap_p;
   char * data;
   size_t size;
+  size_t header_size;
   int reader_id;
   uint64_t read_uid_local;
   uint64_t write_uid_local;
+  uint64_t peek_read_pointer;
+  uint64_t read_doorbell_local;
 
   bool read_conflate;
   std::string endpoint;
@@ -48,6 +91,36 @@ struct msgq_pollitem_t {
   int revents;
 };
 
+struct msgq_doorbell_t {
+  uint64_t owner; // pid of the poller, 0 if unused
+  uint32_t futex;
+  uint32_t futex_waiters;
+  uint64_t ready[MSGQ_DOORBELL_WORDS];
+};
+
+// Poller that only looks at queues which were published to, instead of scanning all of them
+struct msgq_poller_t {
+  int slot;
+  msgq_doorbell_t *doorbell;
+  std::vector<msgq_queue_t *> queues;
+  // Queues returned by the last poll, they might still have unread messages
+  uint64_t pending[MSGQ_DOORBELL_WORDS];
+  // All queues are checked every now and then, so readers notice when their publisher restarted
+  uint64_t last_scan;
+};
+
+struct msgq_reader_stats_t {
+  uint64_t uid;
+  bool valid;
+  uint64_t lag_bytes; // Unread bytes between the read and write pointer
+  uint64_t idle_ns; // Time since the reader last checked the queue
+  uint64_t evictions; // Readers that were replaced in this slot
+};
+
+bool msgq_use_futex();
+// Futex on a word in shared memory, the wait is a plain sleep where futexes are not available
+int msgq_futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, const struct timespec *ts);
+void msgq_futex_wake(std::atomic<uint32_t> *addr);
 void msgq_wait_for_subscriber(msgq_queue_t *q);
 void msgq_reset_reader(msgq_queue_t *q);
 
@@ -55,14 +128,34 @@ int msgq_msg_init_size(msgq_msg_t *msg, size_t size);
 int msgq_msg_init_data(msgq_msg_t *msg, char * data, size_t size);
 int msgq_msg_close(msgq_msg_t *msg);
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size);
+// Fails if the queue exists with another size or number of reader slots, unless publisher is set,
+// then the file is replaced
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t max_readers = DEFAULT_NUM_READERS, bool publisher = false);
 void msgq_close_queue(msgq_queue_t *q);
 void msgq_init_publisher(msgq_queue_t * q);
 void msgq_init_subscriber(msgq_queue_t * q);
 
 int msgq_msg_send(msgq_msg_t *msg, msgq_queue_t *q);
+// Publishes nmsgs messages with a single reader invalidation pass, write pointer update and wakeup
+int msgq_msg_sendv(msgq_msg_t *msgs, size_t nmsgs, msgq_queue_t *q);
+// Zero-copy send. msgq_msg_reserve points msg->data at a slot of size bytes in the shared segment
+// (8 byte aligned), msgq_msg_commit publishes it. Nothing else may be sent in between.
+int msgq_msg_reserve(msgq_msg_t *msg, size_t size, msgq_queue_t *q);
+int msgq_msg_commit(msgq_msg_t *msg, msgq_queue_t *q);
 int msgq_msg_recv(msgq_msg_t *msg, msgq_queue_t *q);
+// Zero-copy receive. msg->data points into the shared segment (8 byte aligned) and must not be closed.
+// msgq_msg_release moves past the message and returns false if it was overwritten while borrowed,
+// in that case everything read from it has to be discarded.
+int msgq_msg_peek(msgq_msg_t *msg, msgq_queue_t *q);
+bool msgq_msg_release(msgq_msg_t *msg, msgq_queue_t *q);
 int msgq_msg_ready(msgq_queue_t * q);
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout);
 
+int msgq_poller_init(msgq_poller_t *p);
+void msgq_poller_close(msgq_poller_t *p);
+int msgq_poller_add(msgq_poller_t *p, msgq_queue_t *q);
+// Fills ready with the indices of the queues that have messages, returns how many
+int msgq_poller_poll(msgq_poller_t *p, int *ready, int timeout);
+
 bool msgq_all_readers_updated(msgq_queue_t *q);
+size_t msgq_get_reader_stats(msgq_queue_t *q, msgq_reader_stats_t *stats, size_t max_stats);
@@ -0,0 +1,203 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "msgq.h"
+
+// Benchmarks for msgq, run as ./msgq_bench [latency|throughput|poll]
+
+static inline uint64_t nanos_monotonic() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void print_stats(const char *name, std::vector<uint64_t> &samples) {
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  printf("%-8s n=%zu median=%.1fus p90=%.1fus p99=%.1fus max=%.1fus\n", name, n,
+         samples[n / 2] / 1e3, samples[n * 9 / 10] / 1e3, samples[n * 99 / 100] / 1e3, samples[n - 1] / 1e3);
+}
+
+// Publish timestamped messages from this process to a forked subscriber,
+// which blocks in msgq_poll and records the publish -> wakeup latency.
+static void bench_latency(bool use_futex, int count, int interval_us) {
+  const char *endpoint = "msgq_bench_latency";
+  msgq_queue_t pub;
+  msgq_new_queue(&pub, endpoint, DEFAULT_SEGMENT_SIZE);
+  msgq_init_publisher(&pub);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    // msgq_use_futex reads the environment once per process
+    if (use_futex) {
+      unsetenv("MSGQ_SIGNAL");
+    } else {
+      setenv("MSGQ_SIGNAL", "1", 1);
+    }
+
+    msgq_queue_t sub;
+    msgq_new_queue(&sub, endpoint, DEFAULT_SEGMENT_SIZE);
+    msgq_init_subscriber(&sub);
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count);
+    while (latencies.size() < (size_t)count) {
+      msgq_pollitem_t item = {.q = &sub};
+      if (msgq_poll(&item, 1, -1) == 0) continue;
+
+      msgq_msg_t msg;
+      while (msgq_msg_recv(&msg, &sub) > 0) {
+        uint64_t sent;
+        memcpy(&sent, msg.data, sizeof(sent));
+        latencies.push_back(nanos_monotonic() - sent);
+        msgq_msg_close(&msg);
+      }
+    }
+
+    print_stats(use_futex ? "futex" : "signal", latencies);
+    msgq_close_queue(&sub);
+    exit(0);
+  }
+
+  msgq_wait_for_subscriber(&pub);
+  usleep(100 * 1000);
+
+  for (int i = 0; i < count; i++) {
+    uint64_t now = nanos_monotonic();
+    msgq_msg_t msg = {.size = sizeof(now), .data = (char *)&now};
+    msgq_msg_send(&msg, &pub);
+    usleep(interval_us);
+  }
+
+  waitpid(pid, NULL, 0);
+  msgq_close_queue(&pub);
+  unlink((std::string("/dev/shm/") + endpoint).c_str());
+}
+
+// Publish bursts of messages one by one and with msgq_msg_sendv, with a few
+// subscribers attached so the reader invalidation and wakeup checks are accounted for.
+static void bench_throughput(size_t msg_size, size_t batch, int count) {
+  const char *endpoint = "msgq_bench_throughput";
+  const int num_readers = 4;
+
+  msgq_queue_t pub, subs[num_readers];
+  msgq_new_queue(&pub, endpoint, DEFAULT_SEGMENT_SIZE);
+  msgq_init_publisher(&pub);
+  for (auto &sub : subs) {
+    msgq_new_queue(&sub, endpoint, DEFAULT_SEGMENT_SIZE);
+    // The subscribers aren't in a poll, so their wakeup stays MSGQ_WAKEUP_NONE and publishing
+    // doesn't signal them, like readers between polls
+    msgq_init_subscriber(&sub);
+  }
+
+  std::vector<char> data(msg_size);
+  std::vector<msgq_msg_t> msgs(batch, {.size = msg_size, .data = data.data()});
+
+  uint64_t start = nanos_monotonic();
+  for (int i = 0; i < count; i += batch) {
+    for (auto &msg : msgs) {
+      msgq_msg_send(&msg, &pub);
+    }
+  }
+  double single = count / ((nanos_monotonic() - start) / 1e9);
+
+  start = nanos_monotonic();
+  for (int i = 0; i < count; i += batch) {
+    msgq_msg_sendv(msgs.data(), msgs.size(), &pub);
+  }
+  double batched = count / ((nanos_monotonic() - start) / 1e9);
+
+  printf("size=%-6zu batch=%-4zu send: %.0f msg/s  sendv: %.0f msg/s  (%.1fx)\n", msg_size, batch, single, batched, batched / single);
+
+  for (auto &sub : subs) msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+  unlink((std::string("/dev/shm/") + endpoint).c_str());
+}
+
+// Cost of a poll over many registered queues when only one of them is being published to,
+// scanning every queue with msgq_poll against checking the rung doorbell bits.
+static void bench_poll(int num_queues, int count) {
+  std::vector<msgq_queue_t> pubs(num_queues), subs(num_queues);
+  std::vector<msgq_pollitem_t> items(num_queues);
+
+  msgq_poller_t poller;
+  if (msgq_poller_init(&poller) != 0) {
+    fprintf(stderr, "doorbells not available\n");
+    return;
+  }
+
+  for (int i = 0; i < num_queues; i++) {
+    std::string endpoint = "msgq_bench_poll_" + std::to_string(i);
+    msgq_new_queue(&pubs[i], endpoint.c_str(), 1024 * 1024);
+    msgq_new_queue(&subs[i], endpoint.c_str(), 1024 * 1024);
+    msgq_init_publisher(&pubs[i]);
+    msgq_init_subscriber(&subs[i]);
+    items[i].q = &subs[i];
+    msgq_poller_add(&poller, &subs[i]);
+  }
+
+  char data[64] = {};
+  msgq_msg_t msg = {.size = sizeof(data), .data = data};
+  msgq_queue_t &hot_pub = pubs[num_queues / 2];
+  msgq_queue_t &hot_sub = subs[num_queues / 2];
+
+  auto run = [&](const char *name, auto poll_fn) {
+    std::vector<uint64_t> samples;
+    for (int i = 0; i < count; i++) {
+      msgq_msg_send(&msg, &hot_pub);
+
+      uint64_t start = nanos_monotonic();
+      int n = poll_fn();
+      samples.push_back(nanos_monotonic() - start);
+      assert(n == 1);
+
+      msgq_msg_t recv_msg;
+      msgq_msg_recv(&recv_msg, &hot_sub);
+      msgq_msg_close(&recv_msg);
+    }
+    print_stats(name, samples);
+  };
+
+  printf("%d queues, one hot\n", num_queues);
+  run("scan", [&]() { return msgq_poll(items.data(), items.size(), -1); });
+  std::vector<int> ready(num_queues);
+  run("doorbell", [&]() { return msgq_poller_poll(&poller, ready.data(), -1); });
+
+  msgq_poller_close(&poller);
+  for (int i = 0; i < num_queues; i++) {
+    msgq_close_queue(&pubs[i]);
+    msgq_close_queue(&subs[i]);
+    unlink(("/dev/shm/msgq_bench_poll_" + std::to_string(i)).c_str());
+  }
+}
+
+int main(int argc, char *argv[]) {
+  std::string bench = argc > 1 ? argv[1] : "latency";
+
+  if (bench == "latency") {
+    // 100 Hz, like can and carState
+    bench_latency(false, 1000, 10000);
+    bench_latency(true, 1000, 10000);
+  } else if (bench == "throughput") {
+    for (size_t size : {64, 1024, 16 * 1024}) {
+      for (size_t batch : {10, 100, 500}) {
+        bench_throughput(size, batch, 100000);
+      }
+    }
+  } else if (bench == "poll") {
+    bench_poll(150, 10000);
+  } else {
+    fprintf(stderr, "unknown benchmark %s\n", bench.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,413 @@
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "catch2/catch.hpp"
+#include "msgq.h"
+
+// Removes a test queue before and after the test, other tests may use the name with another size
+struct TestQueueFile {
+  TestQueueFile(const std::string &name) : path("/dev/shm/" + name) { unlink(path.c_str()); }
+  ~TestQueueFile() { unlink(path.c_str()); }
+  std::string path;
+};
+
+TEST_CASE("msgq_poll with futex wakes up a thread that did not subscribe"){
+  TestQueueFile file("test_queue");
+  if (!msgq_use_futex()) return;
+
+  msgq_queue_t writer, reader;
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  std::atomic<bool> woken(false);
+  std::thread t([&](){
+    msgq_pollitem_t item = {.q = &reader};
+    // Long timeout, returning early means the futex wake arrived
+    int n = msgq_poll(&item, 1, 5000);
+    woken = (n == 1 && item.revents);
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  REQUIRE(*reader.read_wakeups[reader.reader_id] == MSGQ_WAKEUP_FUTEX);
+
+  auto start = std::chrono::steady_clock::now();
+  char data[] = "test";
+  msgq_msg_t msg = {.size = sizeof(data), .data = data};
+  msgq_msg_send(&msg, &writer);
+  t.join();
+
+  REQUIRE(woken);
+  REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(50));
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("msgq_poll with multiple queues falls back to signals"){
+  TestQueueFile file("test_queue");
+  msgq_queue_t writer, reader1, reader2;
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader1, "test_queue", 1024);
+  msgq_new_queue(&reader2, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader1);
+  msgq_init_subscriber(&reader2);
+
+  msgq_pollitem_t items[2] = {{.q = &reader1}, {.q = &reader2}};
+  REQUIRE(msgq_poll(items, 2, 0) == 0);
+  // Signaled only while they wait in the poll
+  REQUIRE(*reader1.read_wakeups[reader1.reader_id] == MSGQ_WAKEUP_NONE);
+  REQUIRE(*reader2.read_wakeups[reader2.reader_id] == MSGQ_WAKEUP_NONE);
+
+  std::thread t([&](){
+    while (*reader1.read_wakeups[reader1.reader_id] != MSGQ_WAKEUP_SIGNAL) {}
+    char data[] = "test";
+    msgq_msg_t msg = {.size = sizeof(data), .data = data};
+    msgq_msg_send(&msg, &writer);
+  });
+  REQUIRE(msgq_poll(items, 2, 5000) == 2);
+  t.join();
+  msgq_msg_t recv_msg;
+  for (auto r : {&reader1, &reader2}) {
+    REQUIRE(msgq_msg_recv(&recv_msg, r) > 0);
+    msgq_msg_close(&recv_msg);
+  }
+
+  char data[] = "test";
+  msgq_msg_t msg = {.size = sizeof(data), .data = data};
+  msgq_msg_send(&msg, &writer);
+  REQUIRE(msgq_poll(items, 2, 0) == 2);
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader1);
+  msgq_close_queue(&reader2);
+}
+
+TEST_CASE("msgq_msg_peek returns the message in place"){
+  TestQueueFile file("test_queue");
+  msgq_queue_t writer, reader;
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  char data[] = "test";
+  msgq_msg_t msg = {.size = sizeof(data), .data = data};
+  msgq_msg_send(&msg, &writer);
+
+  msgq_msg_t view;
+  REQUIRE(msgq_msg_peek(&view, &reader) == sizeof(data));
+  REQUIRE(view.data >= reader.data);
+  REQUIRE(view.data < reader.data + reader.size);
+  REQUIRE(((uintptr_t)view.data % 8) == 0);
+  REQUIRE(memcmp(view.data, data, sizeof(data)) == 0);
+
+  // Not released yet, so the same message is returned again
+  msgq_msg_t view2;
+  REQUIRE(msgq_msg_peek(&view2, &reader) == sizeof(data));
+  REQUIRE(view2.data == view.data);
+
+  REQUIRE(msgq_msg_release(&view, &reader));
+  REQUIRE(msgq_msg_peek(&view, &reader) == 0);
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("msgq_msg_release detects overwritten messages"){
+  TestQueueFile file("test_queue");
+  msgq_queue_t writer, reader;
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  char data[128] = {};
+  msgq_msg_t msg = {.size = sizeof(data), .data = data};
+  msgq_msg_send(&msg, &writer);
+
+  msgq_msg_t view;
+  REQUIRE(msgq_msg_peek(&view, &reader) == sizeof(data));
+
+  // Wrap around the queue and overwrite the borrowed message
+  for (int i = 0; i < 10; i++){
+    msgq_msg_send(&msg, &writer);
+  }
+
+  REQUIRE(!msgq_msg_release(&view, &reader));
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("Full reader table evicts the least recently used reader"){
+  TestQueueFile file("test_queue_readers");
+  msgq_queue_t writer, reader1, reader2, reader3;
+  REQUIRE(msgq_new_queue(&writer, "test_queue_readers", 1024, 2) == 0);
+  REQUIRE(msgq_new_queue(&reader1, "test_queue_readers", 1024, 2) == 0);
+  REQUIRE(msgq_new_queue(&reader2, "test_queue_readers", 1024, 2) == 0);
+  REQUIRE(msgq_new_queue(&reader3, "test_queue_readers", 1024, 2) == 0);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader1);
+  msgq_init_subscriber(&reader2);
+
+  // reader1 keeps checking the queue, reader2 doesn't
+  msgq_msg_ready(&reader1);
+  msgq_init_subscriber(&reader3);
+
+  REQUIRE(reader3.reader_id == reader2.reader_id);
+  REQUIRE(*writer.num_evictions == 1);
+  REQUIRE(*reader1.read_uids[reader1.reader_id] == reader1.read_uid_local);
+  REQUIRE(*reader2.read_uids[reader2.reader_id] != reader2.read_uid_local);
+
+  msgq_reader_stats_t stats[2];
+  REQUIRE(msgq_get_reader_stats(&writer, stats, 2) == 2);
+  REQUIRE(stats[reader3.reader_id].evictions == 1);
+  REQUIRE(stats[reader1.reader_id].evictions == 0);
+
+  // Closing a reader frees the slot without an eviction
+  msgq_close_queue(&reader1);
+  msgq_init_subscriber(&reader2);
+  REQUIRE(*writer.num_evictions == 1);
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader2);
+  msgq_close_queue(&reader3);
+}
+
+TEST_CASE("Opening a queue with another layout fails without resizing it"){
+  TestQueueFile file("test_queue_layout");
+  msgq_queue_t writer, other;
+  REQUIRE(msgq_new_queue(&writer, "test_queue_layout", 1024, 2) == 0);
+  size_t total = writer.size + writer.header_size;
+
+  REQUIRE(msgq_new_queue(&other, "test_queue_layout", 1024, 4) != 0);
+  REQUIRE(msgq_new_queue(&other, "test_queue_layout", 2048, 2) != 0);
+
+  struct stat st = {};
+  REQUIRE(stat("/dev/shm/test_queue_layout", &st) == 0);
+  REQUIRE((size_t)st.st_size == total);
+
+  REQUIRE(msgq_new_queue(&other, "test_queue_layout", 1024, 2) == 0);
+  msgq_close_queue(&writer);
+  msgq_close_queue(&other);
+}
+
+TEST_CASE("A publisher replaces a queue with another layout"){
+  TestQueueFile file("test_queue_layout");
+  msgq_queue_t old_queue, writer, reader;
+  REQUIRE(msgq_new_queue(&old_queue, "test_queue_layout", 1024, 2) == 0);
+  msgq_close_queue(&old_queue);
+
+  auto size = GENERATE(2048, 1024);
+  auto readers = size == 1024 ? 4 : 2;
+  REQUIRE(msgq_new_queue(&writer, "test_queue_layout", size, readers, true) == 0);
+  REQUIRE(msgq_new_queue(&reader, "test_queue_layout", size, readers) == 0);
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  char data[] = "test";
+  msgq_msg_t msg = {.size = sizeof(data), .data = data};
+  REQUIRE(msgq_msg_send(&msg, &writer) == sizeof(data));
+  msgq_msg_t recv_msg;
+  REQUIRE(msgq_msg_recv(&recv_msg, &reader) == sizeof(data));
+  msgq_msg_close(&recv_msg);
+
+  struct stat st = {};
+  REQUIRE(stat("/dev/shm/test_queue_layout", &st) == 0);
+  REQUIRE((size_t)st.st_size == writer.size + writer.header_size);
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("Reader stats report lag"){
+  TestQueueFile file("test_queue");
+  msgq_queue_t writer, reader;
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  char data[16] = {};
+  msgq_msg_t msg = {.size = sizeof(data), .data = data};
+  msgq_msg_send(&msg, &writer);
+  msgq_msg_send(&msg, &writer);
+
+  msgq_reader_stats_t stats;
+  REQUIRE(msgq_get_reader_stats(&writer, &stats, 1) == 1);
+  REQUIRE(stats.valid);
+  REQUIRE(stats.lag_bytes == 2 * ALIGN(sizeof(data) + sizeof(int64_t)));
+
+  msgq_msg_t recv_msg;
+  msgq_msg_recv(&recv_msg, &reader);
+  msgq_msg_close(&recv_msg);
+  msgq_get_reader_stats(&writer, &stats, 1);
+  REQUIRE(stats.lag_bytes == ALIGN(sizeof(data) + sizeof(int64_t)));
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("msgq_msg_sendv publishes all messages in order"){
+  TestQueueFile file("test_queue");
+  msgq_queue_t writer, reader;
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  // Enough messages to wrap around and split into multiple batches
+  const int n = 100;
+  uint64_t data[n];
+  msgq_msg_t msgs[n];
+  for (int i = 0; i < n; i++){
+    data[i] = i;
+    msgs[i] = {.size = sizeof(uint64_t), .data = (char*)&data[i]};
+  }
+
+  // Read in between, so the reader stays valid while the queue wraps around
+  for (int i = 0; i < n; i += 10){
+    REQUIRE(msgq_msg_sendv(&msgs[i], 10, &writer) == 10 * sizeof(uint64_t));
+
+    for (int j = i; j < i + 10; j++){
+      msgq_msg_t recv_msg;
+      REQUIRE(msgq_msg_recv(&recv_msg, &reader) == sizeof(uint64_t));
+      REQUIRE(*(uint64_t*)recv_msg.data == (uint64_t)j);
+      msgq_msg_close(&recv_msg);
+    }
+  }
+
+  // Larger than the queue, the reader gets invalidated and skips ahead
+  REQUIRE(msgq_msg_sendv(msgs, n, &writer) == n * sizeof(uint64_t));
+  msgq_msg_t recv_msg;
+  REQUIRE(msgq_msg_recv(&recv_msg, &reader) == 0);
+
+  uint64_t next = n;
+  msgq_msg_t msg = {.size = sizeof(uint64_t), .data = (char*)&next};
+  msgq_msg_send(&msg, &writer);
+  REQUIRE(msgq_msg_recv(&recv_msg, &reader) == sizeof(uint64_t));
+  REQUIRE(*(uint64_t*)recv_msg.data == n);
+  msgq_msg_close(&recv_msg);
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("msgq_msg_reserve writes in place and msgq_msg_commit publishes"){
+  TestQueueFile file("test_queue");
+  msgq_queue_t writer, reader;
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  // Enough messages to wrap around a few times
+  for (uint64_t i = 0; i < 100; i++){
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_reserve(&msg, 3 * sizeof(uint64_t), &writer) == 0);
+    REQUIRE((uintptr_t)msg.data % 8 == 0);
+    REQUIRE(msg.data > writer.data);
+    REQUIRE(msg.data + msg.size <= writer.data + writer.size);
+
+    for (int j = 0; j < 3; j++){
+      ((uint64_t*)msg.data)[j] = i + j;
+    }
+
+    // Not visible until committed
+    REQUIRE(msgq_msg_ready(&reader) == 0);
+    REQUIRE(msgq_msg_commit(&msg, &writer) == 3 * sizeof(uint64_t));
+
+    msgq_msg_t recv_msg;
+    REQUIRE(msgq_msg_recv(&recv_msg, &reader) == 3 * sizeof(uint64_t));
+    for (int j = 0; j < 3; j++){
+      REQUIRE(((uint64_t*)recv_msg.data)[j] == i + j);
+    }
+    msgq_msg_close(&recv_msg);
+  }
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("msgq_poller_poll only returns queues with messages"){
+  msgq_poller_t poller;
+  if (msgq_poller_init(&poller) != 0) return;
+
+  const int n = 3;
+  msgq_queue_t writers[n], readers[n];
+  std::vector<TestQueueFile> files;
+  files.reserve(n);
+  for (int i = 0; i < n; i++){
+    std::string endpoint = "test_queue_poller_" + std::to_string(i);
+    files.emplace_back(endpoint);
+    msgq_new_queue(&writers[i], endpoint.c_str(), 1024);
+    msgq_new_queue(&readers[i], endpoint.c_str(), 1024);
+    msgq_init_publisher(&writers[i]);
+    msgq_init_subscriber(&readers[i]);
+    REQUIRE(msgq_poller_add(&poller, &readers[i]) == i);
+  }
+
+  int ready[n];
+  REQUIRE(msgq_poller_poll(&poller, ready, 0) == 0);
+
+  char data[] = "test";
+  msgq_msg_t msg = {.size = sizeof(data), .data = data};
+  msgq_msg_send(&msg, &writers[1]);
+  REQUIRE(msgq_poller_poll(&poller, ready, 0) == 1);
+  REQUIRE(ready[0] == 1);
+
+  // Still unread, so it's returned again without another publish
+  REQUIRE(msgq_poller_poll(&poller, ready, 0) == 1);
+
+  msgq_msg_t recv_msg;
+  msgq_msg_recv(&recv_msg, &readers[1]);
+  msgq_msg_close(&recv_msg);
+  REQUIRE(msgq_poller_poll(&poller, ready, 0) == 0);
+
+  // Blocking poll is woken up by the publisher
+  std::thread t([&](){
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    msgq_msg_send(&msg, &writers[2]);
+  });
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(msgq_poller_poll(&poller, ready, 5000) == 1);
+  REQUIRE(ready[0] == 2);
+  REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1000));
+  t.join();
+
+  // A restarted publisher resets the reader table. The reader reconnects with its doorbell,
+  // and isn't signaled for every message
+  msgq_msg_recv(&recv_msg, &readers[2]);
+  msgq_msg_close(&recv_msg);
+  msgq_init_publisher(&writers[0]);
+  REQUIRE(msgq_msg_recv(&recv_msg, &readers[0]) == 0);
+  REQUIRE(*readers[0].read_doorbells[readers[0].reader_id] == readers[0].read_doorbell_local);
+  REQUIRE(*readers[0].read_wakeups[readers[0].reader_id] == MSGQ_WAKEUP_NONE);
+  msgq_msg_send(&msg, &writers[0]);
+  REQUIRE(msgq_poller_poll(&poller, ready, 0) == 1);
+  REQUIRE(ready[0] == 0);
+
+  msgq_poller_close(&poller);
+  for (int i = 0; i < n; i++){
+    msgq_close_queue(&writers[i]);
+    msgq_close_queue(&readers[i]);
+  }
+}
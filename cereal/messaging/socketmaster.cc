@@ -3,6 +3,11 @@
 #include <stdlib.h>
 #include <string>
 #include <mutex>
+#include <utility>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
 
 #include "services.h"
 #include "messaging.h"
@@ -15,11 +20,20 @@ static inline uint64_t nanos_since_boot() {
   return t.tv_sec * 1000000000ULL + t.tv_nsec;
 }
 
+// Service id by name, -1 for unknown names
+static int service_index(std::string_view name) {
+  static const std::unordered_map<std::string_view, int> index = []() {
+    std::unordered_map<std::string_view, int> m;
+    for (size_t i = 0; i < std::size(services); i++) m[services[i].name] = i;
+    return m;
+  }();
+  auto it = index.find(name);
+  return it == index.end() ? -1 : it->second;
+}
+
 static const service *get_service(const char *name) {
-  for (const auto &it : services) {
-    if (strcmp(it.name, name) == 0) return &it;
-  }
-  return nullptr;
+  int i = service_index(name);
+  return i < 0 ? nullptr : &services[i];
 }
 
 static inline bool inList(const std::vector<const char *> &list, const char *value) {
@@ -59,6 +73,7 @@ struct SubMaster::SubMessage {
 SubMaster::SubMaster(const std::vector<const char *> &service_list, const char *address,
                      const std::vector<const char *> &ignore_alive) {
   poller_ = Poller::create();
+  service_ids_.resize(std::size(services), nullptr);
   for (auto name : service_list) {
     const service *serv = get_service(name);
     assert(serv != nullptr);
@@ -72,56 +87,78 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const char *
       .ignore_alive = inList(ignore_alive, name),
       .allocated_msg_reader = malloc(sizeof(capnp::FlatArrayMessageReader))};
     m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
-    messages_[socket] = m;
-    services_[name] = m;
+    messages_.push_back(m);
+    service_ids_[serv - services] = m;
   }
+  ready_.reserve(service_list.size());
+}
+
+static std::vector<const char *> service_names(const std::vector<ServiceId> &ids) {
+  std::vector<const char *> names;
+  for (auto id : ids) names.push_back(services[(int)id].name);
+  return names;
 }
 
+SubMaster::SubMaster(const std::vector<ServiceId> &service_list, const char *address,
+                     const std::vector<ServiceId> &ignore_alive)
+    : SubMaster(service_names(service_list), address, service_names(ignore_alive)) {}
+
 void SubMaster::update(int timeout) {
-  for (auto &kv : messages_) kv.second->updated = false;
+  for (auto m : messages_) m->updated = false;
 
-  auto sockets = poller_->poll(timeout);
+  poller_->poll(timeout, ready_);
   uint64_t current_time = nanos_since_boot();
 
-  std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
+  if (++frame == UINT64_MAX) frame = 1;
 
-  for (auto s : sockets) {
-    Message *msg = s->receive(true);
-    if (msg == nullptr) continue;
+  for (int i : ready_) {
+    SubMessage *m = messages_[i];
+    SubSocket *s = m->socket;
+    auto view = s->receive_view();
+    if (view.size() == 0) continue;
 
-    SubMessage *m = messages_.at(s);
+    // Events are used until the next update, copy them out of the queue
+    // instead of holding on to the shared memory. The copy goes to a scratch buffer first,
+    // the last event of the service stays valid if the view was overwritten while copying
+    auto words = scratch_buf_.align((const char *)view.begin(), view.size() * sizeof(capnp::word));
+    if (!s->release_view()) continue;
 
+    std::swap(m->aligned_buf, scratch_buf_);
     m->msg_reader->~FlatArrayMessageReader();
     capnp::ReaderOptions options;
     options.traversalLimitInWords = kj::maxValue; // Don't limit
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
-    delete msg;
-    messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
+    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(words, options);
+    update_msg(m, current_time, m->msg_reader->getRoot<cereal::Event>());
   }
 
-  update_msgs(current_time, messages);
+  update_alive(current_time);
 }
 
-void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages){
+void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<ServiceId, cereal::Event::Reader>> &messages){
   if (++frame == UINT64_MAX) frame = 1;
 
   for(auto &kv : messages) {
-    auto m_find = services_.find(kv.first);
-    if (m_find == services_.end()){
-      continue;
+    SubMessage *m = service_ids_[(int)kv.first];
+    if (m != nullptr) {
+      update_msg(m, current_time, kv.second);
     }
-    SubMessage *m = m_find->second;
-    m->event = kv.second;
-    m->updated = true;
-    m->rcv_time = current_time;
-    m->rcv_frame = frame;
-    m->valid = m->event.getValid();
-    if (SIMULATION) m->alive = true;
   }
 
+  update_alive(current_time);
+}
+
+void SubMaster::update_msg(SubMessage *m, uint64_t current_time, const cereal::Event::Reader &event) {
+  m->event = event;
+  m->updated = true;
+  m->rcv_time = current_time;
+  m->rcv_frame = frame;
+  m->valid = m->event.getValid();
+  if (SIMULATION) m->alive = true;
+}
+
+void SubMaster::update_alive(uint64_t current_time) {
   if (!SIMULATION) {
-    for (auto &kv : messages_) {
-      SubMessage *m = kv.second;
+    for (auto m : messages_) {
       m->alive = (m->freq <= (1e-5) || ((current_time - m->rcv_time) * (1e-9)) < (10.0 / m->freq));
     }
   }
@@ -129,8 +166,7 @@ void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<s
 
 bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid, bool alive) {
   int found = 0;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
+  for (auto m : messages_) {
     if (service_list.size() == 0 || inList(service_list, m->name.c_str())) {
       found += (!valid || m->valid) && (!alive || (m->alive || m->ignore_alive));
     }
@@ -151,34 +187,69 @@ void SubMaster::drain() {
   }
 }
 
+SubMaster::SubMessage *SubMaster::get(const char *name) const {
+  int i = service_index(name);
+  if (i < 0 || service_ids_[i] == nullptr) throw std::out_of_range(name);
+  return service_ids_[i];
+}
+
+SubMaster::SubMessage *SubMaster::get(ServiceId id) const {
+  SubMessage *m = service_ids_[(int)id];
+  assert(m != nullptr);
+  return m;
+}
+
 bool SubMaster::updated(const char *name) const {
-  return services_.at(name)->updated;
+  return get(name)->updated;
 }
 
 bool SubMaster::alive(const char *name) const {
-  return services_.at(name)->alive;
+  return get(name)->alive;
 }
 
 bool SubMaster::valid(const char *name) const {
-  return services_.at(name)->valid;
+  return get(name)->valid;
 }
 
 uint64_t SubMaster::rcv_frame(const char *name) const {
-  return services_.at(name)->rcv_frame;
+  return get(name)->rcv_frame;
 }
 
 uint64_t SubMaster::rcv_time(const char *name) const {
-  return services_.at(name)->rcv_time;
+  return get(name)->rcv_time;
 }
 
 cereal::Event::Reader &SubMaster::operator[](const char *name) const {
-  return services_.at(name)->event;
+  return get(name)->event;
 };
 
+bool SubMaster::updated(ServiceId id) const {
+  return get(id)->updated;
+}
+
+bool SubMaster::alive(ServiceId id) const {
+  return get(id)->alive;
+}
+
+bool SubMaster::valid(ServiceId id) const {
+  return get(id)->valid;
+}
+
+uint64_t SubMaster::rcv_frame(ServiceId id) const {
+  return get(id)->rcv_frame;
+}
+
+uint64_t SubMaster::rcv_time(ServiceId id) const {
+  return get(id)->rcv_time;
+}
+
+cereal::Event::Reader &SubMaster::operator[](ServiceId id) const {
+  return get(id)->event;
+}
+
 SubMaster::~SubMaster() {
   delete poller_;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
+  for (auto m : messages_) {
     m->msg_reader->~FlatArrayMessageReader();
     free(m->allocated_msg_reader);
     delete m->socket;
@@ -195,9 +266,14 @@ PubMaster::PubMaster(const std::vector<const char *> &service_list) {
   }
 }
 
+PubSocket *PubMaster::get(const char *name) const {
+  auto it = sockets_.find(name);
+  if (it == sockets_.end()) throw std::out_of_range(name);
+  return it->second;
+}
+
 int PubMaster::send(const char *name, MessageBuilder &msg) {
-  auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+  return get(name)->send_segments(msg.getSegmentsForOutput());
 }
 
 PubMaster::~PubMaster() {
@@ -6,18 +6,50 @@ TICI = os.path.isfile('/TICI')
 RESERVED_PORT = 8022  # sshd
 STARTING_PORT = 8001
 
+KB = 1024
+MB = 1024 * KB
+
+# msgq queues hold at least QUEUE_SECONDS worth of messages, and at least three of the largest message
+QUEUE_SECONDS = 10
+MIN_QUEUE_SIZE = 1 * MB
+DEFAULT_MSG_SIZE = 1 * KB
+
+# reader slots of a msgq queue, DEFAULT_NUM_READERS in msgq.h
+DEFAULT_NUM_READERS = 10
+
 
 def new_port(port: int):
   port += STARTING_PORT
   return port + 1 if port >= RESERVED_PORT else port
 
 
+def queue_size(name: str, frequency: float) -> int:
+  if name in QUEUE_SIZES:
+    return QUEUE_SIZES[name]
+
+  msg_size = MSG_SIZES.get(name, DEFAULT_MSG_SIZE)
+  sz = max(MIN_QUEUE_SIZE, 3 * msg_size, int(msg_size * frequency * QUEUE_SECONDS))
+  return (sz + MB - 1) // MB * MB
+
+
+def qlog_hz(frequency: float, decimation: Optional[float]) -> float:
+  # the decimation is applied by time, so bursts and rate changes don't change the rate in the qlog.
+  # 0 keeps every message, or every nth for services without a nominal frequency
+  if decimation is None or decimation <= 1 or frequency <= 0:
+    return 0.
+  return frequency / decimation
+
+
 class Service:
-  def __init__(self, port: int, should_log: bool, frequency: float, decimation: Optional[int] = None):
+  def __init__(self, name: str, port: int, should_log: bool, frequency: float, decimation: Optional[int] = None):
     self.port = port
     self.should_log = should_log
     self.frequency = frequency
     self.decimation = decimation
+    self.queue_size = queue_size(name, frequency)
+    self.num_readers = NUM_READERS.get(name, DEFAULT_NUM_READERS)
+    self.qlog_hz = qlog_hz(frequency, decimation)
+    self.qlog_on_change = name in QLOG_ON_CHANGE
 
 DCAM_FREQ = 10. if not TICI else 20.
 
@@ -77,7 +109,58 @@ services = {
   "driverEncodeData": (False, DCAM_FREQ),
   "wideRoadEncodeData": (False, 20.),
 }
-service_list = {name: Service(new_port(idx), *vals) for  # type: ignore
+
+# Largest expected message, for services sending more than DEFAULT_MSG_SIZE
+MSG_SIZES = {
+  "sensorEvents": 4 * KB,
+  "can": 16 * KB,
+  "sendcan": 4 * KB,
+  "controlsState": 4 * KB,
+  "carState": 4 * KB,
+  "carControl": 4 * KB,
+  "liveTracks": 8 * KB,
+  "ubloxGnss": 8 * KB,
+  "ubloxRaw": 8 * KB,
+  "procLog": 64 * KB,
+  "modelV2": 64 * KB,
+  "liveLocationKalman": 4 * KB,
+  "carParams": 16 * KB,
+  "logMessage": 64 * KB,
+  "errorLogMessage": 64 * KB,
+  "androidLog": 16 * KB,
+  "thumbnail": 128 * KB,
+  "navRoute": 256 * KB,
+  "navThumbnail": 256 * KB,
+}
+
+# Fixed queue sizes, the camera states can carry a full frame and the debug streams whole encoded frames
+QUEUE_SIZES = {
+  "roadCameraState": 100 * MB,
+  "driverCameraState": 100 * MB,
+  "wideRoadCameraState": 100 * MB,
+  "roadEncodeData": 10 * MB,
+  "driverEncodeData": 10 * MB,
+  "wideRoadEncodeData": 10 * MB,
+}
+
+# Read by most daemons, plus logging and debugging tools
+NUM_READERS = {
+  "can": 2 * DEFAULT_NUM_READERS,
+  "carState": 2 * DEFAULT_NUM_READERS,
+  "carControl": 2 * DEFAULT_NUM_READERS,
+  "controlsState": 2 * DEFAULT_NUM_READERS,
+  "deviceState": 2 * DEFAULT_NUM_READERS,
+  "pandaStates": 2 * DEFAULT_NUM_READERS,
+  "modelV2": 2 * DEFAULT_NUM_READERS,
+}
+
+# Slow changing services, only kept in the qlog when their content changes (and once per segment)
+QLOG_ON_CHANGE = {
+  "carParams",
+  "managerState",
+}
+
+service_list = {name: Service(name, new_port(idx), *vals) for  # type: ignore
                 idx, (name, vals) in enumerate(services.items())}
 
 
@@ -86,13 +169,18 @@ def build_header():
   h += "/* THIS IS AN AUTOGENERATED FILE, PLEASE EDIT services.py */\n"
   h += "#ifndef __SERVICES_H\n"
   h += "#define __SERVICES_H\n"
-  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; };\n"
+  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; int queue_size; int num_readers; float qlog_hz; bool qlog_on_change; };\n"
   h += "static struct service services[] = {\n"
   for k, v in service_list.items():
     should_log = "true" if v.should_log else "false"
     decimation = -1 if v.decimation is None else v.decimation
-    h += '  { "%s", %d, %s, %d, %d },\n' % \
-         (k, v.port, should_log, v.frequency, decimation)
+    qlog_on_change = "true" if v.qlog_on_change else "false"
+    h += '  { "%s", %d, %s, %d, %d, %d, %d, %f, %s },\n' % \
+         (k, v.port, should_log, v.frequency, decimation, v.queue_size, v.num_readers, v.qlog_hz, qlog_on_change)
+  h += "};\n"
+  h += "enum class ServiceId : int {\n"
+  for k in service_list.keys():
+    h += '  %s,\n' % k
   h += "};\n"
   h += "#endif\n"
   return h
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "messaging/msgq.h"
+#include "visionipc/frame_ring.h"
+
+static uint64_t frame_ring_nanos() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+FrameRing *frame_ring_create(int *fd) {
+  static std::atomic<int> counter = 0;
+
+  // Unlinked right away, clients get the fd from the listener
+  std::string path = "/dev/shm/visionipc_ring_" + std::to_string(getpid()) + "_" + std::to_string(counter++);
+  *fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (*fd < 0) return nullptr;
+  unlink(path.c_str());
+
+  if (ftruncate(*fd, sizeof(FrameRing)) != 0) {
+    close(*fd);
+    return nullptr;
+  }
+
+  void *mem = mmap(NULL, sizeof(FrameRing), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  if (mem == MAP_FAILED) {
+    close(*fd);
+    return nullptr;
+  }
+
+  // The new file is zero filled
+  FrameRing *ring = (FrameRing *)mem;
+  ring->server_pid = getpid();
+  return ring;
+}
+
+void frame_ring_close(FrameRing *ring, int fd) {
+  // Wake up the clients, so they can reconnect
+  ring->closed = 1;
+  ring->futex.fetch_add(1);
+  msgq_futex_wake(&ring->futex);
+
+  munmap(ring, sizeof(FrameRing));
+  close(fd);
+}
+
+size_t frame_ring_claim(FrameRing *ring, size_t start, size_t num_buffers, bool *stolen) {
+  uint64_t now = frame_ring_nanos();
+  *stolen = false;
+
+  for (size_t i = 0; i < num_buffers; i++) {
+    size_t idx = (start + i) % num_buffers;
+    FrameRingBuffer &b = ring->buffers[idx];
+
+    // Invalidate first, a client leasing at the same time either shows up
+    // in leases below or sees the invalid frame and backs off
+    uint64_t frame = b.frame;
+    b.frame = 0;
+    if (b.leases == 0 || (int64_t)(now - b.lease_time) > (int64_t)FRAME_RING_LEASE_TIMEOUT_NS) {
+      return idx;
+    }
+    b.frame = frame;
+  }
+
+  *stolen = true;
+  ring->steals++;
+  ring->buffers[start].frame = 0;
+  return start;
+}
+
+void frame_ring_push(FrameRing *ring, uint64_t server_id, size_t idx, const VisionIpcBufExtra &extra) {
+  uint64_t n = ring->write_seq;
+  FrameRingEntry &e = ring->entries[n % FRAME_RING_SIZE];
+  ring->buffers[idx].frame = n + 1;
+
+  e.seq.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  e.server_id = server_id;
+  e.idx = idx;
+  e.extra = extra;
+  e.seq.store(2 * n + 2, std::memory_order_release);
+
+  ring->write_seq.store(n + 1, std::memory_order_release);
+
+  ring->futex.fetch_add(1);
+  if (ring->futex_waiters > 0) {
+    msgq_futex_wake(&ring->futex);
+  }
+}
+
+FrameRing *frame_ring_map(int fd) {
+  void *mem = mmap(NULL, sizeof(FrameRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  return mem == MAP_FAILED ? nullptr : (FrameRing *)mem;
+}
+
+void frame_ring_unmap(FrameRing *ring) {
+  munmap(ring, sizeof(FrameRing));
+}
+
+static bool frame_ring_server_alive(FrameRing *ring) {
+  return !ring->closed && !(kill(ring->server_pid, 0) == -1 && errno == ESRCH);
+}
+
+int frame_ring_pop(FrameRing *ring, uint64_t *read_seq, bool conflate, VisionIpcPacket *packet, int timeout_ms) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+  while (true) {
+    // The server bumps the futex after publishing, so either the wait returns right away or we see the frame below
+    uint32_t seq = ring->futex;
+    uint64_t write_seq = ring->write_seq.load(std::memory_order_acquire);
+
+    if (write_seq > *read_seq) {
+      uint64_t oldest = write_seq > FRAME_RING_SIZE ? write_seq - FRAME_RING_SIZE : 0;
+      uint64_t n = conflate ? write_seq - 1 : std::max(*read_seq, oldest);
+      FrameRingEntry &e = ring->entries[n % FRAME_RING_SIZE];
+
+      uint64_t seq_before = e.seq.load(std::memory_order_acquire);
+      packet->server_id = e.server_id;
+      packet->idx = e.idx;
+      packet->extra = e.extra;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      uint64_t seq_after = e.seq.load(std::memory_order_relaxed);
+
+      *read_seq = n + 1;
+      if (seq_before == 2 * n + 2 && seq_after == seq_before) {
+        return 1;
+      }
+      // Overwritten while reading, the frame is gone
+      continue;
+    }
+
+    // Still wait out the timeout when the server is gone, callers retry in a loop
+    bool alive = frame_ring_server_alive(ring);
+    int ms = 100;
+    if (timeout_ms >= 0) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      if (remaining <= 0) return alive ? 0 : -1;
+      ms = std::min<int>(ms, remaining);
+    } else if (!alive) {
+      return -1;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000 * 1000;
+
+    ring->futex_waiters.fetch_add(1);
+    msgq_futex_wait(&ring->futex, seq, &ts);
+    ring->futex_waiters.fetch_sub(1);
+  }
+}
+
+bool frame_ring_lease(FrameRing *ring, size_t idx, uint64_t frame) {
+  FrameRingBuffer &b = ring->buffers[idx];
+  b.lease_time = frame_ring_nanos();
+  b.leases++;
+
+  if (b.frame == frame) {
+    return true;
+  }
+  b.leases--;
+  return false;
+}
+
+bool frame_ring_release(FrameRing *ring, size_t idx, uint64_t frame) {
+  FrameRingBuffer &b = ring->buffers[idx];
+  bool intact = b.frame == frame;
+  b.leases--;
+  return intact;
+}
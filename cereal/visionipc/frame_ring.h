@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "visionipc/visionipc.h"
+
+// Shared memory ring of the frames published on a stream. It is passed to clients as an extra fd
+// next to the buffers, so they can wait on a futex and read frame indices without a msgq round trip
+#define FRAME_RING_SIZE 256
+// Leases older than this are considered stale, e.g. left behind by a client that crashed
+#define FRAME_RING_LEASE_TIMEOUT_NS (1000ULL * 1000 * 1000)
+
+struct FrameRingEntry {
+  std::atomic<uint64_t> seq;  // 2 * frame number + 2 when valid, odd while being written
+  uint64_t server_id;
+  uint64_t idx;
+  VisionIpcBufExtra extra;
+};
+
+struct FrameRingBuffer {
+  std::atomic<uint64_t> frame;  // Frame number + 1 of the frame in the buffer, 0 while the server writes to it
+  std::atomic<uint32_t> leases;
+  std::atomic<uint64_t> lease_time;
+};
+
+struct FrameRing {
+  std::atomic<uint64_t> write_seq;  // Number of frames published
+  std::atomic<uint32_t> futex;
+  std::atomic<uint32_t> futex_waiters;
+  std::atomic<uint32_t> closed;
+  int32_t server_pid;
+  std::atomic<uint64_t> steals;  // Leased buffers the server had to take back
+  FrameRingEntry entries[FRAME_RING_SIZE];
+  FrameRingBuffer buffers[VISIONIPC_MAX_FDS];
+};
+
+// Server side, returns nullptr if shared memory is not available
+FrameRing *frame_ring_create(int *fd);
+void frame_ring_close(FrameRing *ring, int fd);
+// Returns the first buffer from start on that is not leased and marks it as being written.
+// If all of them are leased, the one at start is taken anyway and stolen is set.
+size_t frame_ring_claim(FrameRing *ring, size_t start, size_t num_buffers, bool *stolen);
+void frame_ring_push(FrameRing *ring, uint64_t server_id, size_t idx, const VisionIpcBufExtra &extra);
+
+// Client side. read_seq is the next frame to read, start with frame_ring_latest().
+// frame_ring_pop returns 1 with a packet, 0 on timeout and -1 once the server is gone.
+// Conflating readers skip straight to the newest frame, others only skip frames that were overwritten.
+FrameRing *frame_ring_map(int fd);
+void frame_ring_unmap(FrameRing *ring);
+inline uint64_t frame_ring_latest(FrameRing *ring) { return ring->write_seq; }
+int frame_ring_pop(FrameRing *ring, uint64_t *read_seq, bool conflate, VisionIpcPacket *packet, int timeout_ms);
+// Leases the buffer of the frame just popped, frame is read_seq after frame_ring_pop. Fails if the buffer
+// already holds a newer frame. frame_ring_release returns false if the lease was stolen in the meantime.
+bool frame_ring_lease(FrameRing *ring, size_t idx, uint64_t frame);
+bool frame_ring_release(FrameRing *ring, size_t idx, uint64_t frame);
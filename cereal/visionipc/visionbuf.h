@@ -19,6 +19,10 @@ enum VisionStreamType {
   VISION_STREAM_DRIVER,
   VISION_STREAM_WIDE_ROAD,
   VISION_STREAM_RGB_MAP,
+  // Derived from one of the streams above by the server, see VisionIpcServer::create_derived_buffers
+  VISION_STREAM_ROAD_HALF,
+  VISION_STREAM_WIDE_ROAD_HALF,
+  VISION_STREAM_DRIVER_ROI,
   VISION_STREAM_MAX,
 };
 
@@ -8,8 +8,11 @@
 #include "visionipc/visionipc_server.h"
 #include "logger/logger.h"
 
-VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), device_id(device_id), ctx(ctx) {
+VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), conflate(conflate), device_id(device_id), ctx(ctx) {
   msg_ctx = Context::create();
+}
+
+void VisionIpcClient::init_msgq(){
   sock = SubSocket::create(msg_ctx, get_endpoint_name(name, type), "127.0.0.1", conflate, false);
 
   poller = Poller::create();
@@ -29,6 +32,11 @@ bool VisionIpcClient::connect(bool blocking){
 
   num_buffers = 0;
 
+  if (ring != nullptr) {
+    frame_ring_unmap(ring);
+    ring = nullptr;
+  }
+
   // Connect to server socket and ask for all FDs of type
   std::string path = "/tmp/visionipc_" + name;
 
@@ -52,11 +60,23 @@ bool VisionIpcClient::connect(bool blocking){
 
   // Get FDs
   int fds[VISIONIPC_MAX_FDS];
+  int num_fds = 0;
   VisionBuf bufs[VISIONIPC_MAX_FDS];
-  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_buffers);
-
-  assert(num_buffers >= 0);
-  assert(r == sizeof(VisionBuf) * num_buffers);
+  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_fds);
+
+  assert(r >= 0 && r % sizeof(VisionBuf) == 0);
+  num_buffers = r / sizeof(VisionBuf);
+  assert(num_fds == num_buffers || num_fds == num_buffers + 1);
+
+  // An extra fd is the frame ring
+  if (num_fds > num_buffers) {
+    ring = frame_ring_map(fds[num_buffers]);
+    close(fds[num_buffers]);
+    assert(ring != nullptr);
+    ring_read_seq = frame_ring_latest(ring);
+  } else if (sock == nullptr) {
+    init_msgq();
+  }
 
   // Import buffers
   for (size_t i = 0; i < num_buffers; i++){
@@ -77,43 +97,94 @@ bool VisionIpcClient::connect(bool blocking){
   return true;
 }
 
-VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_ms){
-  auto p = poller->poll(timeout_ms);
+bool VisionIpcClient::recv_packet(VisionIpcPacket *packet, const int timeout_ms){
+  if (ring != nullptr) {
+    int r = frame_ring_pop(ring, &ring_read_seq, conflate, packet, timeout_ms);
+    if (r < 0) {
+      // Server went away, reconnect to get the new ring
+      connected = false;
+    }
+    return r > 0;
+  }
+
+  if (poller == nullptr) {
+    return false;
+  }
 
+  auto p = poller->poll(timeout_ms);
   if (!p.size()){
-    return nullptr;
+    return false;
   }
 
   Message * r = sock->receive(true);
   if (r == nullptr){
-    return nullptr;
+    return false;
   }
 
-  // Get buffer
   assert(r->getSize() == sizeof(VisionIpcPacket));
-  VisionIpcPacket *packet = (VisionIpcPacket*)r->getData();
+  *packet = *(VisionIpcPacket*)r->getData();
+  delete r;
+  return true;
+}
+
+VisionBuf * VisionIpcClient::recv_buf(VisionIpcBufExtra * extra, const int timeout_ms, bool lease){
+  VisionIpcPacket packet;
+  VisionBuf * buf = nullptr;
+  while (buf == nullptr){
+    if (!recv_packet(&packet, timeout_ms)){
+      return nullptr;
+    }
 
-  assert(packet->idx < num_buffers);
-  VisionBuf * buf = &buffers[packet->idx];
+    // Get buffer
+    assert(packet.idx < num_buffers);
+    buf = &buffers[packet.idx];
 
-  if (buf->server_id != packet->server_id){
-    connected = false;
-    delete r;
-    return nullptr;
+    if (buf->server_id != packet.server_id){
+      connected = false;
+      return nullptr;
+    }
+
+    // Leases are only supported over the frame ring
+    if (lease && ring != nullptr){
+      if (frame_ring_lease(ring, packet.idx, ring_read_seq)){
+        lease_frames[packet.idx] = ring_read_seq;
+      } else {
+        // The buffer was already reused for a newer frame
+        buf = nullptr;
+      }
+    }
   }
 
   if (extra) {
-    *extra = packet->extra;
+    *extra = packet.extra;
   }
 
   if (buf->sync(VISIONBUF_SYNC_TO_DEVICE) != 0) {
     LOGE("Failed to sync buffer");
   }
 
-  delete r;
   return buf;
 }
 
+VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_ms){
+  return recv_buf(extra, timeout_ms, false);
+}
+
+VisionBuf * VisionIpcClient::recv_lease(VisionIpcBufExtra * extra, const int timeout_ms){
+  return recv_buf(extra, timeout_ms, true);
+}
+
+bool VisionIpcClient::release(VisionBuf * buf){
+  if (ring == nullptr){
+    return true;
+  }
+
+  assert(buf->idx < num_buffers && lease_frames[buf->idx] != 0);
+  uint64_t frame = lease_frames[buf->idx];
+  lease_frames[buf->idx] = 0;
+  return frame_ring_release(ring, buf->idx, frame);
+}
+
 
 
 VisionIpcClient::~VisionIpcClient(){
@@ -123,6 +194,10 @@ VisionIpcClient::~VisionIpcClient(){
     }
   }
 
+  if (ring != nullptr) {
+    frame_ring_unmap(ring);
+  }
+
   delete sock;
   delete poller;
   delete msg_ctx;
@@ -6,20 +6,29 @@
 #include "messaging/messaging.h"
 #include "visionipc/visionipc.h"
 #include "visionipc/visionbuf.h"
+#include "visionipc/frame_ring.h"
 
 class VisionIpcClient {
 private:
   std::string name;
   Context * msg_ctx;
-  SubSocket * sock;
-  Poller * poller;
+  SubSocket * sock = nullptr;
+  Poller * poller = nullptr;
 
   VisionStreamType type;
+  bool conflate;
+
+  // Set when the server shares its frame ring, msgq is only used otherwise
+  FrameRing * ring = nullptr;
+  uint64_t ring_read_seq = 0;
+  uint64_t lease_frames[VISIONIPC_MAX_FDS] = {};
 
   cl_device_id device_id = nullptr;
   cl_context ctx = nullptr;
 
-  void init_msgq(bool conflate);
+  void init_msgq();
+  bool recv_packet(VisionIpcPacket *packet, const int timeout_ms);
+  VisionBuf * recv_buf(VisionIpcBufExtra * extra, const int timeout_ms, bool lease);
 
 public:
   bool connected = false;
@@ -28,6 +37,11 @@ public:
   VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcClient();
   VisionBuf * recv(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
+  // Like recv, but the server doesn't reuse the buffer until it is released or the lease
+  // goes stale. Frames that were already overwritten are skipped.
+  VisionBuf * recv_lease(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
+  // Returns false if the server had to take the buffer back, what was read from it may be torn
+  bool release(VisionBuf * buf);
   bool connect(bool blocking=true);
   bool is_connected() { return connected; }
 };
@@ -22,6 +22,10 @@ cpdef enum VisionStreamType:
   VISION_STREAM_ROAD
   VISION_STREAM_DRIVER
   VISION_STREAM_WIDE_ROAD
+  VISION_STREAM_RGB_MAP
+  VISION_STREAM_ROAD_HALF
+  VISION_STREAM_WIDE_ROAD_HALF
+  VISION_STREAM_DRIVER_ROI
 
 
 cdef class VisionIpcServer:
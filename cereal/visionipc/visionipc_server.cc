@@ -12,6 +12,47 @@
 #include "visionipc/visionipc_server.h"
 #include "logger/logger.h"
 
+// Crops and scales a planar yuv420 frame, one work item per output luma pixel.
+// Bilinear sampling at pixel centers, so halving the size averages 2x2 blocks.
+static const char *scale_yuv_src = R"(
+uchar sample_plane(__global const uchar *plane, int w, int h, float fx, float fy) {
+  fx = clamp(fx, 0.0f, (float)(w - 1));
+  fy = clamp(fy, 0.0f, (float)(h - 1));
+  int x0 = (int)fx, y0 = (int)fy;
+  int x1 = min(x0 + 1, w - 1), y1 = min(y0 + 1, h - 1);
+  float ax = fx - x0, ay = fy - y0;
+  float top = mix((float)plane[y0 * w + x0], (float)plane[y0 * w + x1], ax);
+  float bottom = mix((float)plane[y1 * w + x0], (float)plane[y1 * w + x1], ax);
+  return convert_uchar_sat_rte(mix(top, bottom, ay));
+}
+
+__kernel void scale_yuv(__global const uchar *src, int src_w, int src_h,
+                        int crop_x, int crop_y, int crop_w, int crop_h,
+                        __global uchar *dst, int dst_w, int dst_h) {
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if (x >= dst_w || y >= dst_h) return;
+
+  const float sx = (float)crop_w / dst_w;
+  const float sy = (float)crop_h / dst_h;
+  dst[y * dst_w + x] = sample_plane(src, src_w, src_h, crop_x + (x + 0.5f) * sx - 0.5f, crop_y + (y + 0.5f) * sy - 0.5f);
+
+  if (x < dst_w / 2 && y < dst_h / 2) {
+    const int src_cw = src_w / 2, src_ch = src_h / 2;
+    const int dst_cw = dst_w / 2, dst_ch = dst_h / 2;
+    const float fx = crop_x / 2 + (x + 0.5f) * sx - 0.5f;
+    const float fy = crop_y / 2 + (y + 0.5f) * sy - 0.5f;
+
+    __global const uchar *src_u = src + src_w * src_h;
+    __global const uchar *src_v = src_u + src_cw * src_ch;
+    __global uchar *dst_u = dst + dst_w * dst_h;
+    __global uchar *dst_v = dst_u + dst_cw * dst_ch;
+    dst_u[y * dst_cw + x] = sample_plane(src_u, src_cw, src_ch, fx, fy);
+    dst_v[y * dst_cw + x] = sample_plane(src_v, src_cw, src_ch, fx, fy);
+  }
+}
+)";
+
 std::string get_endpoint_name(std::string name, VisionStreamType type){
   if (messaging_use_zmq()){
     assert(name == "camerad");
@@ -61,11 +102,56 @@ void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers,
 
   cur_idx[type] = 0;
 
-  // Create msgq publisher for each of the `name` + type combos
-  // TODO: compute port number directly if using zmq
-  sockets[type] = PubSocket::create(msg_ctx, get_endpoint_name(name, type), false);
+  int ring_fd = -1;
+  FrameRing *ring = frame_ring_create(&ring_fd);
+  if (ring != nullptr) {
+    rings[type] = ring;
+    ring_fds[type] = ring_fd;
+  } else {
+    // Create msgq publisher for each of the `name` + type combos
+    // TODO: compute port number directly if using zmq
+    sockets[type] = PubSocket::create(msg_ctx, get_endpoint_name(name, type), false);
+  }
+}
+
+
+void VisionIpcServer::create_derived_buffers(VisionStreamType type, VisionStreamType source, size_t num_buffers,
+                                             size_t width, size_t height, VisionCrop crop){
+  assert(device_id != nullptr && ctx != nullptr);
+  assert(buffers.count(source) && !buffers[source][0]->rgb);
+  assert(buffers.count(type) == 0 && crops.count(source) == 0);
+
+  VisionBuf *src = buffers[source][0];
+  if (crop.width == 0 || crop.height == 0) {
+    crop = {0, 0, src->width, src->height};
+  }
+  // Keep to whole chroma samples
+  assert(crop.x % 2 == 0 && crop.y % 2 == 0 && crop.width % 2 == 0 && crop.height % 2 == 0);
+  assert(crop.x + crop.width <= src->width && crop.y + crop.height <= src->height);
+  assert(width % 2 == 0 && height % 2 == 0);
+
+  create_buffers(type, num_buffers, false, width, height);
+  if (scale_krnl == nullptr) {
+    init_scaler();
+  }
+
+  derived[source].push_back(type);
+  crops[type] = crop;
 }
 
+void VisionIpcServer::init_scaler(){
+  int err;
+  scale_q = clCreateCommandQueue(ctx, device_id, 0, &err);
+  assert(err == 0);
+
+  scale_prg = clCreateProgramWithSource(ctx, 1, &scale_yuv_src, NULL, &err);
+  assert(err == 0);
+  err = clBuildProgram(scale_prg, 1, &device_id, "", NULL, NULL);
+  assert(err == 0);
+
+  scale_krnl = clCreateKernel(scale_prg, "scale_yuv", &err);
+  assert(err == 0);
+}
 
 void VisionIpcServer::start_listener(){
   listener_thread = std::thread(&VisionIpcServer::listener, this);
@@ -111,10 +197,10 @@ void VisionIpcServer::listener(){
     }
 
     int fds[VISIONIPC_MAX_FDS];
-    int num_fds = buffers[type].size();
+    int num_bufs = buffers[type].size();
     VisionBuf bufs[VISIONIPC_MAX_FDS];
 
-    for (int i = 0; i < num_fds; i++){
+    for (int i = 0; i < num_bufs; i++){
       fds[i] = buffers[type][i]->fd;
       bufs[i] = *buffers[type][i];
 
@@ -126,7 +212,13 @@ void VisionIpcServer::listener(){
       bufs[i].server_id = server_id;
     }
 
-    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds, nullptr);
+    // The frame ring goes after the buffers
+    int num_fds = num_bufs;
+    if (ring_fds.count(type)) {
+      fds[num_fds++] = ring_fds[type];
+    }
+
+    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_bufs, fds, num_fds, nullptr);
 
     close(fd);
   }
@@ -140,7 +232,19 @@ void VisionIpcServer::listener(){
 VisionBuf * VisionIpcServer::get_buffer(VisionStreamType type){
   // Do we want to keep track if the buffer has been sent out yet and warn user?
   assert(buffers.count(type));
-  auto b = buffers[type];
+  auto &b = buffers[type];
+
+  if (rings.count(type)) {
+    // Skip buffers that clients are still reading
+    bool stolen = false;
+    size_t idx = frame_ring_claim(rings[type], cur_idx[type] % b.size(), b.size(), &stolen);
+    if (stolen) {
+      LOGW("%s: all %zu buffers of stream %d are leased, reusing %zu", name.c_str(), b.size(), type, idx);
+    }
+    cur_idx[type] = idx + 1;
+    return b[idx];
+  }
+
   return b[cur_idx[type]++ % b.size()];
 }
 
@@ -153,13 +257,66 @@ void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync
   assert(buffers.count(buf->type));
   assert(buf->idx < buffers[buf->type].size());
 
-  // Send over correct msgq socket
-  VisionIpcPacket packet = {0};
-  packet.server_id = server_id;
-  packet.idx = buf->idx;
-  packet.extra = *extra;
+  if (rings.count(buf->type)) {
+    frame_ring_push(rings[buf->type], server_id, buf->idx, *extra);
+  } else {
+    // Send over correct msgq socket
+    VisionIpcPacket packet = {0};
+    packet.server_id = server_id;
+    packet.idx = buf->idx;
+    packet.extra = *extra;
+
+    sockets[buf->type]->send((char*)&packet, sizeof(packet));
+  }
 
-  sockets[buf->type]->send((char*)&packet, sizeof(packet));
+  if (derived.count(buf->type)) {
+    send_derived(buf, extra, sync);
+  }
+}
+
+void VisionIpcServer::send_derived(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync){
+  // The kernel reads the device copy, which is stale if the frame was written on the CPU
+  if (!sync && buf->sync(VISIONBUF_SYNC_TO_DEVICE) != 0) {
+    LOGE("Failed to sync buffer");
+  }
+
+  // Queue all variants before waiting, then send them out together
+  VisionBuf *outs[VISION_STREAM_MAX];
+  const std::vector<VisionStreamType> &types = derived[buf->type];
+  for (size_t i = 0; i < types.size(); i++) {
+    VisionBuf *out = outs[i] = get_buffer(types[i]);
+    const VisionCrop &crop = crops[types[i]];
+
+    cl_int src_w = buf->width, src_h = buf->height;
+    cl_int crop_x = crop.x, crop_y = crop.y, crop_w = crop.width, crop_h = crop.height;
+    cl_int dst_w = out->width, dst_h = out->height;
+    int err = 0;
+    err |= clSetKernelArg(scale_krnl, 0, sizeof(cl_mem), &buf->buf_cl);
+    err |= clSetKernelArg(scale_krnl, 1, sizeof(cl_int), &src_w);
+    err |= clSetKernelArg(scale_krnl, 2, sizeof(cl_int), &src_h);
+    err |= clSetKernelArg(scale_krnl, 3, sizeof(cl_int), &crop_x);
+    err |= clSetKernelArg(scale_krnl, 4, sizeof(cl_int), &crop_y);
+    err |= clSetKernelArg(scale_krnl, 5, sizeof(cl_int), &crop_w);
+    err |= clSetKernelArg(scale_krnl, 6, sizeof(cl_int), &crop_h);
+    err |= clSetKernelArg(scale_krnl, 7, sizeof(cl_mem), &out->buf_cl);
+    err |= clSetKernelArg(scale_krnl, 8, sizeof(cl_int), &dst_w);
+    err |= clSetKernelArg(scale_krnl, 9, sizeof(cl_int), &dst_h);
+    assert(err == 0);
+
+    const size_t work_size[] = {out->width, out->height};
+    err = clEnqueueNDRangeKernel(scale_q, scale_krnl, 2, NULL, work_size, NULL, 0, NULL, NULL);
+    assert(err == 0);
+  }
+
+  if (clFinish(scale_q) != 0) {
+    LOGE("Failed to scale buffer");
+    return;
+  }
+
+  for (size_t i = 0; i < types.size(); i++) {
+    outs[i]->set_frame_id(extra->frame_id);
+    send(outs[i], extra, true);
+  }
 }
 
 VisionIpcServer::~VisionIpcServer(){
@@ -176,6 +333,16 @@ VisionIpcServer::~VisionIpcServer(){
     }
   }
 
+  for( auto const& [type, ring] : rings ) {
+    frame_ring_close(ring, ring_fds[type]);
+  }
+
+  if (scale_krnl) {
+    clReleaseKernel(scale_krnl);
+    clReleaseProgram(scale_prg);
+    clReleaseCommandQueue(scale_q);
+  }
+
   // Messaging cleanup
   for( auto const& [type, sock] : sockets ) {
     delete sock;
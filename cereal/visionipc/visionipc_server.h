@@ -8,9 +8,15 @@
 #include "messaging/messaging.h"
 #include "visionipc/visionipc.h"
 #include "visionipc/visionbuf.h"
+#include "visionipc/frame_ring.h"
 
 std::string get_endpoint_name(std::string name, VisionStreamType type);
 
+// Region of the source frame a derived stream is scaled from, an empty crop is the full frame
+struct VisionCrop {
+  size_t x = 0, y = 0, width = 0, height = 0;
+};
+
 class VisionIpcServer {
  private:
   cl_device_id device_id = nullptr;
@@ -25,10 +31,23 @@ class VisionIpcServer {
   std::map<VisionStreamType, std::vector<VisionBuf*> > buffers;
   std::map<VisionStreamType, std::map<VisionBuf*, size_t> > idxs;
 
+  // Frames are announced over the shared memory ring, msgq is only used where that is not available
+  std::map<VisionStreamType, FrameRing*> rings;
+  std::map<VisionStreamType, int> ring_fds;
+
   Context * msg_ctx;
   std::map<VisionStreamType, PubSocket*> sockets;
 
+  // Streams scaled from another stream on the GPU, filled when the source is sent
+  std::map<VisionStreamType, std::vector<VisionStreamType> > derived;
+  std::map<VisionStreamType, VisionCrop> crops;
+  cl_command_queue scale_q = nullptr;
+  cl_program scale_prg = nullptr;
+  cl_kernel scale_krnl = nullptr;
+
   void listener(void);
+  void init_scaler();
+  void send_derived(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync);
 
  public:
   VisionIpcServer(std::string name, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
@@ -37,6 +56,10 @@ class VisionIpcServer {
   VisionBuf * get_buffer(VisionStreamType type);
 
   void create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height);
+  // Declares a yuv stream that is cropped and scaled from source once per frame by the server, so
+  // clients that want a smaller image don't each have to do it on the CPU. Needs an OpenCL device.
+  void create_derived_buffers(VisionStreamType type, VisionStreamType source, size_t num_buffers,
+                              size_t width, size_t height, VisionCrop crop = {});
   void send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync=true);
   void start_listener();
 };
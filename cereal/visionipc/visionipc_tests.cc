@@ -1,5 +1,10 @@
+#include <algorithm>
 #include <thread>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
 
 #include "catch2/catch.hpp"
 #include "visionipc_server.h"
@@ -135,3 +140,173 @@ TEST_CASE("Test conflate"){
   recv_buf = client.recv(&extra_recv);
   REQUIRE(recv_buf == nullptr);
 }
+
+TEST_CASE("Client disconnects when the server goes away"){
+  auto server = std::make_unique<VisionIpcServer>("camerad");
+  server->create_buffers(VISION_STREAM_ROAD, 1, false, 100, 100);
+  server->start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+
+  server.reset();
+  REQUIRE(client.recv(nullptr, 10) == nullptr);
+  REQUIRE(!client.connected);
+}
+
+TEST_CASE("Leased buffers are not reused"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 3, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+
+  VisionIpcBufExtra extra = {0};
+  server.send(server.get_buffer(VISION_STREAM_ROAD), &extra, false);
+
+  VisionBuf * leased = client.recv_lease();
+  REQUIRE(leased != nullptr);
+
+  // The server cycles through the other buffers
+  for (int i = 1; i <= 10; i++){
+    VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+    REQUIRE(buf != leased);
+    extra.frame_id = i;
+    server.send(buf, &extra, false);
+  }
+  REQUIRE(client.release(leased));
+
+  // Frames whose buffer was reused before the lease are skipped
+  VisionIpcBufExtra extra_recv = {0};
+  for (int i = 9; i <= 10; i++){
+    VisionBuf * buf = client.recv_lease(&extra_recv, 0);
+    REQUIRE(buf != nullptr);
+    REQUIRE(extra_recv.frame_id == i);
+    REQUIRE(client.release(buf));
+  }
+  REQUIRE(client.recv_lease(nullptr, 0) == nullptr);
+
+  // With every buffer leased, the server has to steal one
+  for (int i = 0; i < 3; i++){
+    server.send(server.get_buffer(VISION_STREAM_ROAD), &extra, false);
+  }
+  VisionBuf * bufs[3];
+  for (int i = 0; i < 3; i++){
+    bufs[i] = client.recv_lease();
+    REQUIRE(bufs[i] != nullptr);
+  }
+  VisionBuf * stolen = server.get_buffer(VISION_STREAM_ROAD);
+  server.send(stolen, &extra, false);
+
+  for (int i = 0; i < 3; i++){
+    REQUIRE(client.release(bufs[i]) == (bufs[i]->idx != stolen->idx));
+  }
+}
+
+static bool get_cl_device(cl_device_id *device_id, cl_context *ctx){
+  cl_platform_id platform_id;
+  cl_uint num_platforms = 0;
+  if (clGetPlatformIDs(1, &platform_id, &num_platforms) != CL_SUCCESS || num_platforms == 0) return false;
+  if (clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_DEFAULT, 1, device_id, NULL) != CL_SUCCESS) return false;
+
+  cl_int err;
+  *ctx = clCreateContext(NULL, 1, device_id, NULL, NULL, &err);
+  return err == CL_SUCCESS;
+}
+
+TEST_CASE("Derived streams are scaled from the source"){
+  cl_device_id device_id;
+  cl_context ctx;
+  if (!get_cl_device(&device_id, &ctx)){
+    WARN("No OpenCL device, skipping");
+    return;
+  }
+
+  size_t width = 64, height = 32;
+  VisionIpcServer server("camerad", device_id, ctx);
+  server.create_buffers(VISION_STREAM_ROAD, 2, false, width, height);
+  server.create_derived_buffers(VISION_STREAM_ROAD_HALF, VISION_STREAM_ROAD, 2, width / 2, height / 2);
+  server.create_derived_buffers(VISION_STREAM_DRIVER_ROI, VISION_STREAM_ROAD, 2, 16, 16, {32, 16, 16, 16});
+  server.start_listener();
+
+  VisionIpcClient client_half = VisionIpcClient("camerad", VISION_STREAM_ROAD_HALF, false);
+  VisionIpcClient client_roi = VisionIpcClient("camerad", VISION_STREAM_DRIVER_ROI, false);
+  REQUIRE(client_half.connect());
+  REQUIRE(client_roi.connect());
+  REQUIRE(client_half.buffers[0].width == width / 2);
+  REQUIRE(client_half.buffers[0].height == height / 2);
+
+  // Constant 2x2 blocks, so halving is exact
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+  for (size_t y = 0; y < height; y++){
+    for (size_t x = 0; x < width; x++){
+      buf->y[y * width + x] = (x / 2) * 4 + y / 2;
+    }
+  }
+  memset(buf->u, 100, width / 2 * height / 2);
+  memset(buf->v, 200, width / 2 * height / 2);
+
+  VisionIpcBufExtra extra = {0};
+  extra.frame_id = 1337;
+  server.send(buf, &extra, false);
+
+  VisionBuf * half = client_half.recv();
+  REQUIRE(half != nullptr);
+  REQUIRE(half->get_frame_id() == extra.frame_id);
+  for (size_t y = 0; y < height / 2; y++){
+    for (size_t x = 0; x < width / 2; x++){
+      REQUIRE(half->y[y * width / 2 + x] == x * 4 + y);
+    }
+  }
+  REQUIRE(half->u[0] == 100);
+  REQUIRE(half->v[0] == 200);
+
+  VisionBuf * roi = client_roi.recv();
+  REQUIRE(roi != nullptr);
+  for (size_t y = 0; y < 16; y++){
+    for (size_t x = 0; x < 16; x++){
+      REQUIRE(roi->y[y * 16 + x] == buf->y[(16 + y) * width + 32 + x]);
+    }
+  }
+}
+
+static uint64_t nanos_now(){
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// camerad -> modeld hop, run with ./test_runner "[latency]"
+TEST_CASE("Frame latency", "[.][latency]"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 4, false, 1928, 1208);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  const int n = 1000;
+  std::vector<double> latencies;
+  std::thread receiver([&]{
+    for (int i = 0; i < n; i++){
+      VisionIpcBufExtra extra = {0};
+      if (client.recv(&extra, 1000) == nullptr) break;
+      latencies.push_back((nanos_now() - extra.timestamp_sof) / 1e3);
+    }
+  });
+
+  for (int i = 0; i < n; i++){
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+    VisionIpcBufExtra extra = {0};
+    extra.frame_id = i;
+    extra.timestamp_sof = nanos_now();
+    server.send(buf, &extra, false);
+  }
+  receiver.join();
+
+  REQUIRE(latencies.size() == n);
+  std::sort(latencies.begin(), latencies.end());
+  printf("send -> recv latency: median %.1f us, p99 %.1f us, max %.1f us\n",
+         latencies[n / 2], latencies[n * 99 / 100], latencies.back());
+}
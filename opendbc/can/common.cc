@@ -66,6 +66,8 @@ unsigned int chrysler_checksum(uint32_t address, const std::vector<uint8_t> &d)
 
 // Static lookup table for fast computation of CRC8 poly 0x2F, aka 8H2F/AUTOSAR
 uint8_t crc8_lut_8h2f[256];
+// Static lookup table for fast computation of CRC8 poly 0x1D, for Hyundai
+uint8_t crc8_lut_1d[256];
 
 void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
   uint8_t crc;
@@ -87,6 +89,7 @@ void init_crc_lookup_tables() {
   // At init time, set up static lookup tables for fast CRC computation.
 
   gen_crc_lookup_table(0x2F, crc8_lut_8h2f);    // CRC-8 8H2F/AUTOSAR for Volkswagen
+  gen_crc_lookup_table(0x1D, crc8_lut_1d);      // CRC-8 poly 0x11D for Hyundai
 }
 
 unsigned int volkswagen_crc(uint32_t address, const std::vector<uint8_t> &d) {
@@ -187,3 +190,38 @@ unsigned int pedal_checksum(const std::vector<uint8_t> &d) {
   }
   return crc;
 }
+
+unsigned int hyundai_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
+  // sum of all bytes but the checksum, as on MDPS12 and LKAS11 of most cars
+  unsigned int s = 0;
+  for (int i = 0; i < d.size(); i++) {
+    if (i != sig.lsb / 8) s += d[i];
+  }
+  return s & 0xFF;
+}
+
+unsigned int hyundai_checksum_6b(uint32_t address, const std::vector<uint8_t> &d) {
+  // sum of the first 6 bytes, as on LKAS11 of the 2018 Kia Sorento
+  unsigned int s = 0;
+  for (int i = 0; i < d.size() && i < 6; i++) { s += d[i]; }
+  return s & 0xFF;
+}
+
+unsigned int hyundai_crc8(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
+  // CRC8 poly 0x11D of all bytes but the checksum, as on LKAS11 of the 2019 Hyundai Santa Fe.
+  // crcmod's init 0xFD includes the final XOR 0xDF, so the register starts at 0xFD ^ 0xDF
+  uint8_t crc = 0xFD ^ 0xDF;
+  for (int i = 0; i < d.size(); i++) {
+    if (i != sig.lsb / 8) crc = crc8_lut_1d[crc ^ d[i]];
+  }
+  return crc ^ 0xDF;
+}
+
+unsigned int hyundai_nibble_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
+  // 16 minus the sum of all nibbles but the checksum, as on SCC12
+  unsigned int s = 0;
+  for (int i = 0; i < d.size() * 2; i++) {
+    if (i != sig.lsb / 4) s += (d[i / 2] >> ((i % 2) * 4)) & 0xF;
+  }
+  return (16 - s % 16) & 0xF;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <utility>
 #include <vector>
 #include <map>
 #include <unordered_map>
@@ -27,6 +29,30 @@ unsigned int chrysler_checksum(uint32_t address, const std::vector<uint8_t> &d);
 void init_crc_lookup_tables();
 unsigned int volkswagen_crc(uint32_t address, const std::vector<uint8_t> &d);
 unsigned int pedal_checksum(const std::vector<uint8_t> &d);
+unsigned int hyundai_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
+unsigned int hyundai_checksum_6b(uint32_t address, const std::vector<uint8_t> &d);
+unsigned int hyundai_crc8(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
+unsigned int hyundai_nibble_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
+
+inline bool is_checksum(SignalType type) {
+  return type == SignalType::HONDA_CHECKSUM || type == SignalType::TOYOTA_CHECKSUM || type == SignalType::PEDAL_CHECKSUM ||
+         type == SignalType::VOLKSWAGEN_CHECKSUM || type == SignalType::SUBARU_CHECKSUM || type == SignalType::CHRYSLER_CHECKSUM ||
+         type == SignalType::HYUNDAI_CHECKSUM || type == SignalType::HYUNDAI_CHECKSUM_6B || type == SignalType::HYUNDAI_CRC8 ||
+         type == SignalType::HYUNDAI_NIBBLE_CHECKSUM;
+}
+
+inline bool is_counter(SignalType type) {
+  return type == SignalType::HONDA_COUNTER || type == SignalType::PEDAL_COUNTER ||
+         type == SignalType::VOLKSWAGEN_COUNTER || type == SignalType::HYUNDAI_COUNTER;
+}
+
+inline bool is_hyundai_check(SignalType type) {
+  return type == SignalType::HYUNDAI_CHECKSUM || type == SignalType::HYUNDAI_CHECKSUM_6B || type == SignalType::HYUNDAI_CRC8 ||
+         type == SignalType::HYUNDAI_NIBBLE_CHECKSUM || type == SignalType::HYUNDAI_COUNTER;
+}
+
+// Generic bit by bit decode, the generated decoders in Msg::decode are used for parsing
+int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig);
 
 class MessageState {
 public:
@@ -37,6 +63,10 @@ public:
   std::vector<double> vals;
   std::vector<std::vector<double>> all_vals;
 
+  DecodeFn decode = nullptr;
+  std::vector<int> sig_index;  // index of each of parse_sigs in the message
+  std::vector<double> decoded;  // all signals of the message
+
   uint64_t seen;
   uint64_t check_threshold;
 
@@ -46,6 +76,10 @@ public:
   bool ignore_checksum = false;
   bool ignore_counter = false;
 
+  bool keep_all_vals = true;
+  size_t value_index = 0;  // of vals[0] in CANParser::signal_values, with change tracking
+  bool received = false;  // since the last CANParser::query_changed
+
   bool parse(uint64_t sec, const std::vector<uint8_t> &dat);
   bool update_counter_generic(int64_t v, int cnt_size);
 };
@@ -57,6 +91,26 @@ private:
 
   const DBC *dbc = NULL;
   std::unordered_map<uint32_t, MessageState> message_states;
+  // flat lookup by address for standard 11 bit addresses, others go through message_states
+  std::vector<MessageState*> state_table;
+  std::vector<uint8_t> dat_buf;
+
+  bool track_changes = false;
+  std::vector<uint8_t> signal_changed;
+  std::vector<uint32_t> changed;
+  std::vector<MessageState*> received;
+
+  void init_state_table();
+  void update_changed(MessageState &state);
+  inline MessageState *get_state(uint32_t address) {
+    if (address < state_table.size()) {
+      return state_table[address];
+    }
+    auto it = message_states.find(address);
+    return it != message_states.end() ? &it->second : nullptr;
+  }
+
+  friend class CANParserGroup;
 
 public:
   bool can_valid = false;
@@ -64,6 +118,7 @@ public:
   uint64_t last_sec = 0;
   uint64_t last_nonempty_sec = 0;
   uint64_t bus_timeout_threshold = 0;
+  std::vector<double> signal_values;  // with change tracking, NAN until first received
 
   CANParser(int abus, const std::string& dbc_name,
             const std::vector<MessageParseOptions> &options,
@@ -72,20 +127,83 @@ public:
   #ifndef DYNAMIC_CAPNP
   void update_string(const std::string &data, bool sendcan);
   void UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Reader& cans);
+  void UpdateCan(uint64_t sec, const cereal::CanData::Reader& cmsg);
   #endif
   void UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cans);
+  void UpdateBusTimeout(uint64_t sec, bool bus_empty);
   void UpdateValid(uint64_t sec);
+  // For checksums that differ between cars sharing a DBC, like LKAS11 on Hyundai. check turns the
+  // checksum and counter checks of received frames on, they start off for Hyundai messages
+  void set_checksum_type(uint32_t address, SignalType type, bool check = false);
   std::vector<SignalValue> query_latest();
+
+  // Incremental alternative to query_latest, for callers that only touch what changed. The values
+  // of all parsed signals are kept in signal_values, in the order of signal_list, and query_changed
+  // gives the indexes of the signals whose value changed and the addresses of the messages received
+  // since its last call. A signal is listed once however often it changed. all_vals isn't kept
+  void enable_change_tracking();
+  std::vector<std::pair<uint32_t, const char*>> signal_list();
+  void query_changed(std::vector<uint32_t> &changed_out, std::vector<uint32_t> &received_out);
+};
+
+#ifndef DYNAMIC_CAPNP
+// Parsers for several buses of the same can stream, e.g. the pt, can2 and cam parsers of a car.
+// Each event is deserialized once and every frame goes straight to the parsers of its bus,
+// instead of every parser copying and walking the whole event for its own bus.
+class CANParserGroup {
+private:
+  kj::Array<capnp::word> aligned_buf;
+  std::vector<CANParser*> parsers;
+  std::array<std::vector<CANParser*>, 256> bus_parsers;  // by src
+
+public:
+  CANParserGroup(const std::vector<CANParser*> &parsers);
+  void update_string(const std::string &data, bool sendcan);
+};
+#endif
+
+// Everything needed to pack a message, resolved once per DBC
+struct MessagePackLayout {
+  uint32_t address;
+  unsigned int size;
+  std::vector<Signal> sigs;
+  std::unordered_map<std::string, int> sig_index;
+  int counter = -1;  // index in sigs
+  int checksum = -1;
+};
+
+// One message of a pack_batch call
+struct MessagePackRequest {
+  int msg;  // message handle
+  int counter;
+  uint32_t num_sigs;  // takes the next num_sigs signal handles and values
+  uint8_t *dat;  // message_size(msg) bytes
 };
 
 class CANPacker {
 private:
   const DBC *dbc = NULL;
-  std::map<std::pair<uint32_t, std::string>, Signal> signal_lookup;
   std::map<uint32_t, Msg> message_lookup;
+  std::vector<MessagePackLayout> layouts;
+  std::unordered_map<uint32_t, int> layout_index;
+  std::vector<uint8_t> checksum_buf;
 
 public:
   CANPacker(const std::string& dbc_name);
   std::vector<uint8_t> pack(uint32_t address, const std::vector<SignalPackValue> &values, int counter);
+
+  // Handle based packing, for callers packing the same messages every cycle. Handles are
+  // looked up once, then signals are set into a caller buffer of message_size bytes,
+  // starting zeroed, and finish sets the counter (if >= 0) and checksum.
+  int message_handle(uint32_t address);  // -1 if the message isn't in the DBC
+  int signal_handle(int msg, const std::string &name);  // -1 and a warning if the signal isn't in the message
+  unsigned int message_size(int msg);
+  void set_signal(int msg, int sig, double value, uint8_t *dat);
+  void finish(int msg, uint8_t *dat, int counter);
+  // Packs all messages of a cycle in one call, signal handles < 0 are skipped
+  void pack_batch(const std::vector<MessagePackRequest> &requests, const std::vector<int> &sigs, const std::vector<double> &values);
+
+  // For checksums that differ between cars sharing a DBC, like LKAS11 on Hyundai
+  void set_checksum_type(uint32_t address, SignalType type);
   Msg* lookup_message(uint32_t address);
 };
@@ -6,6 +6,7 @@ from libcpp cimport bool
 from libcpp.map cimport map
 from libcpp.string cimport string
 from libcpp.vector cimport vector
+from libcpp.utility cimport pair
 from libcpp.unordered_set cimport unordered_set
 
 
@@ -20,7 +21,12 @@ cdef extern from "common_dbc.h":
     VOLKSWAGEN_CHECKSUM,
     VOLKSWAGEN_COUNTER,
     SUBARU_CHECKSUM,
-    CHRYSLER_CHECKSUM
+    CHRYSLER_CHECKSUM,
+    HYUNDAI_CHECKSUM,
+    HYUNDAI_CHECKSUM_6B,
+    HYUNDAI_CRC8,
+    HYUNDAI_NIBBLE_CHECKSUM,
+    HYUNDAI_COUNTER
 
   cdef struct Signal:
     const char* name
@@ -72,13 +78,46 @@ cdef extern from "common_dbc.h":
 cdef extern from "common.h":
   cdef const DBC* dbc_lookup(const string);
 
+  cdef struct MessagePackRequest:
+    int msg
+    int counter
+    uint32_t num_sigs
+    uint8_t *dat
+
   cdef cppclass CANParser:
     bool can_valid
     bool bus_timeout
+    vector[double] signal_values
     CANParser(int, string, vector[MessageParseOptions], vector[SignalParseOptions])
     void update_string(string, bool)
+    void set_checksum_type(uint32_t, SignalType, bool)
     vector[SignalValue] query_latest()
+    void enable_change_tracking()
+    vector[pair[uint32_t, const char*]] signal_list()
+    void query_changed(vector[uint32_t]&, vector[uint32_t]&)
+
+  cdef cppclass CANParserGroup:
+    CANParserGroup(vector[CANParser*])
+    void update_string(string, bool)
 
   cdef cppclass CANPacker:
    CANPacker(string)
    vector[uint8_t] pack(uint32_t, vector[SignalPackValue], int counter)
+   int message_handle(uint32_t)
+   int signal_handle(int, string)
+   unsigned int message_size(int)
+   void set_signal(int, int, double, uint8_t*)
+   void finish(int, uint8_t*, int)
+   void pack_batch(vector[MessagePackRequest]&, vector[int]&, vector[double]&)
+   void set_checksum_type(uint32_t, SignalType)
+
+
+cdef inline SignalType checksum_type_from_name(str name) except *:
+  # checksums that differ between cars sharing a DBC
+  if name == "HYUNDAI_CHECKSUM":
+    return HYUNDAI_CHECKSUM
+  elif name == "HYUNDAI_CHECKSUM_6B":
+    return HYUNDAI_CHECKSUM_6B
+  elif name == "HYUNDAI_CRC8":
+    return HYUNDAI_CRC8
+  raise ValueError(f"Unknown checksum type: {name}")
@@ -2,11 +2,16 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 
 #define ARRAYSIZE(x) (sizeof(x)/sizeof(x[0]))
 
+// Generated decoders load 8 bytes at a time, from a zero padded copy of the message
+#define MAX_MSG_SIZE 64
+#define DECODE_BUF_SIZE (MAX_MSG_SIZE + 8)
+
 struct SignalPackValue {
   std::string name;
   double value;
@@ -40,6 +45,11 @@ enum SignalType {
   VOLKSWAGEN_COUNTER,
   SUBARU_CHECKSUM,
   CHRYSLER_CHECKSUM,
+  HYUNDAI_CHECKSUM,
+  HYUNDAI_CHECKSUM_6B,
+  HYUNDAI_CRC8,
+  HYUNDAI_NIBBLE_CHECKSUM,
+  HYUNDAI_COUNTER,
 };
 
 struct Signal {
@@ -51,14 +61,30 @@ struct Signal {
   SignalType type;
 };
 
+// Decodes all sigs of a message into vals, in order. Generated per message by process_dbc.py
+typedef void (*DecodeFn)(const uint8_t *dat, double *vals);
+
 struct Msg {
   const char* name;
   uint32_t address;
   unsigned int size;
   size_t num_sigs;
   const Signal *sigs;
+  DecodeFn decode;
 };
 
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "generated decoders assume a little endian host");
+
+inline uint64_t load_le64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t load_be64(const uint8_t *p) {
+  return __builtin_bswap64(load_le64(p));
+}
+
 struct Val {
   const char* name;
   uint32_t address;
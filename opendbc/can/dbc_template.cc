@@ -29,6 +29,8 @@ const Signal sigs_{{address}}[] = {
       .type = SignalType::SUBARU_CHECKSUM,
       {% elif checksum_type == "chrysler" and sig.name == "CHECKSUM" %}
       .type = SignalType::CHRYSLER_CHECKSUM,
+      {% elif checksum_type == "hyundai" and (address, sig.name) in hyundai_signal_types %}
+      .type = SignalType::{{hyundai_signal_types[(address, sig.name)]}},
       {% elif address in [512, 513] and sig.name == "CHECKSUM_PEDAL" %}
       .type = SignalType::PEDAL_CHECKSUM,
       {% elif address in [512, 513] and sig.name == "COUNTER_PEDAL" %}
@@ -45,6 +47,14 @@ const Signal sigs_{{address}}[] = {
 };
 {% endfor %}
 
+{% for address, msg_name, msg_size, sigs in msgs %}
+void decode_{{address}}(const uint8_t *dat, double *vals) {
+  {% for sig in sigs %}
+  vals[{{loop.index0}}] = {{decode_signal(sig)}};
+  {% endfor %}
+}
+
+{% endfor %}
 const Msg msgs[] = {
 {% for address, msg_name, msg_size, sigs in msgs %}
   {% set address_hex = "0x%X" % address %}
@@ -54,6 +64,7 @@ const Msg msgs[] = {
     .size = {{msg_size}},
     .num_sigs = ARRAYSIZE(sigs_{{address}}),
     .sigs = sigs_{{address}},
+    .decode = decode_{{address}},
   },
 {% endfor %}
 };
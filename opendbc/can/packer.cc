@@ -3,18 +3,19 @@
 #include <algorithm>
 #include <map>
 #include <cmath>
+#include <cstring>
 
 #include "common.h"
 
 
-void set_value(std::vector<uint8_t> &msg, const Signal &sig, int64_t ival) {
+void set_value(uint8_t *msg, size_t msg_size, const Signal &sig, int64_t ival) {
   int i = sig.lsb / 8;
   int bits = sig.size;
   if (sig.size < 64) {
     ival &= ((1ULL << sig.size) - 1);
   }
 
-  while (i >= 0 && i < msg.size() && bits > 0) {
+  while (i >= 0 && i < msg_size && bits > 0) {
     int shift = (int)(sig.lsb / 8) == i ? sig.lsb % 8 : 0;
     int size = std::min(bits, 8 - shift);
 
@@ -34,79 +35,148 @@ CANPacker::CANPacker(const std::string& dbc_name) {
   for (int i = 0; i < dbc->num_msgs; i++) {
     const Msg* msg = &dbc->msgs[i];
     message_lookup[msg->address] = *msg;
+
+    MessagePackLayout layout = {.address = msg->address, .size = msg->size};
     for (int j = 0; j < msg->num_sigs; j++) {
       const Signal* sig = &msg->sigs[j];
-      signal_lookup[std::make_pair(msg->address, std::string(sig->name))] = *sig;
+      layout.sigs.push_back(*sig);
+      layout.sig_index[sig->name] = j;
+      if (strcmp(sig->name, "COUNTER") == 0 || is_counter(sig->type)) {
+        layout.counter = j;
+      }
+      if (strcmp(sig->name, "CHECKSUM") == 0 || is_checksum(sig->type)) {
+        layout.checksum = j;
+      }
     }
+    layout_index[msg->address] = layouts.size();
+    layouts.push_back(layout);
   }
   init_crc_lookup_tables();
 }
 
 std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals, int counter) {
-  std::vector<uint8_t> ret(message_lookup[address].size, 0);
+  int msg = message_handle(address);
+  if (msg < 0) {
+    WARN("undefined message %d\n", address);
+    return {};
+  }
+  std::vector<uint8_t> ret(layouts[msg].size, 0);
 
   // set all values for all given signal/value pairs
   for (const auto& sigval : signals) {
-    auto sig_it = signal_lookup.find(std::make_pair(address, sigval.name));
-    if (sig_it == signal_lookup.end()) {
-      // TODO: do something more here. invalid flag like CANParser?
-      WARN("undefined signal %s - %d\n", sigval.name.c_str(), address);
-      continue;
+    int sig = signal_handle(msg, sigval.name);
+    if (sig >= 0) {
+      set_signal(msg, sig, sigval.value, ret.data());
     }
-    const auto &sig = sig_it->second;
+  }
 
-    int64_t ival = (int64_t)(round((sigval.value - sig.offset) / sig.factor));
-    if (ival < 0) {
-      ival = (1ULL << sig.size) + ival;
-    }
+  finish(msg, ret.data(), counter);
+  return ret;
+}
 
-    set_value(ret, sig, ival);
+int CANPacker::message_handle(uint32_t address) {
+  auto it = layout_index.find(address);
+  return it != layout_index.end() ? it->second : -1;
+}
+
+int CANPacker::signal_handle(int msg, const std::string &name) {
+  const auto &sig_index = layouts[msg].sig_index;
+  auto it = sig_index.find(name);
+  if (it == sig_index.end()) {
+    // TODO: do something more here. invalid flag like CANParser?
+    WARN("undefined signal %s - %d\n", name.c_str(), layouts[msg].address);
+    return -1;
   }
+  return it->second;
+}
+
+unsigned int CANPacker::message_size(int msg) {
+  return layouts[msg].size;
+}
+
+void CANPacker::set_signal(int msg, int sig, double value, uint8_t *dat) {
+  const auto &layout = layouts[msg];
+  const Signal &s = layout.sigs[sig];
+
+  int64_t ival = (int64_t)(round((value - s.offset) / s.factor));
+  if (ival < 0) {
+    ival = (1ULL << s.size) + ival;
+  }
+  set_value(dat, layout.size, s, ival);
+}
+
+void CANPacker::finish(int msg, uint8_t *dat, int counter) {
+  const auto &layout = layouts[msg];
+  const uint32_t address = layout.address;
 
   // set message counter
   if (counter >= 0){
-    auto sig_it = signal_lookup.find(std::make_pair(address, "COUNTER"));
-    if (sig_it == signal_lookup.end()) {
+    if (layout.counter < 0) {
       WARN("COUNTER not defined\n");
-      return ret;
+      return;
     }
-    const auto& sig = sig_it->second;
+    const auto& sig = layout.sigs[layout.counter];
 
-    if ((sig.type != SignalType::HONDA_COUNTER) && (sig.type != SignalType::VOLKSWAGEN_COUNTER)) {
+    if (!is_counter(sig.type)) {
       //WARN("COUNTER signal type not valid\n");
     }
 
-    set_value(ret, sig, counter);
+    set_value(dat, layout.size, sig, counter);
   }
 
   // set message checksum
-  auto sig_it_checksum = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
-  if (sig_it_checksum != signal_lookup.end()) {
-    const auto &sig = sig_it_checksum->second;
+  if (layout.checksum >= 0) {
+    const auto &sig = layout.sigs[layout.checksum];
+    // the checksum functions take a vector, reused so there's no allocation per message
+    checksum_buf.assign(dat, dat + layout.size);
+    unsigned int chksm = 0;
     if (sig.type == SignalType::HONDA_CHECKSUM) {
-      unsigned int chksm = honda_checksum(address, ret);
-      set_value(ret, sig, chksm);
+      chksm = honda_checksum(address, checksum_buf);
     } else if (sig.type == SignalType::TOYOTA_CHECKSUM) {
-      unsigned int chksm = toyota_checksum(address, ret);
-      set_value(ret, sig, chksm);
+      chksm = toyota_checksum(address, checksum_buf);
     } else if (sig.type == SignalType::VOLKSWAGEN_CHECKSUM) {
-      unsigned int chksm = volkswagen_crc(address, ret);
-      set_value(ret, sig, chksm);
+      chksm = volkswagen_crc(address, checksum_buf);
     } else if (sig.type == SignalType::SUBARU_CHECKSUM) {
-      unsigned int chksm = subaru_checksum(address, ret);
-      set_value(ret, sig, chksm);
+      chksm = subaru_checksum(address, checksum_buf);
     } else if (sig.type == SignalType::CHRYSLER_CHECKSUM) {
-      unsigned int chksm = chrysler_checksum(address, ret);
-      set_value(ret, sig, chksm);
+      chksm = chrysler_checksum(address, checksum_buf);
     } else if (sig.type == SignalType::PEDAL_CHECKSUM) {
-      unsigned int chksm = pedal_checksum(ret);
-      set_value(ret, sig, chksm);
+      chksm = pedal_checksum(checksum_buf);
+    } else if (sig.type == SignalType::HYUNDAI_CHECKSUM) {
+      chksm = hyundai_checksum(address, sig, checksum_buf);
+    } else if (sig.type == SignalType::HYUNDAI_CHECKSUM_6B) {
+      chksm = hyundai_checksum_6b(address, checksum_buf);
+    } else if (sig.type == SignalType::HYUNDAI_CRC8) {
+      chksm = hyundai_crc8(address, sig, checksum_buf);
+    } else if (sig.type == SignalType::HYUNDAI_NIBBLE_CHECKSUM) {
+      chksm = hyundai_nibble_checksum(address, sig, checksum_buf);
     } else {
       //WARN("CHECKSUM signal type not valid\n");
+      return;
     }
+    set_value(dat, layout.size, sig, chksm);
   }
+}
 
-  return ret;
+void CANPacker::pack_batch(const std::vector<MessagePackRequest> &requests, const std::vector<int> &sigs, const std::vector<double> &values) {
+  size_t i = 0;
+  for (const auto &r : requests) {
+    assert(i + r.num_sigs <= sigs.size() && sigs.size() == values.size());
+    memset(r.dat, 0, layouts[r.msg].size);
+    for (size_t end = i + r.num_sigs; i < end; i++) {
+      if (sigs[i] >= 0) {
+        set_signal(r.msg, sigs[i], values[i], r.dat);
+      }
+    }
+    finish(r.msg, r.dat, r.counter);
+  }
+}
+
+void CANPacker::set_checksum_type(uint32_t address, SignalType type) {
+  int msg = message_handle(address);
+  if (msg >= 0 && layouts[msg].checksum >= 0) {
+    layouts[msg].sigs[layouts[msg].checksum].type = type;
+  }
 }
 
 // This function has a definition in common.h and is used in PlotJuggler
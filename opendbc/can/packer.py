@@ -1,3 +1,27 @@
 # pylint: skip-file
 from opendbc.can.packer_pyx import CANPacker
 assert CANPacker
+
+
+class CANBatch:
+  """Collects a cycle's make_can_msg calls and packs them in one call to the packer on flush.
+
+  The messages are returned as empty lists, filled in place with [address, 0, dat, bus] by
+  flush, so they can be appended to a list of messages to send as usual."""
+  def __init__(self, packer):
+    self.packer = packer
+    self.requests = []
+    self.msgs = []
+
+  def make_can_msg(self, name_or_addr, bus, values, counter=-1):
+    msg = []
+    self.requests.append((name_or_addr, bus, values, counter))
+    self.msgs.append(msg)
+    return msg
+
+  def flush(self):
+    try:
+      for msg, packed in zip(self.msgs, self.packer.make_can_msgs(self.requests)):
+        msg[:] = packed
+    finally:
+      self.requests, self.msgs = [], []
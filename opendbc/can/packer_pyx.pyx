@@ -2,6 +2,7 @@
 # cython: c_string_encoding=ascii, language_level=3
 
 from libc.stdint cimport uint8_t, uint32_t, uint64_t
+from libc.string cimport memset
 from libcpp.vector cimport vector
 from libcpp.map cimport map
 from libcpp.string cimport string
@@ -9,7 +10,7 @@ from libcpp cimport bool
 from posix.dlfcn cimport dlopen, dlsym, RTLD_LAZY
 
 from .common cimport CANPacker as cpp_CANPacker
-from .common cimport dbc_lookup, SignalPackValue, DBC
+from .common cimport dbc_lookup, checksum_type_from_name, DBC, MessagePackRequest
 
 
 cdef class CANPacker:
@@ -17,7 +18,8 @@ cdef class CANPacker:
     cpp_CANPacker *packer
     const DBC *dbc
     map[string, (int, int)] name_to_address_and_size
-    map[int, int] address_to_size
+    dict handles
+    uint8_t buf[64]
 
   def __init__(self, dbc_name):
     self.dbc = dbc_lookup(dbc_name)
@@ -29,27 +31,117 @@ cdef class CANPacker:
     for i in range(num_msgs):
       msg = self.dbc[0].msgs[i]
       self.name_to_address_and_size[string(msg.name)] = (msg.address, msg.size)
-      self.address_to_size[msg.address] = msg.size
 
-  cdef vector[uint8_t] pack(self, addr, values, counter):
-    cdef vector[SignalPackValue] values_thing
-    values_thing.reserve(len(values))
-    cdef SignalPackValue spv
+    # name or address -> (address, message handle, {signal name: signal handle})
+    self.handles = {}
 
-    for name, value in values.iteritems():
-      spv.name = name.encode('utf8')
-      spv.value = value
-      values_thing.push_back(spv)
+  cdef tuple get_handles(self, name_or_addr):
+    h = self.handles.get(name_or_addr)
+    if h is None:
+      if type(name_or_addr) == int:
+        addr = name_or_addr
+      else:
+        addr = self.name_to_address_and_size[name_or_addr.encode('utf8')][0]
+      msg = self.packer.message_handle(addr)
+      if msg < 0:
+        raise KeyError(f"undefined message {name_or_addr}")
+      h = (addr, msg, {})
+      self.handles[name_or_addr] = h
+    return h
 
-    return self.packer.pack(addr, values_thing, counter)
+  cdef int signal(self, int msg, dict sigs, name) except? -3:
+    cdef int sig = sigs.get(name, -2)
+    if sig == -2:
+      # an undefined signal is warned about once per message, then skipped
+      sig = self.packer.signal_handle(msg, name.encode('utf8'))
+      sigs[name] = sig
+    return sig
+
+  cdef bytes pack(self, int msg, dict sigs, values, int counter):
+    cdef int size = self.packer.message_size(msg)
+    cdef int sig
+    memset(self.buf, 0, size)
+
+    for name, value in values.items():
+      sig = self.signal(msg, sigs, name)
+      if sig >= 0:
+        self.packer.set_signal(msg, sig, value, self.buf)
+
+    self.packer.finish(msg, self.buf, counter)
+    return (<char *>self.buf)[:size]
+
+  cdef check_handle(self, int msg, int sig, uint8_t[::1] dat):
+    if not 0 <= msg < self.dbc[0].num_msgs:
+      raise IndexError(f"invalid message handle {msg}")
+    if not -1 <= sig < <int>self.dbc[0].msgs[msg].num_sigs:
+      raise IndexError(f"invalid signal handle {sig}")
+    if dat is not None and dat.shape[0] < self.packer.message_size(msg):
+      raise ValueError(f"buffer of {dat.shape[0]} bytes, {self.packer.message_size(msg)} needed")
+
+  def set_checksum_type(self, name_or_addr, checksum_type):
+    addr, _, _ = self.get_handles(name_or_addr)
+    self.packer.set_checksum_type(addr, checksum_type_from_name(checksum_type))
 
   cpdef make_can_msg(self, name_or_addr, bus, values, counter=-1):
-    cdef int addr, size
-    if type(name_or_addr) == int:
-      addr = name_or_addr
-      size = self.address_to_size[name_or_addr]
-    else:
-      addr, size = self.name_to_address_and_size[name_or_addr.encode('utf8')]
-
-    cdef vector[uint8_t] val = self.pack(addr, values, counter)
-    return [addr, 0, (<char *>&val[0])[:size], bus]
+    addr, msg, sigs = self.get_handles(name_or_addr)
+    return [addr, 0, self.pack(msg, sigs, values, counter), bus]
+
+  def make_can_msgs(self, msgs):
+    """Packs (name or address, bus, values, counter) tuples in one call to the C++ packer"""
+    cdef vector[MessagePackRequest] requests
+    cdef vector[int] sigs
+    cdef vector[double] values
+    cdef vector[size_t] offsets
+    cdef MessagePackRequest r
+    cdef uint8_t *buf
+    cdef size_t i, size = 0
+
+    addrs = []
+    for name_or_addr, bus, vals, counter in msgs:
+      addr, msg, handles = self.get_handles(name_or_addr)
+      for name, value in vals.items():
+        sigs.push_back(self.signal(msg, handles, name))
+        values.push_back(value)
+      r.msg = msg
+      r.counter = counter
+      r.num_sigs = len(vals)
+      r.dat = NULL
+      requests.push_back(r)
+      offsets.push_back(size)
+      size += self.packer.message_size(msg)
+      addrs.append((addr, bus))
+
+    dat = bytearray(size)
+    buf = <uint8_t *><char *>dat
+    for i in range(requests.size()):
+      requests[i].dat = buf + offsets[i]
+    self.packer.pack_batch(requests, sigs, values)
+
+    ret = []
+    for i in range(requests.size()):
+      addr, bus = addrs[i]
+      size = self.packer.message_size(requests[i].msg)
+      ret.append([addr, 0, (<char *>requests[i].dat)[:size], bus])
+    return ret
+
+  # Handle based packing, see CANPacker in common.h. A message is packed into a zeroed
+  # bytearray of message_size bytes with set_signal, then finish sets its counter and checksum.
+  def message_handle(self, name_or_addr):
+    return self.get_handles(name_or_addr)[1]
+
+  def signal_handle(self, int msg, name):
+    self.check_handle(msg, -1, None)
+    return self.packer.signal_handle(msg, name.encode('utf8'))
+
+  def message_size(self, int msg):
+    self.check_handle(msg, -1, None)
+    return self.packer.message_size(msg)
+
+  def set_signal(self, int msg, int sig, double value, uint8_t[::1] dat):
+    self.check_handle(msg, sig, dat)
+    if sig >= 0:
+      self.packer.set_signal(msg, sig, value, &dat[0])
+
+  def finish(self, int msg, uint8_t[::1] dat, int counter=-1):
+    self.check_handle(msg, -1, dat)
+    self.packer.finish(msg, &dat[0], counter)
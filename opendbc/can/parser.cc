@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <cmath>
 #include <limits>
 
 #include <unistd.h>
@@ -22,7 +23,7 @@ int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig) {
     int size = msb - lsb + 1;
 
     uint8_t d = (msg[i] >> (lsb - (i*8))) & ((1ULL << size) - 1);
-    ret |= d << (bits - size);
+    ret |= (int64_t)d << (bits - size);
 
     bits -= size;
     i = sig.is_little_endian ? i-1 : i+1;
@@ -32,14 +33,15 @@ int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig) {
 
 
 bool MessageState::parse(uint64_t sec, const std::vector<uint8_t> &dat) {
+  uint8_t buf[DECODE_BUF_SIZE] = {};
+  memcpy(buf, dat.data(), std::min(dat.size(), (size_t)MAX_MSG_SIZE));
+  decode(buf, decoded.data());
 
   for (int i = 0; i < parse_sigs.size(); i++) {
     auto &sig = parse_sigs[i];
 
-    int64_t tmp = get_raw_value(dat, sig);
-    if (sig.is_signed) {
-      tmp -= ((tmp >> (sig.size-1)) & 0x1) ? (1ULL << sig.size) : 0;
-    }
+    // checksums and counters have no factor or offset, see process_dbc.py
+    int64_t tmp = decoded[sig_index[i]];
 
     //DEBUG("parse 0x%X %s -> %ld\n", address, sig.name, tmp);
 
@@ -57,12 +59,20 @@ bool MessageState::parse(uint64_t sec, const std::vector<uint8_t> &dat) {
         checksum_failed = true;
       } else if (sig.type == SignalType::PEDAL_CHECKSUM && pedal_checksum(dat) != tmp) {
         checksum_failed = true;
+      } else if (sig.type == SignalType::HYUNDAI_CHECKSUM && hyundai_checksum(address, sig, dat) != tmp) {
+        checksum_failed = true;
+      } else if (sig.type == SignalType::HYUNDAI_CHECKSUM_6B && hyundai_checksum_6b(address, dat) != tmp) {
+        checksum_failed = true;
+      } else if (sig.type == SignalType::HYUNDAI_CRC8 && hyundai_crc8(address, sig, dat) != tmp) {
+        checksum_failed = true;
+      } else if (sig.type == SignalType::HYUNDAI_NIBBLE_CHECKSUM && hyundai_nibble_checksum(address, sig, dat) != tmp) {
+        checksum_failed = true;
       }
     }
 
     bool counter_failed = false;
     if (!ignore_counter) {
-      if (sig.type == SignalType::HONDA_COUNTER || sig.type == SignalType::VOLKSWAGEN_COUNTER || sig.type == SignalType::PEDAL_COUNTER) { 
+      if (is_counter(sig.type)) {
         counter_failed = !update_counter_generic(tmp, sig.size);
       }
     }
@@ -73,8 +83,10 @@ bool MessageState::parse(uint64_t sec, const std::vector<uint8_t> &dat) {
     }
 
     // TODO: these may get updated if the invalid or checksum gets checked later
-    vals[i] = tmp * sig.factor + sig.offset;
-    all_vals[i].push_back(vals[i]);
+    vals[i] = decoded[sig_index[i]];
+    if (keep_all_vals) {
+      all_vals[i].push_back(vals[i]);
+    }
   }
   seen = sec;
 
@@ -138,17 +150,28 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
 
     state.size = msg->size;
     assert(state.size < 64);  // max signal size is 64 bytes
+    state.decode = msg->decode;
+    state.decoded.resize(msg->num_sigs);
 
     // track checksums and counters for this message
     for (int i = 0; i < msg->num_sigs; i++) {
       const Signal *sig = &msg->sigs[i];
       if (sig->type != SignalType::DEFAULT) {
         state.parse_sigs.push_back(*sig);
+        state.sig_index.push_back(i);
         state.vals.push_back(0);
         state.all_vals.push_back({});
       }
     }
 
+    // Hyundai checksums and counters aren't checked on received frames until they're verified
+    // against recorded routes of the car, see set_checksum_type and parser_bench
+    for (const auto &sig : state.parse_sigs) {
+      if (is_hyundai_check(sig.type)) {
+        state.ignore_checksum = state.ignore_counter = true;
+      }
+    }
+
     // track requested signals for this message
     for (const auto& sigop : sigoptions) {
       if (sigop.address != op.address) continue;
@@ -158,6 +181,7 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
         if (strcmp(sig->name, sigop.name) == 0
             && sig->type == SignalType::DEFAULT) {
           state.parse_sigs.push_back(*sig);
+          state.sig_index.push_back(i);
           state.vals.push_back(0);
           state.all_vals.push_back({});
           break;
@@ -165,6 +189,7 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
       }
     }
   }
+  init_state_table();
 }
 
 CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter)
@@ -183,16 +208,31 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
       .ignore_checksum = ignore_checksum,
       .ignore_counter = ignore_counter,
     };
+    state.decode = msg->decode;
+    state.decoded.resize(msg->num_sigs);
 
     for (int j = 0; j < msg->num_sigs; j++) {
       const Signal *sig = &msg->sigs[j];
       state.parse_sigs.push_back(*sig);
+      state.sig_index.push_back(j);
       state.vals.push_back(0);
       state.all_vals.push_back({});
     }
 
     message_states[state.address] = state;
   }
+  init_state_table();
+}
+
+void CANParser::init_state_table() {
+  for (auto &kv : message_states) {
+    if (kv.first <= 0x7FF) {
+      if (kv.first >= state_table.size()) {
+        state_table.resize(kv.first + 1, nullptr);
+      }
+      state_table[kv.first] = &kv.second;
+    }
+  }
 }
 
 #ifndef DYNAMIC_CAPNP
@@ -229,36 +269,77 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Rea
       continue;
     }
     bus_empty = false;
+    UpdateCan(sec, cmsg);
+  }
 
-    auto state_it = message_states.find(cmsg.getAddress());
-    if (state_it == message_states.end()) {
-      // DEBUG("skip %d: not specified\n", cmsg.getAddress());
-      continue;
-    }
+  UpdateBusTimeout(sec, bus_empty);
+}
 
-    auto dat = cmsg.getDat();
+void CANParser::UpdateCan(uint64_t sec, const cereal::CanData::Reader& cmsg) {
+  MessageState *state = get_state(cmsg.getAddress());
+  if (!state) {
+    // DEBUG("skip %d: not specified\n", cmsg.getAddress());
+    return;
+  }
 
-    if (dat.size() > 64) {
-      DEBUG("got message longer than 64 bytes: 0x%X %zu\n", cmsg.getAddress(), dat.size());
-      continue;
-    }
+  auto dat = cmsg.getDat();
+
+  if (dat.size() > 64) {
+    DEBUG("got message longer than 64 bytes: 0x%X %zu\n", cmsg.getAddress(), dat.size());
+    return;
+  }
 
-    // TODO: this actually triggers for some cars. fix and enable this
-    //if (dat.size() != state_it->second.size) {
-    //  DEBUG("got message with unexpected length: expected %d, got %zu for %d", state_it->second.size, dat.size(), cmsg.getAddress());
-    //  continue;
-    //}
+  // TODO: this actually triggers for some cars. fix and enable this
+  //if (dat.size() != state->size) {
+  //  DEBUG("got message with unexpected length: expected %d, got %zu for %d", state->size, dat.size(), cmsg.getAddress());
+  //  return;
+  //}
 
-    std::vector<uint8_t> data(dat.size(), 0);
-    memcpy(data.data(), dat.begin(), dat.size());
-    state_it->second.parse(sec, data);
+  dat_buf.assign(dat.begin(), dat.end());
+  if (state->parse(sec, dat_buf) && track_changes) {
+    update_changed(*state);
   }
+}
 
-  // update bus timeout
-  if (!bus_empty) {
-    last_nonempty_sec = sec;
+CANParserGroup::CANParserGroup(const std::vector<CANParser*> &parsers)
+  : aligned_buf(kj::heapArray<capnp::word>(1024)), parsers(parsers) {
+  for (auto p : parsers) {
+    assert(p->bus >= 0 && p->bus < bus_parsers.size());
+    bus_parsers[p->bus].push_back(p);
+  }
+}
+
+void CANParserGroup::update_string(const std::string &data, bool sendcan) {
+  // same as CANParser::update_string, once for all parsers
+  const size_t buf_size = (data.length() / sizeof(capnp::word)) + 1;
+  if (aligned_buf.size() < buf_size) {
+    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+  }
+  memcpy(aligned_buf.begin(), data.data(), data.length());
+
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.slice(0, buf_size));
+  cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+
+  const uint64_t sec = event.getLogMonoTime();
+  auto cans = sendcan ? event.getSendcan() : event.getCan();
+
+  bool bus_empty[256];
+  std::fill(std::begin(bus_empty), std::end(bus_empty), true);
+
+  for (int i = 0; i < cans.size(); i++) {
+    auto can = cans[i];
+    const uint8_t src = can.getSrc();
+    bus_empty[src] = false;
+    for (auto p : bus_parsers[src]) {
+      p->UpdateCan(sec, can);
+    }
+  }
+
+  for (auto p : parsers) {
+    p->last_sec = sec;
+    p->UpdateBusTimeout(sec, bus_empty[p->bus]);
+    p->UpdateValid(sec);
   }
-  bus_timeout = (sec - last_nonempty_sec) > bus_timeout_threshold;
 }
 #endif
 
@@ -271,17 +352,25 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cms
     return;
   }
 
-  auto state_it = message_states.find(cmsg.get("address").as<uint32_t>());
-  if (state_it == message_states.end()) {
+  MessageState *state = get_state(cmsg.get("address").as<uint32_t>());
+  if (!state) {
     DEBUG("skip %d: not specified\n", cmsg.get("address").as<uint32_t>());
     return;
   }
 
   auto dat = cmsg.get("dat").as<capnp::Data>();
   if (dat.size() > 64) return; // shouldn't ever happen
-  std::vector<uint8_t> data(dat.size(), 0);
-  memcpy(data.data(), dat.begin(), dat.size());
-  state_it->second.parse(sec, data);
+  dat_buf.assign(dat.begin(), dat.end());
+  if (state->parse(sec, dat_buf) && track_changes) {
+    update_changed(*state);
+  }
+}
+
+void CANParser::UpdateBusTimeout(uint64_t sec, bool bus_empty) {
+  if (!bus_empty) {
+    last_nonempty_sec = sec;
+  }
+  bus_timeout = (sec - last_nonempty_sec) > bus_timeout_threshold;
 }
 
 void CANParser::UpdateValid(uint64_t sec) {
@@ -299,6 +388,18 @@ void CANParser::UpdateValid(uint64_t sec) {
   }
 }
 
+void CANParser::set_checksum_type(uint32_t address, SignalType type, bool check) {
+  MessageState *state = get_state(address);
+  if (!state) return;
+
+  for (auto &sig : state->parse_sigs) {
+    if (is_checksum(sig.type)) {
+      sig.type = type;
+    }
+  }
+  state->ignore_checksum = state->ignore_counter = !check;
+}
+
 std::vector<SignalValue> CANParser::query_latest() {
   std::vector<SignalValue> ret;
 
@@ -320,3 +421,72 @@ std::vector<SignalValue> CANParser::query_latest() {
 
   return ret;
 }
+
+void CANParser::enable_change_tracking() {
+  if (track_changes) return;
+
+  // in address order, so indexes don't depend on the hash map
+  std::vector<MessageState*> states;
+  for (auto &kv : message_states) {
+    states.push_back(&kv.second);
+  }
+  std::sort(states.begin(), states.end(), [](auto a, auto b) { return a->address < b->address; });
+
+  size_t num_values = 0;
+  for (auto state : states) {
+    state->keep_all_vals = false;
+    for (auto &v : state->all_vals) v.clear();
+    state->value_index = num_values;
+    num_values += state->vals.size();
+  }
+
+  signal_values.assign(num_values, NAN);
+  signal_changed.assign(num_values, false);
+  changed.reserve(num_values);
+  received.reserve(states.size());
+  track_changes = true;
+}
+
+std::vector<std::pair<uint32_t, const char*>> CANParser::signal_list() {
+  std::vector<std::pair<uint32_t, const char*>> ret(signal_values.size());
+  for (const auto &kv : message_states) {
+    const auto &state = kv.second;
+    for (int i = 0; i < state.parse_sigs.size(); i++) {
+      ret[state.value_index + i] = {state.address, state.parse_sigs[i].name};
+    }
+  }
+  return ret;
+}
+
+void CANParser::update_changed(MessageState &state) {
+  if (!state.received) {
+    state.received = true;
+    received.push_back(&state);
+  }
+  for (int i = 0; i < state.vals.size(); i++) {
+    const size_t idx = state.value_index + i;
+    // NAN != NAN, so the first value always counts as a change
+    if (signal_values[idx] != state.vals[i]) {
+      signal_values[idx] = state.vals[i];
+      if (!signal_changed[idx]) {
+        signal_changed[idx] = true;
+        changed.push_back(idx);
+      }
+    }
+  }
+}
+
+void CANParser::query_changed(std::vector<uint32_t> &changed_out, std::vector<uint32_t> &received_out) {
+  changed_out.clear();
+  changed_out.swap(changed);
+  for (auto idx : changed_out) {
+    signal_changed[idx] = false;
+  }
+
+  received_out.clear();
+  for (auto state : received) {
+    state->received = false;
+    received_out.push_back(state->address);
+  }
+  received.clear();
+}
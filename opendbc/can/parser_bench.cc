@@ -0,0 +1,214 @@
+// Decodes the can stream of a recorded route, e.g. a Hyundai rlog, with the generated decoders and
+// the generic bit by bit decode, and checks they agree. Then checks the checksum of every frame
+// with one against the packer's, LKAS11 with the Hyundai variant that matches its first frame.
+// Also times the pt, can2 and cam parsers of a car on it, separately, as a CANParserGroup, and with
+// change tracking instead of query_latest. Fails on a decoder or checksum mismatch.
+// usage: parser_bench <decompressed rlog> [dbc name]
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+struct Frame {
+  const Msg *msg;
+  std::vector<uint8_t> dat;
+};
+
+// The frame is unchanged if the packer computes the same checksum for it
+static bool checksum_matches(CANPacker &packer, int msg, const std::vector<uint8_t> &dat) {
+  std::vector<uint8_t> buf(dat);
+  packer.finish(msg, buf.data(), -1);
+  return buf == dat;
+}
+
+static double now_ms() {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <decompressed rlog> [dbc name]\n", argv[0]);
+    return 1;
+  }
+  const std::string dbc_name = argc > 2 ? argv[2] : "hyundai_kia_generic";
+  const DBC *dbc = dbc_lookup(dbc_name);
+  if (!dbc) {
+    printf("unknown dbc %s\n", dbc_name.c_str());
+    return 1;
+  }
+
+  int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    printf("failed to open %s\n", argv[1]);
+    return 1;
+  }
+  struct stat st = {};
+  fstat(fd, &st);
+  void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  assert(mem != MAP_FAILED);
+
+  // can events, and the frames of every bus with a message in the dbc
+  std::vector<std::string> events;
+  std::vector<Frame> frames;
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)mem, st.st_size / sizeof(capnp::word));
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    const capnp::word *end = reader.getEnd();
+    if (event.which() == cereal::Event::CAN) {
+      events.emplace_back((const char *)words.begin(), (const char *)end);
+      for (auto can : event.getCan()) {
+        for (int i = 0; i < dbc->num_msgs; i++) {
+          auto dat = can.getDat();
+          if (dbc->msgs[i].address == can.getAddress() && dat.size() <= MAX_MSG_SIZE) {
+            frames.push_back({&dbc->msgs[i], std::vector<uint8_t>(dat.begin(), dat.end())});
+            break;
+          }
+        }
+      }
+    }
+    words = kj::arrayPtr(end, words.end());
+  }
+  munmap(mem, st.st_size);
+  printf("%zu can events, %zu frames in %s\n", events.size(), frames.size(), dbc_name.c_str());
+  if (frames.empty()) return 1;
+
+  // the generated decoders against the generic decode
+  int mismatches = 0;
+  std::vector<double> vals(1024), generic(1024);
+  for (const auto &f : frames) {
+    uint8_t buf[DECODE_BUF_SIZE] = {};
+    memcpy(buf, f.dat.data(), f.dat.size());
+    f.msg->decode(buf, vals.data());
+    for (int i = 0; i < f.msg->num_sigs; i++) {
+      const Signal &sig = f.msg->sigs[i];
+      int64_t tmp = get_raw_value(f.dat, sig);
+      if (sig.is_signed) {
+        tmp -= ((tmp >> (sig.size-1)) & 0x1) ? (1ULL << sig.size) : 0;
+      }
+      if (tmp * sig.factor + sig.offset != vals[i] && mismatches++ < 10) {
+        printf("mismatch 0x%X %s: %f != %f\n", f.msg->address, sig.name, vals[i], tmp * sig.factor + sig.offset);
+      }
+    }
+  }
+  printf("decoders: %d mismatches\n", mismatches);
+
+  // checksums, by address the frames checked and by address and type those that failed.
+  // LKAS11 is checked with each of the Hyundai variants, the car uses the one that fits
+  CANPacker packer(dbc_name);
+  std::map<uint32_t, size_t> checked;
+  std::map<std::pair<uint32_t, SignalType>, size_t> failed;
+  for (const auto &f : frames) {
+    const Signal *sigs_end = f.msg->sigs + f.msg->num_sigs;
+    const Signal *checksum = std::find_if(f.msg->sigs, sigs_end, [](const Signal &sig) { return is_checksum(sig.type); });
+    if (checksum == sigs_end || f.dat.size() != f.msg->size) continue;
+
+    std::vector<SignalType> types = {checksum->type};
+    if (strcmp(f.msg->name, "LKAS11") == 0) {
+      types = {SignalType::HYUNDAI_CHECKSUM, SignalType::HYUNDAI_CHECKSUM_6B, SignalType::HYUNDAI_CRC8};
+    }
+    int msg = packer.message_handle(f.msg->address);
+    checked[f.msg->address]++;
+    for (auto type : types) {
+      packer.set_checksum_type(f.msg->address, type);
+      failed[{f.msg->address, type}] += !checksum_matches(packer, msg, f.dat);
+    }
+  }
+  size_t checksum_failures = 0;
+  for (const auto &[address, count] : checked) {
+    auto best = failed.lower_bound({address, SignalType::DEFAULT});
+    for (auto it = best; it != failed.end() && it->first.first == address; ++it) {
+      if (it->second < best->second) best = it;
+    }
+    printf("checksum 0x%X, type %d: %zu of %zu frames failed\n", address, (int)best->first.second, best->second, count);
+    checksum_failures += best->second;
+  }
+
+  const int runs = 20;
+  double start = now_ms();
+  size_t sigs = 0;
+  for (int r = 0; r < runs; r++) {
+    for (const auto &f : frames) {
+      for (int i = 0; i < f.msg->num_sigs; i++) {
+        const Signal &sig = f.msg->sigs[i];
+        int64_t tmp = get_raw_value(f.dat, sig);
+        if (sig.is_signed) {
+          tmp -= ((tmp >> (sig.size-1)) & 0x1) ? (1ULL << sig.size) : 0;
+        }
+        generic[i] = tmp * sig.factor + sig.offset;
+      }
+      sigs += f.msg->num_sigs;
+    }
+  }
+  double generic_ms = now_ms() - start;
+
+  start = now_ms();
+  for (int r = 0; r < runs; r++) {
+    for (const auto &f : frames) {
+      uint8_t buf[DECODE_BUF_SIZE] = {};
+      memcpy(buf, f.dat.data(), f.dat.size());
+      f.msg->decode(buf, vals.data());
+    }
+  }
+  double generated_ms = now_ms() - start;
+  printf("generic decode:   %.1f ns/signal\n", generic_ms * 1e6 / sigs);
+  printf("generated decode: %.1f ns/signal\n", generated_ms * 1e6 / sigs);
+
+  // the pt, can2 and cam parsers of a car, with all signals
+  std::vector<std::unique_ptr<CANParser>> parsers;
+  for (int bus = 0; bus < 3; bus++) {
+    parsers.emplace_back(new CANParser(bus, dbc_name, true, true));
+  }
+  start = now_ms();
+  for (const auto &e : events) {
+    for (auto &p : parsers) {
+      p->update_string(e, false);
+      p->query_latest();
+    }
+  }
+  double separate_ms = now_ms() - start;
+
+  CANParserGroup group({parsers[0].get(), parsers[1].get(), parsers[2].get()});
+  start = now_ms();
+  for (const auto &e : events) {
+    group.update_string(e, false);
+    for (auto &p : parsers) {
+      p->query_latest();
+    }
+  }
+  double group_ms = now_ms() - start;
+
+  std::vector<uint32_t> changed, received;
+  size_t num_changed = 0;
+  for (auto &p : parsers) {
+    p->enable_change_tracking();
+  }
+  start = now_ms();
+  for (const auto &e : events) {
+    group.update_string(e, false);
+    for (auto &p : parsers) {
+      p->query_changed(changed, received);
+      num_changed += changed.size();
+    }
+  }
+  double tracked_ms = now_ms() - start;
+  printf("3 parsers:        %.1f us/event\n", separate_ms * 1e3 / events.size());
+  printf("CANParserGroup:   %.1f us/event\n", group_ms * 1e3 / events.size());
+  printf("change tracking:  %.1f us/event, %.1f of %zu signals changed\n", tracked_ms * 1e3 / events.size(),
+         (double)num_changed / events.size(), parsers[0]->signal_values.size() * parsers.size());
+  return mismatches > 0 || checksum_failures > 0;
+}
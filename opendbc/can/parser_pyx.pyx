@@ -3,13 +3,16 @@
 
 from libcpp.string cimport string
 from libcpp.vector cimport vector
+from libcpp.utility cimport pair
 from libcpp.unordered_set cimport unordered_set
 from libc.stdint cimport uint32_t, uint64_t, uint16_t
 from libcpp cimport bool
 from libcpp.map cimport map
+from cpython.buffer cimport PyBUF_WRITABLE
 
 from .common cimport CANParser as cpp_CANParser
-from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, DBC
+from .common cimport CANParserGroup as cpp_CANParserGroup
+from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, checksum_type_from_name, SignalValue, DBC
 
 import os
 import numbers
@@ -25,6 +28,10 @@ cdef class CANParser:
     map[string, uint32_t] msg_name_to_address
     map[uint32_t, string] address_to_msg_name
     vector[SignalValue] can_values
+    vector[uint32_t] changed_v
+    vector[uint32_t] received_v
+    list signal_dicts
+    list signal_names
 
   cdef readonly:
     dict vl
@@ -33,8 +40,12 @@ cdef class CANParser:
     bool bus_timeout
     string dbc_name
     int can_invalid_cnt
+    bool track_changes
+    list signals
+    dict signal_index
+    list changed
 
-  def __init__(self, dbc_name, signals, checks=None, bus=0, enforce_checks=True):
+  def __init__(self, dbc_name, signals, checks=None, bus=0, enforce_checks=True, track_changes=False):
     if checks is None:
       checks = []
 
@@ -102,11 +113,46 @@ cdef class CANParser:
       message_options_v.push_back(mpo)
 
     self.can = new cpp_CANParser(bus, dbc_name, message_options_v, signal_options_v)
-    self.update_vl()
 
-  cdef unordered_set[uint32_t] update_vl(self):
-    cdef unordered_set[uint32_t] updated_addrs
+    # With change tracking the values of all signals are kept in one array, see values, and
+    # updates only write the signals that changed into vl. Like with query_latest, vl starts
+    # with every signal at 0. vl_all isn't filled
+    self.track_changes = track_changes
+    self.signals = []
+    self.signal_index = {}
+    self.signal_dicts = []
+    self.signal_names = []
+    self.changed = []
+    cdef vector[pair[uint32_t, const char*]] signal_list
+    if track_changes:
+      self.can.enable_change_tracking()
+      signal_list = self.can.signal_list()
+      for i in range(signal_list.size()):
+        address = signal_list[i].first
+        sig_name = <unicode>signal_list[i].second
+        self.signals.append((address, sig_name))
+        self.signal_index[(address, sig_name)] = i
+        self.signal_index[(self.address_to_msg_name[address].decode('utf8'), sig_name)] = i
+        self.signal_dicts.append(self.vl[address])
+        self.signal_names.append(sig_name)
+        self.vl[address][sig_name] = 0.
+
+    self.update_vl()
 
+  @property
+  def values(self):
+    # Latest value of every signal, indexed like signals. NaN until the signal is first received.
+    # A read only view of the parser's own array, so it stays current without being fetched again.
+    # The view holds a reference to the parser, which keeps the array alive
+    if not self.track_changes:
+      raise RuntimeError("values needs track_changes")
+    if self.can.signal_values.size() == 0:
+      return memoryview(b'').cast('d')
+    cdef SignalValues buf = SignalValues.__new__(SignalValues)
+    buf.parser = self
+    return memoryview(buf)
+
+  cdef void update_valid(self):
     # Update invalid flag
     self.can_invalid_cnt += 1
     if self.can.can_valid:
@@ -114,6 +160,29 @@ cdef class CANParser:
     self.can_valid = self.can_invalid_cnt < CAN_INVALID_CNT
     self.bus_timeout = self.can.bus_timeout
 
+  cdef unordered_set[uint32_t] update_changed(self):
+    # Writes the signals that changed since the last call into vl, and their indexes into changed.
+    # Returns the addresses received since the last call, changed or not
+    cdef unordered_set[uint32_t] updated_addrs
+    cdef uint32_t idx, addr
+    cdef const double *values = self.can.signal_values.data()
+
+    self.can.query_changed(self.changed_v, self.received_v)
+    self.changed = self.changed_v
+    for idx in self.changed_v:
+      self.signal_dicts[idx][self.signal_names[idx]] = values[idx]
+    for addr in self.received_v:
+      updated_addrs.insert(addr)
+
+    return updated_addrs
+
+  cdef unordered_set[uint32_t] update_vl(self):
+    cdef unordered_set[uint32_t] updated_addrs
+
+    self.update_valid()
+    if self.track_changes:
+      return self.update_changed()
+
     new_vals = self.can.query_latest()
     for cv in new_vals:
       # Cast char * directly to unicode
@@ -124,6 +193,10 @@ cdef class CANParser:
 
     return updated_addrs
 
+  def set_checksum_type(self, name_or_addr, checksum_type, check=False):
+    addr = name_or_addr if isinstance(name_or_addr, numbers.Number) else self.msg_name_to_address[name_or_addr.encode('utf8')]
+    self.can.set_checksum_type(addr, checksum_type_from_name(checksum_type), check)
+
   def update_string(self, dat, sendcan=False):
     for v in self.vl_all.values():
       v.clear()
@@ -132,16 +205,94 @@ cdef class CANParser:
     return self.update_vl()
 
   def update_strings(self, strings, sendcan=False):
+    # Returns the addresses received in any of the strings. With change tracking, changed holds
+    # the indexes of the signals that changed over all the strings
     for v in self.vl_all.values():
       v.clear()
 
     updated_addrs = set()
     for s in strings:
       self.can.update_string(s, sendcan)
-      updated_addrs.update(self.update_vl())
+      if self.track_changes:
+        self.update_valid()
+      else:
+        updated_addrs.update(self.update_vl())
+
+    if self.track_changes:
+      updated_addrs.update(self.update_changed())
     return updated_addrs
 
 
+cdef class CANParserGroup:
+  # Updates several CANParsers, usually one per bus, from the same can strings.
+  # Every string is deserialized once for all of them, instead of once per parser
+  cdef:
+    cpp_CANParserGroup *group
+    list parsers
+
+  def __init__(self, parsers):
+    self.parsers = list(parsers)
+
+    cdef vector[cpp_CANParser*] parsers_v
+    cdef CANParser p
+    for p in self.parsers:
+      parsers_v.push_back(p.can)
+    self.group = new cpp_CANParserGroup(parsers_v)
+
+  def __dealloc__(self):
+    del self.group
+
+  def update_strings(self, strings, sendcan=False):
+    cdef CANParser p
+    for p in self.parsers:
+      for v in p.vl_all.values():
+        v.clear()
+
+    updated_addrs = [set() for _ in self.parsers]
+    for s in strings:
+      self.group.update_string(s, sendcan)
+      for i, p in enumerate(self.parsers):
+        if p.track_changes:
+          p.update_valid()
+        else:
+          updated_addrs[i].update(p.update_vl())
+
+    for i, p in enumerate(self.parsers):
+      if p.track_changes:
+        updated_addrs[i].update(p.update_changed())
+    return updated_addrs
+
+
+cdef class SignalValues:
+  # Buffer over the values of a CANParser with change tracking, see CANParser.values. It holds
+  # the parser, so the array outlives any view of it
+  cdef:
+    CANParser parser
+    Py_ssize_t shape[1]
+    Py_ssize_t strides[1]
+
+  def __getbuffer__(self, Py_buffer *buffer, int flags):
+    if flags & PyBUF_WRITABLE:
+      raise BufferError("CANParser values are read only")
+
+    self.shape[0] = self.parser.can.signal_values.size()
+    self.strides[0] = sizeof(double)
+    buffer.buf = self.parser.can.signal_values.data()
+    buffer.format = b'd'
+    buffer.internal = NULL
+    buffer.itemsize = sizeof(double)
+    buffer.len = self.shape[0] * sizeof(double)
+    buffer.ndim = 1
+    buffer.obj = self
+    buffer.readonly = 1
+    buffer.shape = self.shape
+    buffer.strides = self.strides
+    buffer.suboffsets = NULL
+
+  def __releasebuffer__(self, Py_buffer *buffer):
+    pass
+
+
 cdef class CANDefine():
   cdef:
     const DBC *dbc
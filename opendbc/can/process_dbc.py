@@ -7,6 +7,50 @@ import jinja2
 from collections import Counter
 from opendbc.can.dbc import dbc
 
+# Hyundai checksums and counters are named per message, LKAS11 defaults to the checksum
+# of most cars, see CANPacker.set_checksum_type for the others
+HYUNDAI_SIGNAL_TYPES = {
+  (832, "CF_Lkas_Chksum"): "HYUNDAI_CHECKSUM",  # LKAS11
+  (832, "CF_Lkas_MsgCount"): "HYUNDAI_COUNTER",
+  (593, "CF_Mdps_Chksum2"): "HYUNDAI_CHECKSUM",  # MDPS12
+  (593, "CF_Mdps_MsgCount2"): "HYUNDAI_COUNTER",
+  (1057, "CR_VSM_ChkSum"): "HYUNDAI_NIBBLE_CHECKSUM",  # SCC12
+  (1057, "CR_VSM_Alive"): "HYUNDAI_COUNTER",
+}
+
+
+def decode_signal(sig):
+  """C++ expression for the value of sig, from the zero padded message in dat"""
+  if sig.is_little_endian:
+    # lsb first, byte b is the low byte of the little endian word
+    b, shift = sig.lsb // 8, sig.lsb % 8
+    raw = f"(load_le64(dat + {b}) >> {shift})"
+    if shift + sig.size > 64:
+      raw = f"({raw} | ((uint64_t)dat[{b + 8}] << {64 - shift}))"
+  else:
+    # msb first, byte b is the high byte of the big endian word
+    b, e = sig.msb // 8, sig.lsb // 8
+    if e - b <= 7:
+      raw = f"(load_be64(dat + {b}) >> {(7 - (e - b)) * 8 + sig.lsb % 8})"
+    else:
+      shift = sig.lsb % 8
+      raw = f"((load_be64(dat + {b + 1}) >> {shift}) | ((uint64_t)dat[{b}] << {64 - shift}))"
+
+  if sig.size < 64:
+    raw = f"({raw} & 0x{(1 << sig.size) - 1:X}ULL)"
+  if sig.is_signed and sig.size < 64:
+    raw = f"((int64_t)({raw} << {64 - sig.size}) >> {64 - sig.size})"
+  else:
+    raw = f"(int64_t){raw}"
+
+  val = f"(double){raw}"
+  if sig.factor != 1:
+    val += f" * {sig.factor}"
+  if sig.offset != 0:
+    val += f" + {sig.offset}"
+  return val
+
+
 def process(in_fn, out_fn):
   dbc_name = os.path.split(out_fn)[-1].replace('.cc', '')
   # print("processing %s: %s -> %s" % (dbc_name, in_fn, out_fn))
@@ -60,6 +104,13 @@ def process(in_fn, out_fn):
     checksum_start_bit = 7
     counter_start_bit = None
     little_endian = False
+  elif can_dbc.name.startswith(("hyundai_", "kia_")):
+    checksum_type = "hyundai"
+    checksum_size = None
+    counter_size = None
+    checksum_start_bit = None
+    counter_start_bit = None
+    little_endian = None
   else:
     checksum_type = None
     checksum_size = None
@@ -72,7 +123,7 @@ def process(in_fn, out_fn):
   for address, msg_name, _, sigs in msgs:
     dbc_msg_name = dbc_name + " " + msg_name
     for sig in sigs:
-      if checksum_type is not None:
+      if checksum_type not in (None, "hyundai"):
         # checksum rules
         if sig.name == "CHECKSUM":
           if sig.size != checksum_size:
@@ -90,6 +141,15 @@ def process(in_fn, out_fn):
             sys.exit("%s: COUNTER starts at wrong bit" % dbc_msg_name)
           if little_endian != sig.is_little_endian:
             sys.exit("%s: COUNTER has wrong endianness" % dbc_msg_name)
+      # hyundai rules, checksums leave out the byte or nibble they are in
+      hyundai_type = HYUNDAI_SIGNAL_TYPES.get((address, sig.name)) if checksum_type == "hyundai" else None
+      if hyundai_type == "HYUNDAI_CHECKSUM" and (sig.size != 8 or sig.lsb % 8 != 0 or not sig.is_little_endian):
+        sys.exit("%s: %s is not a little endian byte" % (dbc_msg_name, sig.name))
+      if hyundai_type == "HYUNDAI_NIBBLE_CHECKSUM" and (sig.size != 4 or sig.lsb % 4 != 0 or not sig.is_little_endian):
+        sys.exit("%s: %s is not a little endian nibble" % (dbc_msg_name, sig.name))
+      # checksums and counters are compared as integers, see MessageState::parse
+      if (sig.name.startswith(("CHECKSUM", "COUNTER")) or hyundai_type is not None) and (sig.factor != 1 or sig.offset != 0):
+        sys.exit("%s: %s has a factor or offset" % (dbc_msg_name, sig.name))
       # pedal rules
       if address in [0x200, 0x201]:
         if sig.name == "COUNTER_PEDAL" and sig.size != 4:
@@ -103,7 +163,8 @@ def process(in_fn, out_fn):
     if count > 1:
       sys.exit("%s: Duplicate message name in DBC file %s" % (dbc_name, name))
 
-  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals)
+  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals,
+                                decode_signal=decode_signal, hyundai_signal_types=HYUNDAI_SIGNAL_TYPES)
 
   with open(out_fn, "a+") as out_f:
     out_f.seek(0)
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+import unittest
+
+from opendbc.can.packer import CANBatch, CANPacker
+
+DBC_NAME = "hyundai_kia_generic"
+MSGS = [
+  ("LKAS11", 0, {"CR_Lkas_StrToqReq": -120, "CF_Lkas_Chksum": 0, "CF_Lkas_MsgCount": 3}, -1),
+  ("CLU11", 2, {"CF_Clu_CruiseSwState": 1, "CF_Clu_Vanz": 20, "CF_Clu_AliveCnt1": 7}, -1),
+  ("SCC12", 0, {"ACCMode": 1, "aReqRaw": -0.5, "aReqValue": -0.5, "CR_VSM_Alive": 9}, -1),
+  (1265, 0, {"CF_Clu_Vanz": 30, "NOT_A_SIGNAL": 1}, 5),
+]
+
+
+class TestCANPacker(unittest.TestCase):
+  def setUp(self):
+    self.packer = CANPacker(DBC_NAME)
+    self.packer.set_checksum_type("LKAS11", "HYUNDAI_CHECKSUM")
+
+  def test_make_can_msgs(self):
+    expected = [self.packer.make_can_msg(*m) for m in MSGS]
+    self.assertEqual(self.packer.make_can_msgs(MSGS), expected)
+    self.assertEqual(self.packer.make_can_msgs([]), [])
+
+  def test_batch(self):
+    batch = CANBatch(self.packer)
+    can_sends = [batch.make_can_msg(*m) for m in MSGS]
+    batch.flush()
+    self.assertEqual(can_sends, [self.packer.make_can_msg(*m) for m in MSGS])
+
+    # the next cycle starts empty
+    msg = batch.make_can_msg(*MSGS[0])
+    batch.flush()
+    self.assertEqual(msg, can_sends[0])
+
+  def test_handles(self):
+    for name_or_addr, bus, values, counter in MSGS:
+      addr, _, expected, _ = self.packer.make_can_msg(name_or_addr, bus, values, counter)
+      msg = self.packer.message_handle(name_or_addr)
+      self.assertEqual(self.packer.message_handle(addr), msg)
+
+      dat = bytearray(self.packer.message_size(msg))
+      for name, value in values.items():
+        self.packer.set_signal(msg, self.packer.signal_handle(msg, name), value, dat)
+      self.packer.finish(msg, dat, counter)
+      self.assertEqual(bytes(dat), expected)
+
+  def test_invalid_handles(self):
+    msg = self.packer.message_handle("CLU11")
+    sig = self.packer.signal_handle(msg, "CF_Clu_Vanz")
+    with self.assertRaises(KeyError):
+      self.packer.message_handle("NOT_A_MESSAGE")
+    with self.assertRaises(IndexError):
+      self.packer.message_size(-1)
+    with self.assertRaises(IndexError):
+      self.packer.set_signal(msg, 1000, 0, bytearray(self.packer.message_size(msg)))
+    with self.assertRaises(ValueError):
+      self.packer.set_signal(msg, sig, 0, bytearray(1))
+    with self.assertRaises(ValueError):
+      self.packer.finish(msg, bytearray(1))
+
+
+if __name__ == "__main__":
+  unittest.main()
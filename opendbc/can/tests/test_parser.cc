@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "catch2/catch.hpp"
+// common.h has its own INFO and WARN
+#undef INFO
+#undef WARN
+#include "opendbc/can/common.h"
+
+static const char *DBC_NAME = "hyundai_kia_generic";
+const uint32_t CLU11 = 1265, WHL_SPD11 = 902;
+
+const std::vector<MessageParseOptions> MESSAGES = {
+  {.address = CLU11, .check_frequency = 0},
+  {.address = WHL_SPD11, .check_frequency = 0},
+};
+const std::vector<SignalParseOptions> SIGNALS = {
+  {.address = CLU11, .name = "CF_Clu_CruiseSwState"},
+  {.address = CLU11, .name = "CF_Clu_Vanz"},
+  {.address = WHL_SPD11, .name = "WHL_SPD_FL"},
+  {.address = WHL_SPD11, .name = "WHL_SPD_FR"},
+};
+
+struct CanFrame {
+  uint32_t address;
+  std::vector<uint8_t> dat;
+};
+
+// Parses a can event with the frames on bus 0
+static void update(CANParser &parser, uint64_t mono_time, const std::vector<CanFrame> &frames) {
+  capnp::MallocMessageBuilder msg;
+  auto event = msg.initRoot<cereal::Event>();
+  event.setLogMonoTime(mono_time);
+  auto cans = event.initCan(frames.size());
+  for (size_t i = 0; i < frames.size(); i++) {
+    cans[i].setAddress(frames[i].address);
+    cans[i].setSrc(0);
+    cans[i].setDat(kj::arrayPtr(frames[i].dat.data(), frames[i].dat.size()));
+  }
+  auto bytes = capnp::messageToFlatArray(msg).releaseAsBytes();
+  parser.update_string(std::string((const char *)bytes.begin(), bytes.size()), false);
+}
+
+// CLU11 with CF_Clu_CruiseSwState and CF_Clu_Vanz, in 0.5 km/h
+static CanFrame clu11(uint8_t cruise_sw_state, uint8_t vanz) {
+  return {CLU11, {cruise_sw_state, vanz, 0, 0}};
+}
+
+static size_t signal_index(CANParser &parser, uint32_t address, const std::string &name) {
+  auto signals = parser.signal_list();
+  auto it = std::find_if(signals.begin(), signals.end(), [&](auto &s) { return s.first == address && s.second == name; });
+  REQUIRE(it != signals.end());
+  return it - signals.begin();
+}
+
+TEST_CASE("CANParser change tracking lists the parsed signals") {
+  CANParser parser(0, DBC_NAME, MESSAGES, SIGNALS);
+  parser.enable_change_tracking();
+
+  // in address order
+  auto signals = parser.signal_list();
+  REQUIRE(signals.size() == SIGNALS.size());
+  REQUIRE(parser.signal_values.size() == SIGNALS.size());
+  REQUIRE(std::is_sorted(signals.begin(), signals.end(), [](auto &a, auto &b) { return a.first < b.first; }));
+  for (const auto &s : SIGNALS) {
+    REQUIRE(std::count_if(signals.begin(), signals.end(), [&](auto &sig) {
+      return sig.first == s.address && std::string(sig.second) == s.name;
+    }) == 1);
+  }
+
+  // NaN until first received
+  for (double v : parser.signal_values) {
+    REQUIRE(std::isnan(v));
+  }
+  update(parser, 1, {clu11(1, 40)});
+  REQUIRE(parser.signal_values[signal_index(parser, CLU11, "CF_Clu_CruiseSwState")] == 1);
+  REQUIRE(parser.signal_values[signal_index(parser, CLU11, "CF_Clu_Vanz")] == 20);
+  REQUIRE(std::isnan(parser.signal_values[signal_index(parser, WHL_SPD11, "WHL_SPD_FL")]));
+  REQUIRE(std::isnan(parser.signal_values[signal_index(parser, WHL_SPD11, "WHL_SPD_FR")]));
+}
+
+TEST_CASE("CANParser query_changed lists a signal once per call") {
+  CANParser parser(0, DBC_NAME, MESSAGES, SIGNALS);
+  parser.enable_change_tracking();
+  const uint32_t cruise = signal_index(parser, CLU11, "CF_Clu_CruiseSwState");
+  const uint32_t vanz = signal_index(parser, CLU11, "CF_Clu_Vanz");
+  std::vector<uint32_t> changed, received;
+
+  // the first values are changes, even when they're received twice
+  update(parser, 1, {clu11(1, 40), clu11(1, 80)});
+  parser.query_changed(changed, received);
+  std::sort(changed.begin(), changed.end());
+  REQUIRE(changed == std::vector<uint32_t>{std::min(cruise, vanz), std::max(cruise, vanz)});
+  REQUIRE(received == std::vector<uint32_t>{CLU11});
+  REQUIRE(parser.signal_values[vanz] == 40);
+
+  // changed twice, over two events
+  update(parser, 2, {clu11(1, 60)});
+  update(parser, 3, {clu11(1, 100)});
+  parser.query_changed(changed, received);
+  REQUIRE(changed == std::vector<uint32_t>{vanz});
+  REQUIRE(received == std::vector<uint32_t>{CLU11});
+  REQUIRE(parser.signal_values[vanz] == 50);
+
+  // changed and back, it's still listed
+  update(parser, 4, {clu11(1, 120), clu11(1, 100)});
+  parser.query_changed(changed, received);
+  REQUIRE(changed == std::vector<uint32_t>{vanz});
+  REQUIRE(parser.signal_values[vanz] == 50);
+
+  // received without a change
+  update(parser, 5, {clu11(1, 100)});
+  parser.query_changed(changed, received);
+  REQUIRE(changed.empty());
+  REQUIRE(received == std::vector<uint32_t>{CLU11});
+
+  update(parser, 6, {});
+  parser.query_changed(changed, received);
+  REQUIRE(changed.empty());
+  REQUIRE(received.empty());
+}
+
+TEST_CASE("CANParser change tracking agrees with query_latest") {
+  CANParser latest(0, DBC_NAME, MESSAGES, SIGNALS);
+  CANParser tracked(0, DBC_NAME, MESSAGES, SIGNALS);
+  tracked.enable_change_tracking();
+  auto signals = tracked.signal_list();
+
+  // A stream of events with up to 3 frames each, from a few values so that some repeat
+  uint32_t seed = 1;
+  auto rand = [&]() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % 4;
+  };
+  std::map<std::pair<uint32_t, std::string>, double> vl;
+  std::vector<double> prev_values = tracked.signal_values;
+  std::vector<uint32_t> changed, received;
+  for (uint64_t t = 1; t <= 500; t++) {
+    std::vector<CanFrame> frames;
+    for (int i = rand() % 4; i > 0; i--) {
+      if (rand() % 2) {
+        frames.push_back(clu11(rand(), rand() * 10));
+      } else {
+        frames.push_back({WHL_SPD11, {(uint8_t)(rand() * 16), 0, (uint8_t)rand(), 0, 0, 0, 0, 0}});
+      }
+    }
+    update(latest, t, frames);
+    update(tracked, t, frames);
+
+    std::set<uint32_t> latest_received;
+    for (const auto &v : latest.query_latest()) {
+      vl[{v.address, v.name}] = v.value;
+      latest_received.insert(v.address);
+    }
+    tracked.query_changed(changed, received);
+    REQUIRE(std::set<uint32_t>(received.begin(), received.end()) == latest_received);
+    REQUIRE(received.size() == latest_received.size());
+
+    std::set<uint32_t> changed_set(changed.begin(), changed.end());
+    REQUIRE(changed_set.size() == changed.size());
+    for (size_t i = 0; i < signals.size(); i++) {
+      auto it = vl.find({signals[i].first, signals[i].second});
+      if (it == vl.end()) {
+        REQUIRE(std::isnan(tracked.signal_values[i]));
+      } else {
+        REQUIRE(tracked.signal_values[i] == it->second);
+      }
+      // a change since the last event is always listed, and only received signals are
+      bool differs = !(tracked.signal_values[i] == prev_values[i]) && !std::isnan(tracked.signal_values[i]);
+      if (differs) {
+        REQUIRE(changed_set.count(i) == 1);
+      }
+      if (changed_set.count(i)) {
+        REQUIRE(latest_received.count(signals[i].first) == 1);
+      }
+    }
+    prev_values = tracked.signal_values;
+  }
+}
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+import gc
+import math
+import random
+import unittest
+
+from opendbc.can.packer import CANPacker
+from opendbc.can.parser import CANParser
+from selfdrive.boardd.boardd import can_list_to_can_capnp
+
+DBC_NAME = "hyundai_kia_generic"
+SIGNALS = [
+  ("CF_Clu_CruiseSwState", "CLU11"),
+  ("CF_Clu_Vanz", "CLU11"),
+  ("WHL_SPD_FL", "WHL_SPD11"),
+  ("WHL_SPD_FR", "WHL_SPD11"),
+]
+CHECKS = [("CLU11", 0), ("WHL_SPD11", 0)]
+
+
+class TestCANParserChangeTracking(unittest.TestCase):
+  def setUp(self):
+    self.packer = CANPacker(DBC_NAME)
+
+  @staticmethod
+  def parser(track_changes):
+    return CANParser(DBC_NAME, list(SIGNALS), list(CHECKS), 0, track_changes=track_changes)
+
+  def can_string(self, msgs):
+    return can_list_to_can_capnp([self.packer.make_can_msg(name, 0, values) for name, values in msgs])
+
+  def test_signal_index(self):
+    cp = self.parser(True)
+    self.assertEqual(len(cp.signals), len(SIGNALS))
+    self.assertEqual(len(cp.values), len(SIGNALS))
+    for sig, msg in SIGNALS:
+      i = cp.signal_index[(msg, sig)]
+      address, name = cp.signals[i]
+      self.assertEqual(name, sig)
+      self.assertEqual(cp.signal_index[(address, sig)], i)
+      self.assertIs(cp.vl[address], cp.vl[msg])
+
+  def test_values_before_receive(self):
+    cp = self.parser(True)
+    # values tell whether a signal was received, vl starts at 0 like without tracking
+    self.assertTrue(all(math.isnan(v) for v in cp.values))
+    self.assertEqual(cp.vl["CLU11"], self.parser(False).vl["CLU11"])
+
+    cp.update_strings([self.can_string([("CLU11", {"CF_Clu_CruiseSwState": 1, "CF_Clu_Vanz": 20})])])
+    values = cp.values
+    self.assertEqual(values[cp.signal_index[("CLU11", "CF_Clu_CruiseSwState")]], 1)
+    self.assertEqual(values[cp.signal_index[("CLU11", "CF_Clu_Vanz")]], 20)
+    self.assertTrue(math.isnan(values[cp.signal_index[("WHL_SPD11", "WHL_SPD_FL")]]))
+
+  def test_values_keep_the_parser(self):
+    values = self.parser(True).values
+    gc.collect()
+    self.assertTrue(values.readonly)
+    self.assertTrue(all(math.isnan(v) for v in values))
+
+  def test_changed_once_per_update(self):
+    cp = self.parser(True)
+    vanz = cp.signal_index[("CLU11", "CF_Clu_Vanz")]
+
+    def clu11(speed):
+      return self.can_string([("CLU11", {"CF_Clu_Vanz": speed})])
+
+    cp.update_strings([clu11(10)])
+
+    # changed twice
+    updated = cp.update_strings([clu11(20), clu11(30)])
+    self.assertEqual(cp.changed, [vanz])
+    self.assertEqual(cp.vl["CLU11"]["CF_Clu_Vanz"], 30)
+    self.assertEqual(updated, {cp.signals[vanz][0]})
+
+    # received without a change is still updated
+    updated = cp.update_strings([clu11(30)])
+    self.assertEqual(cp.changed, [])
+    self.assertEqual(updated, {cp.signals[vanz][0]})
+
+    self.assertEqual(cp.update_strings([]), set())
+
+  def test_vl_matches_query_latest(self):
+    latest, tracked = self.parser(False), self.parser(True)
+    random.seed(0)
+    for _ in range(200):
+      strings = []
+      for _ in range(random.randint(0, 3)):
+        msgs = []
+        if random.random() < 0.7:
+          msgs.append(("CLU11", {"CF_Clu_CruiseSwState": random.randint(0, 2), "CF_Clu_Vanz": random.randint(0, 3) * 10}))
+        if random.random() < 0.7:
+          msgs.append(("WHL_SPD11", {"WHL_SPD_FL": random.randint(0, 3), "WHL_SPD_FR": random.randint(0, 3)}))
+        strings.append(self.can_string(msgs))
+
+      prev = list(tracked.values)
+      self.assertEqual(tracked.update_strings(strings), latest.update_strings(strings))
+      for sig, msg in SIGNALS:
+        self.assertEqual(tracked.vl[msg][sig], latest.vl[msg][sig])
+      changed = [i for i, v in enumerate(tracked.values) if not (math.isnan(v) or v == prev[i])]
+      self.assertTrue(set(changed) <= set(tracked.changed))
+
+
+if __name__ == "__main__":
+  unittest.main()
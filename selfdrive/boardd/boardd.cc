@@ -245,6 +245,8 @@ void can_recv_thread(std::vector<Panda *> pandas) {
   const uint64_t dt = 10000000ULL;
   uint64_t next_frame_time = nanos_since_boot() + dt;
   std::vector<can_frame> raw_can_data;
+  // 32kB, enough for a full bus
+  PooledMessageBuilder msg_pool(4096);
 
   while (!do_exit && check_all_connected(pandas)) {
     bool comms_healthy = true;
@@ -253,7 +255,7 @@ void can_recv_thread(std::vector<Panda *> pandas) {
       comms_healthy &= panda->can_receive(raw_can_data);
     }
 
-    MessageBuilder msg;
+    MessageBuilder &msg = msg_pool.next();
     auto evt = msg.initEvent();
     evt.setValid(comms_healthy);
     auto canData = evt.initCan(raw_can_data.size());
@@ -6,10 +6,10 @@ from common.numpy_fast import clip, interp
 from selfdrive.car import apply_std_steer_torque_limits
 from selfdrive.car.hyundai.hyundaican import create_lkas11, create_clu11, \
   create_scc11, create_scc12, create_scc13, create_scc14, \
-  create_mdps12, create_lfahda_mfc, create_hda_mfc
+  create_mdps12, create_lfahda_mfc, create_hda_mfc, lkas11_checksum_type
 from selfdrive.car.hyundai.scc_smoother import SccSmoother
 from selfdrive.car.hyundai.values import Buttons, CAR, FEATURES, CarControllerParams
-from opendbc.can.packer import CANPacker
+from opendbc.can.packer import CANBatch, CANPacker
 from common.conversions import Conversions as CV
 from common.params import Params
 from selfdrive.controls.lib.longcontrol import LongCtrlState
@@ -49,6 +49,9 @@ class CarController:
     self.car_fingerprint = CP.carFingerprint
     self.params = CarControllerParams(CP)
     self.packer = CANPacker(dbc_name)
+    self.packer.set_checksum_type("LKAS11", lkas11_checksum_type(self.car_fingerprint))
+    # the messages of a cycle are packed together when update returns
+    self.can_batch = CANBatch(self.packer)
     self.frame = 0
 
     self.apply_steer_last = 0
@@ -186,23 +189,23 @@ class CarController:
         self.cut_steer_frames += 1
 
     can_sends = []
-    can_sends.append(create_lkas11(self.packer, self.frame, self.car_fingerprint, apply_steer, lkas_active,
+    can_sends.append(create_lkas11(self.can_batch, self.frame, self.car_fingerprint, apply_steer, lkas_active,
                                    CS.lkas11, sys_warning, sys_state, CC.enabled, hud_control.leftLaneVisible, hud_control.rightLaneVisible,
                                    left_lane_warning, right_lane_warning, 0, self.ldws_opt, cut_steer_temp))
 
     if CS.mdps_bus or CS.scc_bus == 1:  # send lkas11 bus 1 if mdps or scc is on bus 1
-      can_sends.append(create_lkas11(self.packer, self.frame, self.car_fingerprint, apply_steer, lkas_active,
+      can_sends.append(create_lkas11(self.can_batch, self.frame, self.car_fingerprint, apply_steer, lkas_active,
                                      CS.lkas11, sys_warning, sys_state, CC.enabled, hud_control.leftLaneVisible, hud_control.rightLaneVisible,
                                      left_lane_warning, right_lane_warning, 1, self.ldws_opt, cut_steer_temp))
 
     if self.frame % 2 and CS.mdps_bus: # send clu11 to mdps if it is not on bus 0
-      can_sends.append(create_clu11(self.packer, CS.mdps_bus, CS.clu11, Buttons.NONE, enabled_speed))
+      can_sends.append(create_clu11(self.can_batch, CS.mdps_bus, CS.clu11, Buttons.NONE, enabled_speed))
 
     if pcm_cancel_cmd and (self.longcontrol and not self.mad_mode_enabled):
-      can_sends.append(create_clu11(self.packer, CS.scc_bus, CS.clu11, Buttons.CANCEL, clu11_speed))
+      can_sends.append(create_clu11(self.can_batch, CS.scc_bus, CS.clu11, Buttons.CANCEL, clu11_speed))
 
     if CS.mdps_bus or self.car_fingerprint in FEATURES["send_mdps12"]:  # send mdps12 to LKAS to prevent LKAS error
-      can_sends.append(create_mdps12(self.packer, self.frame, CS.mdps12))
+      can_sends.append(create_mdps12(self.can_batch, self.frame, CS.mdps12))
 
     self.update_auto_resume(CC, CS, clu11_speed, can_sends)
     self.update_scc(CC, CS, actuators, controls, hud_control, can_sends)
@@ -240,14 +243,15 @@ class CarController:
       activated_hda = road_speed_limiter_get_active()
       # activated_hda: 0 - off, 1 - main road, 2 - highway
       if self.car_fingerprint in FEATURES["send_lfa_mfa"]:
-        can_sends.append(create_lfahda_mfc(self.packer, CC.enabled, activated_hda))
+        can_sends.append(create_lfahda_mfc(self.can_batch, CC.enabled, activated_hda))
       elif CS.has_lfa_hda:
-        can_sends.append(create_hda_mfc(self.packer, activated_hda, CS, hud_control.leftLaneVisible, hud_control.rightLaneVisible))
+        can_sends.append(create_hda_mfc(self.can_batch, activated_hda, CS, hud_control.leftLaneVisible, hud_control.rightLaneVisible))
 
     new_actuators = actuators.copy()
     new_actuators.steer = apply_steer / self.params.STEER_MAX
     new_actuators.accel = self.accel
 
+    self.can_batch.flush()
     self.frame += 1
     return new_actuators, can_sends
 
@@ -266,7 +270,7 @@ class CarController:
         self.resume_wait_timer -= 1
 
       elif abs(CS.lead_distance - self.last_lead_distance) > 0.1:
-        can_sends.append(create_clu11(self.packer, CS.scc_bus, CS.clu11, Buttons.RES_ACCEL, clu11_speed))
+        can_sends.append(create_clu11(self.can_batch, CS.scc_bus, CS.clu11, Buttons.RES_ACCEL, clu11_speed))
         self.resume_cnt += 1
 
         if self.resume_cnt >= randint(6, 8):
@@ -279,7 +283,7 @@ class CarController:
   def update_scc(self, CC, CS, actuators, controls, hud_control, can_sends):
 
     # scc smoother
-    self.scc_smoother.update(CC.enabled, can_sends, self.packer, CC, CS, self.frame, controls)
+    self.scc_smoother.update(CC.enabled, can_sends, self.can_batch, CC, CS, self.frame, controls)
 
     # send scc to car if longcontrol enabled and SCC not on bus 0 or ont live
     if self.longcontrol and CS.cruiseState_enabled and (CS.scc_bus or not self.scc_live):
@@ -363,15 +367,15 @@ class CarController:
         self.scc12_cnt += 1
         self.scc12_cnt %= 0xF
 
-        can_sends.append(create_scc12(self.packer, apply_accel, CC.enabled, self.scc12_cnt, self.scc_live, CS.scc12,
+        can_sends.append(create_scc12(self.can_batch, apply_accel, CC.enabled, self.scc12_cnt, self.scc_live, CS.scc12,
                                       CS.out.gasPressed, CS.out.brakePressed, CS.out.cruiseState.standstill,
                                       self.car_fingerprint, self.stopped, radar_recog, CS.out.stockAeb))
 
-        can_sends.append(create_scc11(self.packer, self.frame, CC.enabled, set_speed, hud_control.leadVisible, self.scc_live, CS.scc11,
+        can_sends.append(create_scc11(self.can_batch, self.frame, CC.enabled, set_speed, hud_control.leadVisible, self.scc_live, CS.scc11,
                        self.scc_smoother.active_cam, stock_cam, self.stopped))
 
         if self.frame % 20 == 0 and CS.has_scc13:
-          can_sends.append(create_scc13(self.packer, CS.scc13))
+          can_sends.append(create_scc13(self.can_batch, CS.scc13))
 
         if CS.has_scc14:
           acc_standstill = stopping if CS.out.vEgo < 2. else False
@@ -386,7 +390,7 @@ class CarController:
             obj_gap = 0
 
           can_sends.append(
-            create_scc14(self.packer, CC.enabled, CS.out.vEgo, acc_standstill, apply_accel, CS.out.gasPressed,
+            create_scc14(self.can_batch, CC.enabled, CS.out.vEgo, acc_standstill, apply_accel, CS.out.gasPressed,
                          obj_gap, CS.scc14))
     else:
       self.scc12_cnt = -1
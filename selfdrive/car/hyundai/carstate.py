@@ -56,6 +56,19 @@ class CarState(CarStateBase):
     # janpoo6427
     self.prev_cruiseState_speed = 0
 
+    # The gateway, TPMS and navigation messages rarely change, so what comes from them is only
+    # computed again when one of their signals changed, see CANParser.changed. Indexes of the
+    # signals of each of them, filled on the first update
+    self.slow_signals = None
+    self.door_open = False
+    self.seatbelt_unlatched = False
+    self.tpms = (0., 0., 0., 0.)
+    self.navi = (0., 0., 0., 0.)
+    self.navi_speed_limit = 0
+
+  def slow_changed(self, changed, *msgs):
+    return any(not changed.isdisjoint(self.slow_signals[msg]) for msg in msgs)
+
   def update(self, cp, cp2, cp_cam):
     cp_mdps = cp2 if self.mdps_bus else cp
     cp_sas = cp2 if self.sas_bus else cp
@@ -68,10 +81,20 @@ class CarState(CarStateBase):
 
     ret = car.CarState.new_message()
 
-    ret.doorOpen = any([cp.vl["CGW1"]["CF_Gway_DrvDrSw"], cp.vl["CGW1"]["CF_Gway_AstDrSw"],
-                        cp.vl["CGW2"]["CF_Gway_RLDrSw"], cp.vl["CGW2"]["CF_Gway_RRDrSw"]])
+    # everything is new on the first update
+    if self.slow_signals is None:
+      self.slow_signals = {msg: {i for (m, _), i in cp.signal_index.items() if m == msg}
+                           for msg in ("CGW1", "CGW2", "TPMS11", "NAVI", "Navi_HU")}
+      changed = set(range(len(cp.signals)))
+    else:
+      changed = set(cp.changed)
 
-    ret.seatbeltUnlatched = cp.vl["CGW1"]["CF_Gway_DrvSeatBeltSw"] == 0
+    if self.slow_changed(changed, "CGW1", "CGW2"):
+      self.door_open = any([cp.vl["CGW1"]["CF_Gway_DrvDrSw"], cp.vl["CGW1"]["CF_Gway_AstDrSw"],
+                            cp.vl["CGW2"]["CF_Gway_RLDrSw"], cp.vl["CGW2"]["CF_Gway_RRDrSw"]])
+      self.seatbelt_unlatched = cp.vl["CGW1"]["CF_Gway_DrvSeatBeltSw"] == 0
+    ret.doorOpen = self.door_open
+    ret.seatbeltUnlatched = self.seatbelt_unlatched
 
     self.is_set_speed_in_mph = bool(cp.vl["CLU11"]["CF_Clu_SPEED_UNIT"])
     self.speed_conv_to_ms = CV.MPH_TO_MS if self.is_set_speed_in_mph else CV.KPH_TO_MS
@@ -229,11 +252,11 @@ class CarState(CarStateBase):
     self.cruiseState_speed = ret.cruiseState.speed
     ret.cruiseGap = self.cruise_gap
 
-    tpms_unit = cp.vl["TPMS11"]["UNIT"] * 0.725 if int(cp.vl["TPMS11"]["UNIT"]) > 0 else 1.
-    ret.tpms.fl = tpms_unit * cp.vl["TPMS11"]["PRESSURE_FL"]
-    ret.tpms.fr = tpms_unit * cp.vl["TPMS11"]["PRESSURE_FR"]
-    ret.tpms.rl = tpms_unit * cp.vl["TPMS11"]["PRESSURE_RL"]
-    ret.tpms.rr = tpms_unit * cp.vl["TPMS11"]["PRESSURE_RR"]
+    if self.slow_changed(changed, "TPMS11"):
+      tpms = cp.vl["TPMS11"]
+      tpms_unit = tpms["UNIT"] * 0.725 if int(tpms["UNIT"]) > 0 else 1.
+      self.tpms = tuple(tpms_unit * tpms[sig] for sig in ("PRESSURE_FL", "PRESSURE_FR", "PRESSURE_RL", "PRESSURE_RR"))
+    ret.tpms.fl, ret.tpms.fr, ret.tpms.rl, ret.tpms.rr = self.tpms
 
     # janpoo6427
     self.prev_cruiseState_speed = self.cruiseState_speed if self.cruiseState_speed else self.prev_cruiseState_speed
@@ -264,15 +287,17 @@ class CarState(CarStateBase):
     #self.is_highway = cp_scc.vl["SCC11"]["Navi_SCC_Camera_Act"] != 0.
 
     if "NAVI" in cp.vl:
-      ret.naviSafetyInfo.sign = cp.vl["NAVI"]["OPKR_S_Sign"]
-      ret.naviSafetyInfo.dist1 = cp.vl["NAVI"]["OPKR_S_Dist"]
-      ret.naviSafetyInfo.speed2 = cp.vl["NAVI"]["OPKR_SBR_LSpd"]
-      ret.naviSafetyInfo.dist2 = cp.vl["NAVI"]["OPKR_SBR_Dist"]
+      if self.slow_changed(changed, "NAVI"):
+        navi = cp.vl["NAVI"]
+        self.navi = (navi["OPKR_S_Sign"], navi["OPKR_S_Dist"], navi["OPKR_SBR_LSpd"], navi["OPKR_SBR_Dist"])
+      ret.naviSafetyInfo.sign, ret.naviSafetyInfo.dist1, ret.naviSafetyInfo.speed2, ret.naviSafetyInfo.dist2 = self.navi
       ret.naviSafetyInfo.dist = ret.naviSafetyInfo.dist1 if ret.naviSafetyInfo.dist1 < 1023 else ret.naviSafetyInfo.dist2 if ret.naviSafetyInfo.dist2 < 65535 else 0
 
     if self.CP.naviCluster == 1:
-      speedLimit = cp.vl["Navi_HU"]["SpeedLim_Nav_Clu"]
-      ret.naviSafetyInfo.speedLimit = speedLimit if speedLimit < 255 else 0
+      if self.slow_changed(changed, "Navi_HU"):
+        speedLimit = cp.vl["Navi_HU"]["SpeedLim_Nav_Clu"]
+        self.navi_speed_limit = speedLimit if speedLimit < 255 else 0
+      ret.naviSafetyInfo.speedLimit = self.navi_speed_limit
     else:
       ret.naviSafetyInfo.speedLimit = 0
 
@@ -515,7 +540,7 @@ class CarState(CarStateBase):
       signals.append(("SpeedLim_Nav_Clu", "Navi_HU"))
       checks.append(("Navi_HU", 5))
 
-    return CANParser(DBC[CP.carFingerprint]["pt"], signals, checks, 0, enforce_checks=False)
+    return CANParser(DBC[CP.carFingerprint]["pt"], signals, checks, 0, enforce_checks=False, track_changes=True)
 
   @staticmethod
   def get_can2_parser(CP):
@@ -603,7 +628,7 @@ class CarState(CarStateBase):
         ("SCC11", 50),
         ("SCC12", 50),
       ]
-    return CANParser(DBC[CP.carFingerprint]["pt"], signals, checks, 1, enforce_checks=False)
+    return CANParser(DBC[CP.carFingerprint]["pt"], signals, checks, 1, enforce_checks=False, track_changes=True)
 
   @staticmethod
   def get_cam_can_parser(CP):
@@ -697,4 +722,4 @@ class CarState(CarStateBase):
         ]
         checks += [("LFAHDA_MFC", 20)]
 
-    return CANParser(DBC[CP.carFingerprint]["pt"], signals, checks, 2, enforce_checks=False)
+    return CANParser(DBC[CP.carFingerprint]["pt"], signals, checks, 2, enforce_checks=False, track_changes=True)
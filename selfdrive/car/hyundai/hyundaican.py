@@ -1,9 +1,18 @@
 import copy
 
-import crcmod
 from selfdrive.car.hyundai.values import CAR, CHECKSUM, FEATURES, EV_HYBRID_CAR
 
-hyundai_checksum = crcmod.mkCrcFun(0x11D, initCrc=0xFD, rev=False, xorOut=0xdf)
+
+def lkas11_checksum_type(car_fingerprint):
+  # CF_Lkas_Chksum is filled in by the packer and checked by the parsers, it differs between cars
+  if car_fingerprint in CHECKSUM["crc8"]:
+    # CRC Checksum as seen on 2019 Hyundai Santa Fe
+    return "HYUNDAI_CRC8"
+  elif car_fingerprint in CHECKSUM["6B"]:
+    # Checksum of first 6 Bytes, as seen on 2018 Kia Sorento
+    return "HYUNDAI_CHECKSUM_6B"
+  # Checksum of first 6 Bytes and last Byte as seen on 2018 Kia Stinger
+  return "HYUNDAI_CHECKSUM"
 
 
 def create_lkas11(packer, frame, car_fingerprint, apply_steer, steer_req,
@@ -19,7 +28,6 @@ def create_lkas11(packer, frame, car_fingerprint, apply_steer, steer_req,
   values["CF_Lkas_ActToi"] = steer_req and not cut_steer_temp
   values["CF_Lkas_ToiFlt"] = cut_steer_temp  # seems to allow actuation on CR_Lkas_StrToqReq
   values["CF_Lkas_MsgCount"] = frame % 0x10
-  values["CF_Lkas_Chksum"] = 0
 
   if car_fingerprint in FEATURES["send_lfa_mfa"]:
     values["CF_Lkas_LdwsActivemode"] = int(left_lane) + (int(right_lane) << 1)
@@ -53,21 +61,6 @@ def create_lkas11(packer, frame, car_fingerprint, apply_steer, steer_req,
   if ldws_opt:
     values["CF_Lkas_LdwsOpt_USM"] = 3
 
-  dat = packer.make_can_msg("LKAS11", 0, values)[2]
-
-  if car_fingerprint in CHECKSUM["crc8"]:
-    # CRC Checksum as seen on 2019 Hyundai Santa Fe
-    dat = dat[:6] + dat[7:8]
-    checksum = hyundai_checksum(dat)
-  elif car_fingerprint in CHECKSUM["6B"]:
-    # Checksum of first 6 Bytes, as seen on 2018 Kia Sorento
-    checksum = sum(dat[:6]) % 256
-  else:
-    # Checksum of first 6 Bytes and last Byte as seen on 2018 Kia Stinger
-    checksum = (sum(dat[:6]) + dat[7]) % 256
-
-  values["CF_Lkas_Chksum"] = checksum
-
   return packer.make_can_msg("LKAS11", bus, values)
 
 def create_clu11(packer, bus, clu11, button, speed):
@@ -115,11 +108,6 @@ def create_mdps12(packer, frame, mdps12):
   values["CF_Mdps_ToiActive"] = 0
   values["CF_Mdps_ToiUnavail"] = 1
   values["CF_Mdps_MsgCount2"] = frame % 0x100
-  values["CF_Mdps_Chksum2"] = 0
-
-  dat = packer.make_can_msg("MDPS12", 2, values)[2]
-  checksum = sum(dat) % 256
-  values["CF_Mdps_Chksum2"] = checksum
 
   return packer.make_can_msg("MDPS12", 2, values)
 
@@ -183,9 +171,6 @@ def create_scc12(packer, apply_accel, enabled, cnt, scc_live, scc12, gaspressed,
     values["ACCMode"] = 1 if enabled else 0 # 2 if gas padel pressed
 
   values["CR_VSM_Alive"] = cnt
-  values["CR_VSM_ChkSum"] = 0
-  dat = packer.make_can_msg("SCC12", 0, values)[2]
-  values["CR_VSM_ChkSum"] = 16 - sum([sum(divmod(i, 16)) for i in dat]) % 16
 
   return packer.make_can_msg("SCC12", 0, values)
 
@@ -6,8 +6,10 @@ from common.numpy_fast import interp
 from common.conversions import Conversions as CV
 from selfdrive.car.hyundai.values import CAR, DBC, Buttons, CarControllerParams
 from selfdrive.car.hyundai.radar_interface import RADAR_START_ADDR
+from selfdrive.car.hyundai.hyundaican import lkas11_checksum_type
 from selfdrive.car import STD_CARGO_KG, scale_rot_inertia, scale_tire_stiffness, gen_empty_fingerprint, get_safety_config
 from selfdrive.car.interfaces import CarInterfaceBase
+from opendbc.can.parser import CANParserGroup
 from common.params import Params
 from selfdrive.controls.lib.desire_helper import LANE_CHANGE_SPEED_MIN
 from decimal import Decimal
@@ -24,6 +26,11 @@ class CarInterface(CarInterfaceBase):
   def __init__(self, CP, CarController, CarState):
     super().__init__(CP, CarController, CarState)
     self.cp2 = self.CS.get_can2_parser(CP)
+    # buses 0, 1 and 2 are parsed from the same can strings in one pass
+    self.cp_group = CANParserGroup([self.cp, self.cp2, self.cp_cam])
+    # received Hyundai checksums and counters aren't checked until verified on routes of the car with parser_bench
+    for cp in (self.cp, self.cp2, self.cp_cam):
+      cp.set_checksum_type("LKAS11", lkas11_checksum_type(CP.carFingerprint))
     self.mad_mode_enabled = Params().get_bool('MadModeEnabled')
 
   @staticmethod
@@ -406,9 +413,7 @@ class CarInterface(CarInterfaceBase):
     pass
 
   def update(self, c: car.CarControl, can_strings: List[bytes]) -> car.CarState:
-    self.cp.update_strings(can_strings)
-    self.cp2.update_strings(can_strings)
-    self.cp_cam.update_strings(can_strings)
+    self.cp_group.update_strings(can_strings)
 
     ret = self.CS.update(self.cp, self.cp2, self.cp_cam)
     ret.canValid = self.cp.can_valid and self.cp2.can_valid and self.cp_cam.can_valid
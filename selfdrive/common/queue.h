@@ -8,10 +8,13 @@ template <class T>
 class SafeQueue {
 public:
   SafeQueue() = default;
+  // push blocks while capacity elements are queued
+  explicit SafeQueue(size_t capacity) : max_size(capacity) {}
 
   void push(const T& v) {
     {
       std::unique_lock lk(m);
+      cv_pop.wait(lk, [this] { return max_size == 0 || q.size() < max_size; });
       q.push(v);
     }
     cv.notify_one();
@@ -22,6 +25,8 @@ public:
     cv.wait(lk, [this] { return !q.empty(); });
     T v = q.front();
     q.pop();
+    lk.unlock();
+    cv_pop.notify_one();
     return v;
   }
 
@@ -32,6 +37,8 @@ public:
     }
     v = q.front();
     q.pop();
+    lk.unlock();
+    cv_pop.notify_one();
     return true;
   }
 
@@ -47,6 +54,7 @@ public:
 
 private:
   mutable std::mutex m;
-  std::condition_variable cv;
+  std::condition_variable cv, cv_pop;
   std::queue<T> q;
+  size_t max_size = 0;
 };
@@ -490,11 +490,12 @@ void Localizer::determine_gps_mode(double current_time) {
 }
 
 int Localizer::locationd_thread() {
-  const std::initializer_list<const char *> service_list = {"gpsLocationExternal", "sensorEvents", "cameraOdometry", "liveCalibration", "carState", "carParams"};
+  const std::initializer_list<ServiceId> service_list = {ServiceId::gpsLocationExternal, ServiceId::sensorEvents, ServiceId::cameraOdometry,
+                                                         ServiceId::liveCalibration, ServiceId::carState, ServiceId::carParams};
   PubMaster pm({"liveLocationKalman"});
 
   // TODO: remove carParams once we're always sending at 100Hz
-  SubMaster sm(service_list, nullptr, {"gpsLocationExternal", "carParams"});
+  SubMaster sm(service_list, nullptr, {ServiceId::gpsLocationExternal, ServiceId::carParams});
 
   uint64_t cnt = 0;
   bool filterInitialized = false;
@@ -502,7 +503,7 @@ int Localizer::locationd_thread() {
   while (!do_exit) {
     sm.update();
     if (filterInitialized){
-      for (const char* service : service_list) {
+      for (ServiceId service : service_list) {
         if (sm.updated(service) && sm.valid(service)){
           const cereal::Event::Reader log = sm[service];
           this->handle_msg(log);
@@ -513,10 +514,10 @@ int Localizer::locationd_thread() {
     }
 
     // 100Hz publish for notcars, 20Hz for cars
-    const char* trigger_msg = sm["carParams"].getCarParams().getNotCar() ? "sensorEvents" : "cameraOdometry";
+    ServiceId trigger_msg = sm[ServiceId::carParams].getCarParams().getNotCar() ? ServiceId::sensorEvents : ServiceId::cameraOdometry;
     if (sm.updated(trigger_msg)) {
       bool inputsOK = sm.allAliveAndValid();
-      bool sensorsOK = sm.alive("sensorEvents") && sm.valid("sensorEvents");
+      bool sensorsOK = sm.alive(ServiceId::sensorEvents) && sm.valid(ServiceId::sensorEvents);
       bool gpsOK = this->isGpsOK();
 
       MessageBuilder msg_builder;
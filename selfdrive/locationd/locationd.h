@@ -6,6 +6,7 @@
 #include <string>
 
 #include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
 #include "common/transformations/coordinates.hpp"
 #include "common/transformations/orientation.hpp"
 #include "selfdrive/common/params.h"
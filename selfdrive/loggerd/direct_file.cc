@@ -0,0 +1,143 @@
+#include "selfdrive/loggerd/direct_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+
+DirectFile::DirectFile(const char* path) {
+  static const bool direct_io = getenv("LOGGERD_DIRECT_IO") != nullptr;
+#ifdef O_DIRECT
+  if (direct_io) {
+    // Fails on filesystems without O_DIRECT support, e.g. tmpfs
+    fd = HANDLE_EINTR(open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0664));
+    direct = fd >= 0;
+  }
+#endif
+  if (fd < 0) {
+    fd = HANDLE_EINTR(open(path, O_WRONLY | O_CREAT | O_TRUNC, 0664));
+  }
+  assert(fd >= 0);
+
+#ifdef __linux__
+  // Allocated on open, so writing the segment doesn't have to find free blocks
+  static const int preallocate_mb = util::getenv("LOGGERD_PREALLOCATE_MB", 0);
+  if (preallocate_mb > 0) {
+    preallocated = fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)preallocate_mb << 20) == 0;
+  }
+#endif
+
+  for (int i = 0; i < DIRECT_FILE_WINDOW; i++) {
+    uint8_t *data = (uint8_t *)aligned_alloc(DIRECT_FILE_ALIGN, DIRECT_FILE_CHUNK_SIZE);
+    assert(data != nullptr);
+    free_chunks.push({data, 0});
+  }
+  cur = free_chunks.pop();
+  thread = std::thread(&DirectFile::writer_thread, this);
+}
+
+DirectFile::~DirectFile() {
+  if (cur.size > 0) {
+    full_chunks.push(cur);
+  } else {
+    free_chunks.push(cur);
+  }
+  full_chunks.push({nullptr, 0});
+  thread.join();
+
+  for (int i = 0; i < DIRECT_FILE_WINDOW; i++) {
+    ::free(free_chunks.pop().data);
+  }
+
+  // Drop the padding of the last chunk, and the preallocated space that wasn't used
+  if ((direct || preallocated) && ftruncate(fd, total_size) != 0) {
+    LOGE("failed to truncate file, errno=%d", errno);
+  }
+  close(fd);
+}
+
+bool DirectFile::write(const void* data, size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  total_size += size;
+  while (size > 0) {
+    size_t n = std::min(size, (size_t)DIRECT_FILE_CHUNK_SIZE - cur.size);
+    memcpy(cur.data + cur.size, p, n);
+    cur.size += n;
+    p += n;
+    size -= n;
+
+    if (cur.size == DIRECT_FILE_CHUNK_SIZE) {
+      submit();
+    }
+  }
+  return !error;
+}
+
+void DirectFile::submit() {
+  full_chunks.push(cur);
+  // Blocks while all chunks are in flight
+  cur = free_chunks.pop();
+  cur.size = 0;
+}
+
+void DirectFile::writer_thread() {
+  util::set_thread_name("loggerd_file");
+
+  while (true) {
+    Chunk c = full_chunks.pop();
+    if (c.data == nullptr) break;
+
+    // Only the last chunk can be short, it's padded for O_DIRECT and truncated on close
+    size_t len = c.size;
+    if (direct) {
+      len = (c.size + DIRECT_FILE_ALIGN - 1) & ~(size_t)(DIRECT_FILE_ALIGN - 1);
+      memset(c.data + c.size, 0, len - c.size);
+    }
+
+    size_t written = 0;
+    while (written < len) {
+      ssize_t ret = HANDLE_EINTR(pwrite(fd, c.data + written, len - written, write_offset + written));
+      if (ret < 0) {
+        if (!error) LOGE("failed to write file, errno=%d", errno);
+        error = true;
+        break;
+      }
+      written += ret;
+      // A write without progress doesn't set errno. With O_DIRECT, the rest of a short write
+      // can't be written if it no longer starts on an aligned offset
+      if (ret == 0 || (direct && written < len && written % DIRECT_FILE_ALIGN != 0)) {
+        if (!error) LOGE("short write to file, %zu of %zu bytes written", written, len);
+        error = true;
+        break;
+      }
+    }
+    write_offset += c.size;
+
+    if (!direct && write_offset - synced_offset >= DIRECT_FILE_SYNC_BYTES) {
+      writeback();
+    }
+    free_chunks.push(c);
+  }
+}
+
+void DirectFile::writeback() {
+#ifdef __linux__
+  sync_file_range(fd, synced_offset, write_offset - synced_offset, SYNC_FILE_RANGE_WRITE);
+
+  // The previous range has had a while to reach the disk, wait for it and drop it from the page cache
+  if (synced_offset > dropped_offset) {
+    sync_file_range(fd, dropped_offset, synced_offset - dropped_offset,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, dropped_offset, synced_offset - dropped_offset, POSIX_FADV_DONTNEED);
+    dropped_offset = synced_offset;
+  }
+#endif
+  synced_offset = write_offset;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#include "selfdrive/common/queue.h"
+
+// Segment files are written in chunks from a writer thread. Each file has DIRECT_FILE_WINDOW
+// chunks, write() blocks when all of them are waiting to be written.
+// So every open file costs a thread and 2 MB of chunks
+#define DIRECT_FILE_CHUNK_SIZE (1 << 19)
+#define DIRECT_FILE_WINDOW 4
+#define DIRECT_FILE_ALIGN 4096
+// Without O_DIRECT, writeback is kicked off every this many bytes, so it doesn't pile up
+// in the page cache and get flushed in one multi-second burst
+#define DIRECT_FILE_SYNC_BYTES (8 << 20)
+
+// Writes a file with O_DIRECT when LOGGERD_DIRECT_IO is set and the filesystem supports it.
+// Otherwise the writes are buffered, but writeback is started regularly with sync_file_range
+// and written pages are dropped from the page cache.
+// With LOGGERD_PREALLOCATE_MB set, that much space is reserved for the file when it's opened.
+class DirectFile {
+ public:
+  DirectFile(const char* path);
+  // Writes out the last chunk, and truncates the file to what was written if it was padded or preallocated
+  ~DirectFile();
+  bool write(const void* data, size_t size);
+  inline bool is_direct() const { return direct; }
+
+ private:
+  struct Chunk {
+    uint8_t* data;
+    size_t size;
+  };
+
+  void submit();
+  void writer_thread();
+  void writeback();
+
+  int fd = -1;
+  bool direct = false;
+  bool preallocated = false;
+  Chunk cur = {};
+  uint64_t total_size = 0;
+  std::atomic<bool> error = false;
+
+  SafeQueue<Chunk> free_chunks, full_chunks;
+  std::thread thread;
+
+  // Only used by the writer thread
+  uint64_t write_offset = 0, synced_offset = 0, dropped_offset = 0;
+};
@@ -3,11 +3,19 @@
 #include <cstdint>
 #include "selfdrive/loggerd/loggerd.h"
 
+// Returned by encode_frame for a frame that was skipped because the encoder is behind
+#define ENCODER_FRAME_DROPPED (-2)
+
 class VideoEncoder {
 public:
   virtual ~VideoEncoder() {}
+  // Returns the index of the frame in the segment, -1 on error
   virtual int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
                            int in_width, int in_height, uint64_t ts) = 0;
   virtual void encoder_open(const char* path) = 0;
   virtual void encoder_close() = 0;
 };
+
+// OmxEncoder on device, LOGGERD_ENCODER selects the backend on PC
+VideoEncoder *encoder_create(const char *filename, CameraType type, int width, int height, int fps,
+                             int bitrate, bool h265, bool downscale, bool write = true);
@@ -0,0 +1,244 @@
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+
+#include "selfdrive/loggerd/ffmpeg_encoder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#define __STDC_CONSTANT_MACROS
+
+#include "libyuv.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+FfmpegEncoder::FfmpegEncoder(const char* filename, CameraType type, int width, int height, int fps,
+                             int bitrate, bool h265, bool downscale, bool write)
+  : filename(filename), width(width), height(height), fps(fps), bitrate(bitrate), write(write) {
+  codec = avcodec_find_encoder(h265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264);
+  assert(codec);
+
+  pool = av_buffer_pool_init(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1), NULL);
+  assert(pool);
+  pkt = av_packet_alloc();
+  assert(pkt);
+
+  thread = std::thread(FfmpegEncoder::encoder_thread, this);
+}
+
+FfmpegEncoder::~FfmpegEncoder() {
+  encoder_close();
+  jobs.push({.type = Job::EXIT});
+  thread.join();
+
+  av_packet_free(&pkt);
+  av_buffer_pool_uninit(&pool);
+}
+
+void FfmpegEncoder::encoder_open(const char* path) {
+  if (write) {
+    jobs.push({.type = Job::OPEN, .path = path});
+  }
+  is_open = true;
+  counter = 0;
+}
+
+void FfmpegEncoder::encoder_close() {
+  if (!is_open) return;
+
+  // Frames already queued still end up in the segment they were sent for
+  if (write) {
+    jobs.push({.type = Job::CLOSE});
+  }
+  is_open = false;
+}
+
+int FfmpegEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
+                                int in_width, int in_height, uint64_t ts) {
+  if (!write) return counter++;
+
+  if (queued >= FFMPEG_ENCODER_QUEUE_SIZE) {
+    dropped++;
+    return ENCODER_FRAME_DROPPED;
+  }
+
+  AVFrame *frame = av_frame_alloc();
+  assert(frame);
+  frame->buf[0] = av_buffer_pool_get(pool);
+  assert(frame->buf[0]);
+  av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, AV_PIX_FMT_YUV420P, width, height, 1);
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = width;
+  frame->height = height;
+  frame->pts = counter;
+
+  // Just copies when the size doesn't change
+  libyuv::I420Scale(y_ptr, in_width,
+                    u_ptr, in_width/2,
+                    v_ptr, in_width/2,
+                    in_width, in_height,
+                    frame->data[0], frame->linesize[0],
+                    frame->data[1], frame->linesize[1],
+                    frame->data[2], frame->linesize[2],
+                    width, height,
+                    libyuv::kFilterNone);
+
+  ++queued;
+  jobs.push({.type = Job::FRAME, .frame = frame, .queued_tms = millis_since_boot()});
+  return counter++;
+}
+
+void FfmpegEncoder::encoder_thread(FfmpegEncoder *e) {
+  util::set_thread_name(util::string_format("enc_%s", e->filename).substr(0, 15).c_str());
+
+  while (true) {
+    Job job = e->jobs.pop();
+    if (job.type == Job::EXIT) {
+      break;
+    } else if (job.type == Job::OPEN) {
+      e->open_segment(job.path);
+    } else if (job.type == Job::CLOSE) {
+      e->close_segment();
+    } else if (job.type == Job::FRAME) {
+      if (e->format_ctx) {
+        e->in_flight.push_back({job.frame->pts, job.queued_tms});
+        e->encode(job.frame);
+      }
+      av_frame_free(&job.frame);
+      --e->queued;
+    }
+  }
+  e->close_segment();
+}
+
+void FfmpegEncoder::open_segment(const std::string &path) {
+  vid_path = util::string_format("%s/%s", path.c_str(), filename);
+
+  // create camera lock file
+  lock_path = util::string_format("%s/%s.lock", path.c_str(), filename);
+
+  LOG("open %s\n", lock_path.c_str());
+
+  int lock_fd = HANDLE_EINTR(open(lock_path.c_str(), O_RDWR | O_CREAT, 0664));
+  assert(lock_fd >= 0);
+  close(lock_fd);
+
+  // The codec is opened per segment, so every segment starts with a key frame and the headers
+  codec_ctx = avcodec_alloc_context3(codec);
+  assert(codec_ctx);
+  codec_ctx->width = width;
+  codec_ctx->height = height;
+  codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  codec_ctx->time_base = (AVRational){ 1, fps };
+  codec_ctx->framerate = (AVRational){ fps, 1 };
+  codec_ctx->bit_rate = bitrate;
+  codec_ctx->gop_size = fps;
+  // no reordering, packets come out in the order the frames went in
+  codec_ctx->max_b_frames = 0;
+  codec_ctx->thread_count = 0;
+  codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+  // muxer is picked by the file extension, raw hevc for the main cameras and mpegts for qcamera
+  format_ctx = NULL;
+  avformat_alloc_output_context2(&format_ctx, NULL, NULL, vid_path.c_str());
+  assert(format_ctx);
+  if (format_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+    codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+
+  // only used by libx264/libx265, other encoders leave it in the dict
+  AVDictionary *opts = NULL;
+  av_dict_set(&opts, "preset", "veryfast", 0);
+  int err = avcodec_open2(codec_ctx, codec, &opts);
+  av_dict_free(&opts);
+  assert(err >= 0);
+
+  stream = avformat_new_stream(format_ctx, NULL);
+  assert(stream);
+  stream->id = 0;
+  stream->time_base = codec_ctx->time_base;
+
+  err = avcodec_parameters_from_context(stream->codecpar, codec_ctx);
+  assert(err >= 0);
+
+  err = avio_open(&format_ctx->pb, vid_path.c_str(), AVIO_FLAG_WRITE);
+  assert(err >= 0);
+
+  err = avformat_write_header(format_ctx, NULL);
+  assert(err >= 0);
+}
+
+void FfmpegEncoder::close_segment() {
+  if (!format_ctx) return;
+
+  // drain the frames still in the codec
+  encode(NULL);
+
+  int err = av_write_trailer(format_ctx);
+  assert(err == 0);
+
+  err = avio_closep(&format_ctx->pb);
+  assert(err == 0);
+
+  avformat_free_context(format_ctx);
+  format_ctx = NULL;
+  avcodec_free_context(&codec_ctx);
+  in_flight.clear();
+
+  unlink(lock_path.c_str());
+
+  LOG("%s: encoded %d frames, dropped %d, encode latency avg %.1f ms max %.1f ms",
+      vid_path.c_str(), encoded, dropped.exchange(0), encoded > 0 ? latency_sum_ms / encoded : 0., latency_max_ms);
+  encoded = 0;
+  latency_sum_ms = latency_max_ms = 0;
+}
+
+bool FfmpegEncoder::encode(AVFrame *frame) {
+  int err = avcodec_send_frame(codec_ctx, frame);
+  if (err < 0) {
+    LOGE("avcodec_send_frame error %d", err);
+    return false;
+  }
+
+  bool ret = true;
+  while (true) {
+    err = avcodec_receive_packet(codec_ctx, pkt);
+    if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+      // Encoder might need a few frames on startup to get started. Keep going
+      break;
+    } else if (err < 0) {
+      LOGE("avcodec_receive_packet error %d", err);
+      ret = false;
+      break;
+    }
+
+    // time from encode_frame until the frame is out of the codec
+    double tms = millis_since_boot();
+    while (!in_flight.empty() && in_flight.front().first <= pkt->pts) {
+      double latency = tms - in_flight.front().second;
+      latency_sum_ms += latency;
+      latency_max_ms = std::max(latency_max_ms, latency);
+      encoded++;
+      in_flight.pop_front();
+    }
+
+    av_packet_rescale_ts(pkt, codec_ctx->time_base, stream->time_base);
+    pkt->stream_index = stream->index;
+
+    err = av_interleaved_write_frame(format_ctx, pkt);
+    if (err < 0) {
+      LOGE("av_interleaved_write_frame %d", err);
+      ret = false;
+    }
+  }
+  return ret;
+}
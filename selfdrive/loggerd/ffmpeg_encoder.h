@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "selfdrive/common/queue.h"
+#include "selfdrive/loggerd/encoder.h"
+
+// Frames waiting to be encoded, per encoder. Frames coming in while the queue is full are dropped,
+// encode_frame returns ENCODER_FRAME_DROPPED for them and the count is logged when the segment closes
+#define FFMPEG_ENCODER_QUEUE_SIZE 8
+
+// FfmpegEncoder, lossy hevc/h264 software encoder for PC.
+// encode_frame only copies the frame into a queue, encoding and muxing run on a separate
+// thread with libavcodec's frame and slice threading, so the camera thread doesn't fall behind
+class FfmpegEncoder : public VideoEncoder {
+public:
+  FfmpegEncoder(const char* filename, CameraType type, int width, int height, int fps,
+                int bitrate, bool h265, bool downscale, bool write = true);
+  ~FfmpegEncoder();
+  int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
+                   int in_width, int in_height, uint64_t ts);
+  void encoder_open(const char* path);
+  void encoder_close();
+
+private:
+  struct Job {
+    enum Type { FRAME, OPEN, CLOSE, EXIT } type;
+    AVFrame *frame = nullptr;
+    double queued_tms = 0;
+    std::string path;  // segment directory for OPEN
+  };
+
+  static void encoder_thread(FfmpegEncoder *e);
+  void open_segment(const std::string &path);
+  void close_segment();
+  bool encode(AVFrame *frame);
+
+  const char* filename;
+  int width, height, fps, bitrate;
+  bool write;
+  bool is_open = false;
+  int counter = 0;
+
+  // Frame data is reference counted, the codec can hold on to a frame after it's sent
+  AVBufferPool *pool = nullptr;
+  std::atomic<int> queued = 0;
+  SafeQueue<Job> jobs;
+  std::thread thread;
+
+  // Only used by the encoder thread
+  const AVCodec *codec = nullptr;
+  AVCodecContext *codec_ctx = nullptr;
+  AVFormatContext *format_ctx = nullptr;
+  AVStream *stream = nullptr;
+  AVPacket *pkt = nullptr;
+  std::string vid_path, lock_path;
+  std::deque<std::pair<int64_t, double>> in_flight;  // pts and queue time of the frames in the codec
+
+  // Per segment metrics, logged on close
+  std::atomic<int> dropped = 0;
+  int encoded = 0;
+  double latency_sum_ms = 0, latency_max_ms = 0;
+};
@@ -0,0 +1,163 @@
+#include "selfdrive/loggerd/log_codec.h"
+
+#include "cereal/gen/cpp/log.capnp.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+LogCodecConfig log_codec_from_string(const std::string &spec, LogCodecConfig def) {
+  std::vector<std::string> parts;
+  std::stringstream ss(spec);
+  for (std::string part; std::getline(ss, part, ':');) {
+    parts.push_back(part);
+  }
+  if (parts.empty()) return def;
+
+  LogCodecConfig config;
+  if (parts[0] == "bz2") {
+    config = {.codec = LogCodec::BZ2, .level = 9};
+  } else if (parts[0] == "zstd") {
+    config = {.codec = LogCodec::ZSTD, .level = 3};
+  } else if (parts[0] == "lz4") {
+    config = {.codec = LogCodec::LZ4, .level = 0};
+  } else {
+    LOGE("unknown log codec %s", spec.c_str());
+    return def;
+  }
+
+  if (parts.size() > 1) config.level = atoi(parts[1].c_str());
+  if (parts.size() > 2) config.threads = atoi(parts[2].c_str());
+  return config;
+}
+
+const char *log_codec_extension(LogCodec codec) {
+  switch (codec) {
+    case LogCodec::ZSTD: return "zst";
+    case LogCodec::LZ4: return "lz4";
+    default: return "bz2";
+  }
+}
+
+BZFile::BZFile(const char* path, int level) : file(path) {
+  int ret = BZ2_bzCompressInit(&strm, level, 0, 30);
+  assert(ret == BZ_OK);
+}
+
+BZFile::~BZFile() {
+  int ret;
+  do {
+    ret = compress(BZ_FINISH);
+  } while (ret == BZ_FINISH_OK);
+  if (ret != BZ_STREAM_END) {
+    LOGE("BZ2_bzCompress finish error, bzerror=%d", ret);
+  }
+  BZ2_bzCompressEnd(&strm);
+}
+
+void BZFile::write(void* data, size_t size) {
+  strm.next_in = (char *)data;
+  strm.avail_in = size;
+  while (strm.avail_in > 0) {
+    int ret = compress(BZ_RUN);
+    if (ret != BZ_RUN_OK) {
+      if (!error_logged) LOGE("BZ2_bzCompress error, bzerror=%d", ret);
+      error_logged = true;
+      break;
+    }
+  }
+}
+
+int BZFile::compress(int action) {
+  strm.next_out = out;
+  strm.avail_out = sizeof(out);
+  int ret = BZ2_bzCompress(&strm, action);
+
+  size_t size = sizeof(out) - strm.avail_out;
+  if (size > 0 && !file.write(out, size) && !error_logged) {
+    LOGE("failed to write bz2 log");
+    error_logged = true;
+  }
+  return ret;
+}
+
+BlockFile::BlockFile(const char* path, std::unique_ptr<BlockCompressor> block_compressor, const char* index_path)
+    : file(path), compressor(std::move(block_compressor)) {
+  block.reserve(LOG_BLOCK_SIZE * 2);
+
+  if (index_path) {
+    index_file = util::safe_fopen(index_path, "wb");
+    assert(index_file != nullptr);
+    LogIndexHeader header = {.magic = LOG_INDEX_MAGIC, .version = LOG_INDEX_VERSION};
+    util::safe_fwrite(&header, sizeof(header), 1, index_file);
+  }
+  index_block = {.start_mono_time = UINT64_MAX};
+}
+
+BlockFile::~BlockFile() {
+  flush_block();
+
+  if (index_file) {
+    util::safe_fflush(index_file);
+    int err = fclose(index_file);
+    assert(err == 0);
+  }
+}
+
+void BlockFile::write(void* data, size_t size) {
+  if (index_file) {
+    index_message(data, size);
+  }
+  block.append((const char *)data, size);
+  if (block.size() >= LOG_BLOCK_SIZE) {
+    flush_block();
+  }
+}
+
+void BlockFile::index_message(const void* data, size_t size) {
+  try {
+    capnp::FlatArrayMessageReader reader(kj::ArrayPtr<const capnp::word>((const capnp::word *)data, size / sizeof(capnp::word)));
+    auto event = reader.getRoot<cereal::Event>();
+    uint64_t mono_time = event.getLogMonoTime();
+    index_block.start_mono_time = std::min(index_block.start_mono_time, mono_time);
+    index_block.end_mono_time = std::max(index_block.end_mono_time, mono_time);
+    index_block.add((int)event.which());
+  } catch (const kj::Exception &) {
+    // Still written, the block just isn't found by time or type
+  }
+}
+
+void BlockFile::flush_block() {
+  if (block.empty()) return;
+
+  bool ok = compressor->compress(block, compressed) && file.write(compressed.data(), compressed.size());
+  if (!ok && !error_logged) {
+    LOGE("failed to write log block");
+    error_logged = true;
+  }
+
+  if (index_file && ok) {
+    index_block.offset = offset;
+    index_block.size = compressed.size();
+    index_block.raw_size = block.size();
+    // Flushed per block, so the index of a segment cut short by a crash still matches the log
+    util::safe_fwrite(&index_block, sizeof(index_block), 1, index_file);
+    util::safe_fflush(index_file);
+  }
+  if (ok) {
+    offset += compressed.size();
+  }
+  index_block = {.start_mono_time = UINT64_MAX};
+  block.clear();
+}
+
+std::unique_ptr<LogFile> log_file_open(const char* path, const LogCodecConfig &config, const char* index_path) {
+  switch (config.codec) {
+    case LogCodec::ZSTD:
+    case LogCodec::LZ4:
+      return std::make_unique<BlockFile>(path, block_compressor_create(config.codec, config.level, config.threads), index_path);
+    default:
+      return std::make_unique<BZFile>(path, config.level);
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include <bzlib.h>
+#include <capnp/serialize.h>
+#include <kj/array.h>
+
+#include "selfdrive/common/util.h"
+#include "selfdrive/common/swaglog.h"
+#include "cereal/messaging/block_codec.h"
+#include "selfdrive/loggerd/direct_file.h"
+#include "selfdrive/loggerd/log_index.h"
+
+struct LogCodecConfig {
+  LogCodec codec = LogCodec::BZ2;
+  int level = 9;
+  int threads = 0;  // zstd worker threads, 0 compresses on the calling thread
+};
+
+// Parses "bz2", "lz4" or "zstd[:level[:threads]]", returns def for an empty or unknown spec
+LogCodecConfig log_codec_from_string(const std::string &spec, LogCodecConfig def = {});
+const char *log_codec_extension(LogCodec codec);
+
+class LogFile {
+ public:
+  virtual ~LogFile() {}
+  virtual void write(void* data, size_t size) = 0;
+  inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
+};
+
+class BZFile : public LogFile {
+ public:
+  BZFile(const char* path, int level = 9);
+  ~BZFile();
+  void write(void* data, size_t size) override;
+  using LogFile::write;
+
+ private:
+  int compress(int action);
+
+  bool error_logged = false;
+  DirectFile file;
+  bz_stream strm = {};
+  char out[1 << 16];
+};
+
+// Collects messages into blocks of about LOG_BLOCK_SIZE and writes each as its own
+// compressed frame. The frames are concatenated, so the file is a valid zstd/lz4 stream.
+// With an index path, the blocks are also listed in a side-car index, see log_index.h
+class BlockFile : public LogFile {
+ public:
+  BlockFile(const char* path, std::unique_ptr<BlockCompressor> compressor, const char* index_path = nullptr);
+  ~BlockFile();
+  void write(void* data, size_t size) override;
+  using LogFile::write;
+
+ private:
+  void index_message(const void* data, size_t size);
+  void flush_block();
+
+  bool error_logged = false;
+  DirectFile file;
+  uint64_t offset = 0;
+  std::unique_ptr<BlockCompressor> compressor;
+  std::string block, compressed;
+
+  FILE* index_file = nullptr;
+  LogIndexBlock index_block;
+};
+
+// index_path is only used by the block codecs, bz2 logs can't be indexed
+std::unique_ptr<LogFile> log_file_open(const char* path, const LogCodecConfig &config, const char* index_path = nullptr);
@@ -0,0 +1,82 @@
+// Compression speed and ratio of the log codecs over recorded logs
+// usage: log_codec_bench rlog.bz2 [rlog.bz2 ...]
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/loggerd/log_codec.h"
+
+static std::string decompress_bz2(const std::string &in) {
+  bz_stream strm = {};
+  int ret = BZ2_bzDecompressInit(&strm, 0, 0);
+  assert(ret == BZ_OK);
+
+  std::string out(in.size() * 5, '\0');
+  strm.next_in = (char *)in.data();
+  strm.avail_in = in.size();
+  do {
+    if (strm.total_out_lo32 == out.size()) out.resize(out.size() * 2);
+    strm.next_out = &out[strm.total_out_lo32];
+    strm.avail_out = out.size() - strm.total_out_lo32;
+    ret = BZ2_bzDecompress(&strm);
+  } while (ret == BZ_OK && strm.avail_in > 0);
+
+  out.resize(ret == BZ_STREAM_END ? strm.total_out_lo32 : 0);
+  BZ2_bzDecompressEnd(&strm);
+  return out;
+}
+
+// Splits the log into messages, so the codecs see the same writes as in loggerd
+static std::vector<kj::ArrayPtr<capnp::byte>> split_messages(std::string &log) {
+  std::vector<kj::ArrayPtr<capnp::byte>> msgs;
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)log.data(), log.size() / sizeof(capnp::word));
+  try {
+    while (words.size() > 0) {
+      capnp::FlatArrayMessageReader reader(words);
+      kj::ArrayPtr<const capnp::word> msg(words.begin(), reader.getEnd());
+      msgs.push_back(kj::ArrayPtr<capnp::byte>((capnp::byte *)msg.begin(), msg.size() * sizeof(capnp::word)));
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+    }
+  } catch (const kj::Exception &e) {
+    printf("stopped at a corrupt message: %s\n", e.getDescription().cStr());
+  }
+  return msgs;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s rlog.bz2 [rlog.bz2 ...]\n", argv[0]);
+    return 1;
+  }
+
+  std::string log;
+  for (int i = 1; i < argc; i++) {
+    std::string data = util::read_file(argv[i]);
+    log += data.compare(0, 3, "BZh") == 0 ? decompress_bz2(data) : data;
+  }
+  auto msgs = split_messages(log);
+  printf("%zu messages, %.1f MB\n\n", msgs.size(), log.size() / 1e6);
+
+  const char *specs[] = {"bz2:9", "zstd:1", "zstd:3", "zstd:3:2", "zstd:3:4", "zstd:9", "zstd:19:4", "lz4:0", "lz4:9"};
+  const std::string out_path = "/tmp/log_codec_bench";
+  printf("%-12s %10s %10s\n", "codec", "MB/s", "ratio");
+  for (const char *spec : specs) {
+    double start = millis_since_boot();
+    {
+      auto file = log_file_open(out_path.c_str(), log_codec_from_string(spec));
+      for (auto &msg : msgs) file->write(msg);
+    }
+    double seconds = (millis_since_boot() - start) / 1000.0;
+
+    struct stat st = {};
+    stat(out_path.c_str(), &st);
+    printf("%-12s %10.1f %10.2f\n", spec, log.size() / 1e6 / seconds, (double)log.size() / st.st_size);
+  }
+  unlink(out_path.c_str());
+  return 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+// Side-car index of the zstd/lz4 logs, written next to the log as <log>.idx.
+// A header followed by one entry per compressed block, appended as the blocks are written.
+#define LOG_INDEX_MAGIC 0x5844494c  // "LIDX"
+#define LOG_INDEX_VERSION 1
+#define LOG_INDEX_WHICH_WORDS 4     // room for 256 Event::Which values
+
+struct LogIndexHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+
+struct LogIndexBlock {
+  uint64_t offset;           // of the compressed frame in the log
+  uint32_t size;             // compressed size
+  uint32_t raw_size;
+  uint64_t start_mono_time;  // smallest logMonoTime in the block
+  uint64_t end_mono_time;    // largest logMonoTime in the block
+  uint64_t which[LOG_INDEX_WHICH_WORDS];  // bitset of the Event::Which values in the block
+
+  inline void add(int w) {
+    if (w >= 0 && w < LOG_INDEX_WHICH_WORDS * 64) which[w / 64] |= 1ULL << (w % 64);
+  }
+  inline bool has(int w) const {
+    return w >= 0 && w < LOG_INDEX_WHICH_WORDS * 64 && (which[w / 64] & (1ULL << (w % 64)));
+  }
+};
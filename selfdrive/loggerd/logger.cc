@@ -20,6 +20,7 @@
 
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/version.h"
 
 // ***** logging helpers *****
@@ -116,79 +117,270 @@ void log_init_data(LoggerState *s) {
 }
 
 
-static void lh_log_sentinel(LoggerHandle *h, SentinelType type) {
-  MessageBuilder msg;
+static kj::ArrayPtr<capnp::byte> build_sentinel(MessageBuilder &msg, SentinelType type, int signal) {
   auto sen = msg.initEvent().initSentinel();
   sen.setType(type);
-  sen.setSignal(h->exit_signal);
-  auto bytes = msg.toBytes();
+  sen.setSignal(signal);
+  return msg.toBytes();
+}
 
+static void lh_log_sentinel(LoggerHandle *h, SentinelType type) {
+  MessageBuilder msg;
+  auto bytes = build_sentinel(msg, type, h->exit_signal);
   lh_log(h, bytes.begin(), bytes.size(), true);
 }
 
+// ***** writer thread *****
+
+LogWriter::LogWriter(size_t size) : buf(size) {
+  assert((size & (size - 1)) == 0);
+  thread = std::thread(&LogWriter::writer_thread, this);
+}
+
+LogWriter::~LogWriter() {
+  exit = true;
+  cv.notify_one();
+  thread.join();
+}
+
+static inline size_t record_size(size_t data_size) {
+  constexpr size_t align = 16;
+  return (data_size + align - 1) & ~(align - 1);
+}
+
+LogWriter::Record *LogWriter::reserve(size_t size) {
+  const size_t capacity = buf.size();
+  const size_t rec_size = record_size(sizeof(Record) + size);
+  assert(rec_size <= capacity / 2);
+
+  // Records don't wrap around, the rest of the buffer is skipped if it's too short
+  uint64_t h = head.load(std::memory_order_relaxed);
+  size_t offset = h & (capacity - 1);
+  size_t pad = capacity - offset < rec_size ? capacity - offset : 0;
+
+  uint64_t t = tail.load(std::memory_order_acquire);
+  if (capacity - (h - t) < pad + rec_size) {
+    uint64_t start = nanos_since_boot();
+    do {
+      util::sleep_for(1);
+      t = tail.load(std::memory_order_acquire);
+    } while (capacity - (h - t) < pad + rec_size);
+    blocked_ns += nanos_since_boot() - start;
+  }
+
+  if (pad > 0) {
+    ((Record *)&buf[offset])->type = PAD;
+    offset = 0;
+  }
+  next_head = h + pad + rec_size;
+  update_max_atomic(max_depth, next_head - t);
+
+  Record *r = (Record *)&buf[offset];
+  r->size = size;
+  return r;
+}
+
+void LogWriter::commit() {
+  head.store(next_head, std::memory_order_release);
+  cv.notify_one();
+}
+
+void LogWriter::push(LoggerHandle *h, const uint8_t *data, size_t size, bool in_qlog) {
+  Record *r = reserve(size);
+  r->h = h;
+  r->type = in_qlog ? DATA_QLOG : DATA;
+  memcpy(r + 1, data, size);
+  commit();
+}
+
+void LogWriter::push_close(LoggerHandle *h) {
+  Record *r = reserve(0);
+  r->h = h;
+  r->type = CLOSE;
+  commit();
+}
+
+LogWriterStats LogWriter::stats() {
+  return {
+    .depth = (size_t)(head - tail),
+    .max_depth = (size_t)max_depth.exchange(0),
+    .max_write_ms = max_write_ns.exchange(0) / 1e6,
+    .blocked_ms = blocked_ns.exchange(0) / 1e6,
+  };
+}
+
+void LogWriter::writer_thread() {
+  util::set_thread_name("loggerd_writer");
+
+  const size_t capacity = buf.size();
+  uint64_t t = tail.load(std::memory_order_relaxed);
+  while (true) {
+    uint64_t h = head.load(std::memory_order_acquire);
+    if (h == t) {
+      // Everything pushed before exit was set is visible once exit is
+      if (exit && head.load(std::memory_order_acquire) == t) break;
+
+      // The producer notifies without taking the lock, so don't sleep for long
+      std::unique_lock lk(lock);
+      cv.wait_for(lk, std::chrono::milliseconds(10));
+      continue;
+    }
+
+    while (t != h) {
+      size_t offset = t & (capacity - 1);
+      Record *r = (Record *)&buf[offset];
+      if (r->type == PAD) {
+        t += capacity - offset;
+      } else {
+        if (r->type == CLOSE) {
+          lh_close(r->h);
+        } else {
+          uint64_t start = nanos_since_boot();
+          lh_log(r->h, (uint8_t *)(r + 1), r->size, r->type == DATA_QLOG);
+          update_max_atomic(max_write_ns, nanos_since_boot() - start);
+        }
+        t += record_size(sizeof(Record) + r->size);
+      }
+      // Hand the space back right away, a slow write shouldn't hold up the whole batch
+      tail.store(t, std::memory_order_release);
+    }
+  }
+}
+
 // ***** logging functions *****
 
-void logger_init(LoggerState *s, const char* log_name, bool has_qlog) {
+void logger_init(LoggerState *s, const char* log_name, bool has_qlog,
+                 LogCodecConfig log_codec, LogCodecConfig qlog_codec) {
   pthread_mutex_init(&s->lock, NULL);
 
   s->part = -1;
   s->has_qlog = has_qlog;
+  s->log_codec = log_codec;
+  s->qlog_codec = qlog_codec;
   s->route_name = logger_get_route_name();
   snprintf(s->log_name, sizeof(s->log_name), "%s", log_name);
   s->init_data = logger_build_init_data();
+  s->writer = std::make_unique<LogWriter>();
 }
 
-static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
+static std::string logger_prepare_root(const std::string &root_path) {
+  return root_path + ".next";
+}
+
+// Path of one of the segment's files in the directory it's prepared in
+static std::string prepared_file(LoggerHandle *h, const char *path) {
+  return h->prepared_path + std::string(path + strlen(h->segment_path));
+}
+
+// Removes the prepare root with the segments in it
+static void logger_remove_prepared(const std::string &root_path) {
+  const std::string prepare_root = logger_prepare_root(root_path);
+  if (access(prepare_root.c_str(), F_OK) != 0) return;
+
+  LOGW("removing unused segments in %s", prepare_root.c_str());
+  auto remove_entry = [](const char *path, const struct stat *, int, struct FTW *) { return remove(path); };
+  nftw(prepare_root.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Creates the segment directory and opens its files. Only takes s->lock to claim a handle,
+// so it can run on another thread ahead of the rotation. A prepared segment is opened
+// outside the log root, logger_next moves it into place
+static LoggerHandle* logger_open(LoggerState *s, const std::string &root_path, int part, bool prepare) {
   LoggerHandle *h = NULL;
+  pthread_mutex_lock(&s->lock);
   for (int i=0; i<LOGGER_MAX_HANDLES; i++) {
     if (s->handles[i].refcnt == 0) {
       h = &s->handles[i];
+      h->refcnt = 1;
       break;
     }
   }
+  pthread_mutex_unlock(&s->lock);
   assert(h);
 
   snprintf(h->segment_path, sizeof(h->segment_path),
-          "%s/%s--%d", root_path, s->route_name.c_str(), s->part);
+          "%s/%s--%d", root_path.c_str(), s->route_name.c_str(), part);
 
-  snprintf(h->log_path, sizeof(h->log_path), "%s/%s.bz2", h->segment_path, s->log_name);
-  snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog.bz2", h->segment_path);
+  snprintf(h->log_path, sizeof(h->log_path), "%s/%s.%s", h->segment_path, s->log_name, log_codec_extension(s->log_codec.codec));
+  snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog.%s", h->segment_path, log_codec_extension(s->qlog_codec.codec));
   snprintf(h->lock_path, sizeof(h->lock_path), "%s.lock", h->log_path);
+  h->prepared_path[0] = '\0';
+  if (prepare) {
+    snprintf(h->prepared_path, sizeof(h->prepared_path),
+             "%s/%s--%d", logger_prepare_root(root_path).c_str(), s->route_name.c_str(), part);
+  }
   h->end_sentinel_type = SentinelType::END_OF_SEGMENT;
   h->exit_signal = 0;
 
-  if (!util::create_directories(h->segment_path, 0775)) return nullptr;
+  auto open_path = [&](const char *path) { return prepare ? prepared_file(h, path) : std::string(path); };
 
-  FILE* lock_file = fopen(h->lock_path, "wb");
-  if (lock_file == NULL) return NULL;
+  FILE* lock_file = NULL;
+  if (util::create_directories(prepare ? h->prepared_path : h->segment_path, 0775)) {
+    lock_file = fopen(open_path(h->lock_path).c_str(), "wb");
+  }
+  if (lock_file == NULL) {
+    h->refcnt = 0;
+    return NULL;
+  }
   fclose(lock_file);
 
-  h->log = std::make_unique<BZFile>(h->log_path);
+  h->log = log_file_open(open_path(h->log_path).c_str(), s->log_codec, (open_path(h->log_path) + ".idx").c_str());
   if (s->has_qlog) {
-    h->q_log = std::make_unique<BZFile>(h->qlog_path);
+    h->q_log = log_file_open(open_path(h->qlog_path).c_str(), s->qlog_codec, (open_path(h->qlog_path) + ".idx").c_str());
   }
 
   pthread_mutex_init(&h->lock, NULL);
-  h->refcnt++;
   return h;
 }
 
+// Removes a prepared segment that was never logged to
+static void logger_discard(LoggerHandle *h) {
+  h->log.reset(nullptr);
+  h->q_log.reset(nullptr);
+  for (const char *path : {h->log_path, h->qlog_path}) {
+    unlink(prepared_file(h, path).c_str());
+    unlink((prepared_file(h, path) + ".idx").c_str());
+  }
+  unlink(prepared_file(h, h->lock_path).c_str());
+  rmdir(h->prepared_path);
+  // and the prepare root, when it's empty
+  const std::string prepared_path = h->prepared_path;
+  rmdir(prepared_path.substr(0, prepared_path.rfind('/')).c_str());
+  pthread_mutex_destroy(&h->lock);
+  h->refcnt = 0;
+}
+
 int logger_next(LoggerState *s, const char* root_path,
                             char* out_segment_path, size_t out_segment_path_len,
                             int* out_part) {
   bool is_start_of_route = !s->cur_handle;
 
-  pthread_mutex_lock(&s->lock);
-  s->part++;
+  if (is_start_of_route) {
+    logger_remove_prepared(root_path);
+  }
 
-  LoggerHandle* next_h = logger_open(s, root_path);
+  // Normally opened long ago, so the rotation itself is just moving the directory and switching the handle.
+  // The files stay open, and the directory shows up in the log root with its lock file
+  LoggerHandle* next_h = s->next_handle.valid() ? s->next_handle.get() : NULL;
+  if (next_h) {
+    if (rename(next_h->prepared_path, next_h->segment_path) == 0) {
+      next_h->prepared_path[0] = '\0';
+    } else {
+      LOGE("failed to move %s to %s: %s", next_h->prepared_path, next_h->segment_path, strerror(errno));
+      logger_discard(next_h);
+      next_h = NULL;
+    }
+  }
   if (!next_h) {
-    pthread_mutex_unlock(&s->lock);
-    return -1;
+    next_h = logger_open(s, root_path, s->part + 1, false);
+    if (!next_h) return -1;
   }
 
+  pthread_mutex_lock(&s->lock);
+  s->part++;
+
   if (s->cur_handle) {
-    lh_close(s->cur_handle);
+    s->writer->push_close(s->cur_handle);
   }
   s->cur_handle = next_h;
 
@@ -201,9 +393,13 @@ int logger_next(LoggerState *s, const char* root_path,
 
   pthread_mutex_unlock(&s->lock);
 
-  // write beggining of log metadata
+  // write beggining of log metadata, queued behind the end of the previous segment
   log_init_data(s);
-  lh_log_sentinel(s->cur_handle, is_start_of_route ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT);
+  MessageBuilder msg;
+  auto bytes = build_sentinel(msg, is_start_of_route ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT, 0);
+  logger_log(s, bytes.begin(), bytes.size(), true);
+
+  s->next_handle = std::async(std::launch::async, logger_open, s, std::string(root_path), s->part + 1, true);
   return 0;
 }
 
@@ -222,19 +418,30 @@ LoggerHandle* logger_get_handle(LoggerState *s) {
 void logger_log(LoggerState *s, uint8_t* data, size_t data_size, bool in_qlog) {
   pthread_mutex_lock(&s->lock);
   if (s->cur_handle) {
-    lh_log(s->cur_handle, data, data_size, in_qlog);
+    s->writer->push(s->cur_handle, data, data_size, in_qlog);
   }
   pthread_mutex_unlock(&s->lock);
 }
 
+LogWriterStats logger_writer_stats(LoggerState *s) {
+  return s->writer->stats();
+}
+
 void logger_close(LoggerState *s, ExitHandler *exit_handler) {
   pthread_mutex_lock(&s->lock);
   if (s->cur_handle) {
     s->cur_handle->exit_signal = exit_handler && exit_handler->signal.load();
     s->cur_handle->end_sentinel_type = SentinelType::END_OF_ROUTE;
-    lh_close(s->cur_handle);
+    s->writer->push_close(s->cur_handle);
   }
+  // Waits for everything queued to be written
+  s->writer.reset();
   pthread_mutex_unlock(&s->lock);
+
+  if (s->next_handle.valid()) {
+    LoggerHandle *h = s->next_handle.get();
+    if (h) logger_discard(h);
+  }
 }
 
 void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog) {
@@ -256,14 +463,16 @@ void lh_close(LoggerHandle* h) {
     lh_log_sentinel(h, h->end_sentinel_type);
     pthread_mutex_lock(&h->lock);
   }
-  h->refcnt--;
-  if (h->refcnt == 0) {
+  if (h->refcnt == 1) {
     h->log.reset(nullptr);
     h->q_log.reset(nullptr);
     unlink(h->lock_path);
     pthread_mutex_unlock(&h->lock);
     pthread_mutex_destroy(&h->lock);
+    // Freed last, the next segment may be opened in this handle right away
+    h->refcnt = 0;
     return;
   }
+  h->refcnt--;
   pthread_mutex_unlock(&h->lock);
 }
@@ -3,11 +3,16 @@
 #include <cassert>
 #include <pthread.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-#include <bzlib.h>
 #include <capnp/serialize.h>
 #include <kj/array.h>
 
@@ -15,48 +20,13 @@
 #include "selfdrive/common/util.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/hardware/hw.h"
+#include "selfdrive/loggerd/log_codec.h"
 
 const std::string LOG_ROOT = Path::log_root();
 
 #define LOGGER_MAX_HANDLES 16
-
-class BZFile {
- public:
-  BZFile(const char* path) {
-    file = util::safe_fopen(path, "wb");
-    assert(file != nullptr);
-    int bzerror;
-    bz_file = BZ2_bzWriteOpen(&bzerror, file, 9, 0, 30);
-    assert(bzerror == BZ_OK);
-  }
-  ~BZFile() {
-    int bzerror;
-    BZ2_bzWriteClose(&bzerror, bz_file, 0, nullptr, nullptr);
-    if (bzerror != BZ_OK) {
-      LOGE("BZ2_bzWriteClose error, bzerror=%d", bzerror);
-    }
-    util::safe_fflush(file);
-    int err = fclose(file);
-    assert(err == 0);
-  }
-  inline void write(void* data, size_t size) {
-    int bzerror;
-    do {
-      BZ2_bzWrite(&bzerror, bz_file, data, size);
-    } while (bzerror == BZ_IO_ERROR && errno == EINTR);
-
-    if (bzerror != BZ_OK && !error_logged) {
-      LOGE("BZ2_bzWrite error, bzerror=%d", bzerror);
-      error_logged = true;
-    }
-  }
-  inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
-
- private:
-  bool error_logged = false;
-  FILE* file = nullptr;
-  BZFILE* bz_file = nullptr;
-};
+// Room for a few seconds of rlog, so a stalled disk doesn't back up into the poll loop
+#define LOGGER_WRITER_BUFFER_SIZE (16 << 20)
 
 typedef cereal::Sentinel::SentinelType SentinelType;
 
@@ -64,14 +34,59 @@ typedef struct LoggerHandle {
   pthread_mutex_t lock;
   SentinelType end_sentinel_type;
   int exit_signal;
-  int refcnt;
+  std::atomic<int> refcnt;
   char segment_path[4096];
   char log_path[4096];
   char qlog_path[4096];
   char lock_path[4096];
-  std::unique_ptr<BZFile> log, q_log;
+  char prepared_path[4096];  // where a prepared segment is opened, empty once it's in the log root
+  std::unique_ptr<LogFile> log, q_log;
 } LoggerHandle;
 
+struct LogWriterStats {
+  size_t depth;          // bytes queued right now
+  size_t max_depth;      // most bytes queued since the last call
+  double max_write_ms;   // longest write of a single message, includes compression and disk stalls
+  double blocked_ms;     // time logger_log waited for room in the queue
+};
+
+// Does the compression and file I/O of the logger on its own thread. Messages are copied into a
+// single producer, single consumer byte ring, so only the thread calling logger_log,
+// logger_next and logger_close may push. Destroying the writer writes out everything queued.
+class LogWriter {
+ public:
+  LogWriter(size_t size = LOGGER_WRITER_BUFFER_SIZE);
+  ~LogWriter();
+  void push(LoggerHandle *h, const uint8_t *data, size_t size, bool in_qlog);
+  // Closes the handle once everything queued before has been written
+  void push_close(LoggerHandle *h);
+  LogWriterStats stats();
+
+ private:
+  enum RecordType : uint32_t { DATA, DATA_QLOG, CLOSE, PAD };
+  struct alignas(16) Record {
+    LoggerHandle *h;
+    uint32_t type;
+    uint32_t size;
+  };
+
+  Record *reserve(size_t size);
+  void commit();
+  void writer_thread();
+
+  std::vector<uint8_t> buf;
+  alignas(64) std::atomic<uint64_t> head = 0;  // only written by the producer
+  alignas(64) std::atomic<uint64_t> tail = 0;  // only written by the writer thread
+  uint64_t next_head = 0;                       // end of the reserved record
+
+  std::atomic<bool> exit = false;
+  std::mutex lock;
+  std::condition_variable cv;
+  std::thread thread;
+
+  std::atomic<uint64_t> max_depth = 0, max_write_ns = 0, blocked_ns = 0;
+};
+
 typedef struct LoggerState {
   pthread_mutex_t lock;
   int part;
@@ -79,20 +94,32 @@ typedef struct LoggerState {
   std::string route_name;
   char log_name[64];
   bool has_qlog;
+  LogCodecConfig log_codec, qlog_codec;
 
   LoggerHandle handles[LOGGER_MAX_HANDLES];
   LoggerHandle* cur_handle;
+  std::unique_ptr<LogWriter> writer;
+  // The next segment, opened in the background after each rotation. Its open files hold their
+  // DirectFile thread and buffers until it's used, so the logger has twice the files of one segment open.
+  // It's prepared in <root_path>.next and only moved into the log root by the rotation, so the
+  // uploader never sees it before it's used
+  std::future<LoggerHandle*> next_handle;
 } LoggerState;
 
 kj::Array<capnp::word> logger_build_init_data();
 std::string logger_get_route_name();
-void logger_init(LoggerState *s, const char* log_name, bool has_qlog);
+void logger_init(LoggerState *s, const char* log_name, bool has_qlog,
+                 LogCodecConfig log_codec = {}, LogCodecConfig qlog_codec = {});
+// Switches to the segment prepared after the last call, and starts preparing the next one.
+// The first call removes segments left prepared by a logger that didn't close
 int logger_next(LoggerState *s, const char* root_path,
                             char* out_segment_path, size_t out_segment_path_len,
                             int* out_part);
 LoggerHandle* logger_get_handle(LoggerState *s);
 void logger_close(LoggerState *s, ExitHandler *exit_handler=nullptr);
+// Queues the message for the writer thread, the data is copied
 void logger_log(LoggerState *s, uint8_t* data, size_t data_size, bool in_qlog);
+LogWriterStats logger_writer_stats(LoggerState *s);
 
 void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog);
 void lh_close(LoggerHandle* h);
@@ -0,0 +1,69 @@
+// Measures how long a segment rotation holds up the logger, with messages logged at a steady rate
+// usage: logger_rotate_bench [rotations] [root_path]
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/loggerd/logger.h"
+
+int main(int argc, char *argv[]) {
+  const int rotations = argc > 1 ? atoi(argv[1]) : 20;
+  if (rotations < 1) {
+    printf("usage: %s [rotations] [root_path]\n", argv[0]);
+    return 1;
+  }
+  const std::string root = argc > 2 ? argv[2] : "/tmp/logger_rotate_bench";
+  const bool r = util::create_directories(root, 0775);
+  assert(r);
+
+  LoggerState logger = {};
+  logger_init(&logger, "rlog", true, log_codec_from_string(util::getenv("LOGGERD_RLOG_CODEC")),
+              log_codec_from_string(util::getenv("LOGGERD_QLOG_CODEC")));
+  int err = logger_next(&logger, root.c_str(), nullptr, 0, nullptr);
+  assert(err == 0);
+
+  // Another thread logs a message every 100us, like the poll loop in loggerd.
+  // The longest gap between its messages is the stall a rotation causes there
+  std::atomic<bool> exit = false;
+  std::atomic<uint64_t> max_gap_ns = 0;
+  std::thread producer([&]() {
+    MessageBuilder msg;
+    msg.initEvent().setLogMessage(std::string(1000, 'x'));
+    auto bytes = msg.toBytes();
+    uint64_t last = nanos_since_boot();
+    while (!exit) {
+      logger_log(&logger, bytes.begin(), bytes.size(), false);
+      uint64_t now = nanos_since_boot();
+      update_max_atomic(max_gap_ns, now - last);
+      last = now;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+
+  std::vector<double> pauses;
+  for (int i = 0; i < rotations; i++) {
+    // Leaves time to prepare the next segment, as a real segment would
+    util::sleep_for(500);
+    max_gap_ns = 0;
+    double start = millis_since_boot();
+    err = logger_next(&logger, root.c_str(), nullptr, 0, nullptr);
+    assert(err == 0);
+    pauses.push_back(millis_since_boot() - start);
+    util::sleep_for(50);
+    printf("rotation %d: %.3f ms, longest gap between messages %.3f ms\n", i, pauses.back(), max_gap_ns / 1e6);
+  }
+
+  exit = true;
+  producer.join();
+  logger_close(&logger);
+
+  std::sort(pauses.begin(), pauses.end());
+  printf("\nrotation pause: median %.3f ms, max %.3f ms\n", pauses[pauses.size() / 2], pauses.back());
+  return 0;
+}
@@ -1,7 +1,31 @@
 #include "selfdrive/loggerd/loggerd.h"
 
+#if defined(QCOM) || defined(QCOM2)
+#include "selfdrive/loggerd/omx_encoder.h"
+#else
+#include "selfdrive/loggerd/ffmpeg_encoder.h"
+#include "selfdrive/loggerd/raw_logger.h"
+#endif
+
 ExitHandler do_exit;
 
+// On PC, LOGGERD_ENCODER=raw selects the RawLogger, which encodes on the camera thread,
+// instead of the threaded FfmpegEncoder
+VideoEncoder *encoder_create(const char *filename, CameraType type, int width, int height, int fps,
+                             int bitrate, bool h265, bool downscale, bool write) {
+#if defined(QCOM) || defined(QCOM2)
+  return new OmxEncoder(filename, type, width, height, fps, bitrate, h265, downscale, write);
+#else
+  static const std::string backend = util::getenv("LOGGERD_ENCODER", "ffmpeg");
+  if (backend == "raw") {
+    return new RawLogger(filename, type, width, height, fps, bitrate, h265, downscale, write);
+  } else if (backend != "ffmpeg") {
+    LOGE("unknown encoder %s", backend.c_str());
+  }
+  return new FfmpegEncoder(filename, type, width, height, fps, bitrate, h265, downscale, write);
+#endif
+}
+
 // Handle initial encoder syncing by waiting for all encoders to reach the same frame id
 bool sync_encoders(LoggerdState *s, CameraType cam_type, uint32_t frame_id) {
   if (s->camera_synced[cam_type]) return true;
@@ -43,7 +67,7 @@ void encoder_thread(LoggerdState *s, const LogCameraInfo &cam_info) {
   int cur_seg = -1;
   int encode_idx = 0;
   LoggerHandle *lh = NULL;
-  std::vector<Encoder *> encoders;
+  std::vector<VideoEncoder *> encoders;
   VisionIpcClient vipc_client = VisionIpcClient("camerad", cam_info.stream_type, false);
 
   // While we write them right to the log for sync, we also publish the encode idx to the socket
@@ -62,37 +86,42 @@ void encoder_thread(LoggerdState *s, const LogCameraInfo &cam_info) {
       LOGD("encoder init %dx%d", buf_info.width, buf_info.height);
 
       // main encoder
-      encoders.push_back(new Encoder(cam_info.filename, cam_info.type, buf_info.width, buf_info.height,
-                                     cam_info.fps, cam_info.bitrate, cam_info.is_h265,
-                                     cam_info.downscale, cam_info.record));
+      encoders.push_back(encoder_create(cam_info.filename, cam_info.type, buf_info.width, buf_info.height,
+                                        cam_info.fps, cam_info.bitrate, cam_info.is_h265,
+                                        cam_info.downscale, cam_info.record));
       // qcamera encoder
       if (cam_info.has_qcamera) {
-        encoders.push_back(new Encoder(qcam_info.filename, cam_info.type, qcam_info.frame_width, qcam_info.frame_height,
-                                       qcam_info.fps, qcam_info.bitrate, qcam_info.is_h265, qcam_info.downscale));
+        encoders.push_back(encoder_create(qcam_info.filename, cam_info.type, qcam_info.frame_width, qcam_info.frame_height,
+                                          qcam_info.fps, qcam_info.bitrate, qcam_info.is_h265, qcam_info.downscale));
       }
     }
 
     while (!do_exit) {
       VisionIpcBufExtra extra;
-      VisionBuf* buf = vipc_client.recv(&extra);
+      // Encoding can take a while, keep camerad from reusing the buffer in the meantime
+      VisionBuf* buf = vipc_client.recv_lease(&extra);
       if (buf == nullptr) continue;
+      const double frame_tms = millis_since_boot();
 
       if (cam_info.trigger_rotate) {
         s->last_camera_seen_tms = millis_since_boot();
         if (!sync_encoders(s, cam_info.type, extra.frame_id)) {
+          vipc_client.release(buf);
           continue;
         }
 
         // check if we're ready to rotate
         trigger_rotate_if_needed(s, cur_seg, extra.frame_id);
-        if (do_exit) break;
+        if (do_exit) {
+          vipc_client.release(buf);
+          break;
+        }
       }
 
       // rotate the encoder if the logger is on a newer segment
       if (s->rotate_segment > cur_seg) {
         cur_seg = s->rotate_segment;
 
-        LOGW("camera %d rotate encoder to %s", cam_info.type, s->segment_path);
         for (auto &e : encoders) {
           e->encoder_close();
           e->encoder_open(s->segment_path);
@@ -101,6 +130,8 @@ void encoder_thread(LoggerdState *s, const LogCameraInfo &cam_info) {
           lh_close(lh);
         }
         lh = logger_get_handle(&s->logger);
+        // includes waiting for the other cameras and the logger, the gap in this camera's frames
+        LOGW("camera %d rotate encoder to %s, paused %.1f ms", cam_info.type, s->segment_path, millis_since_boot() - frame_tms);
       }
 
       // encode a frame
@@ -108,12 +139,13 @@ void encoder_thread(LoggerdState *s, const LogCameraInfo &cam_info) {
         int out_id = encoders[i]->encode_frame(buf->y, buf->u, buf->v,
                                                buf->width, buf->height, extra.timestamp_eof);
 
+        // dropped frames are counted by the encoder
         if (out_id == -1) {
           LOGE("Failed to encode frame. frame_id: %d encode_id: %d", extra.frame_id, encode_idx);
         }
 
         // publish encode index
-        if (i == 0 && out_id != -1) {
+        if (i == 0 && out_id >= 0) {
           MessageBuilder msg;
           // this is really ugly
           bool valid = (buf->get_frame_id() == extra.frame_id);
@@ -139,6 +171,9 @@ void encoder_thread(LoggerdState *s, const LogCameraInfo &cam_info) {
         }
       }
 
+      if (!vipc_client.release(buf)) {
+        LOGE("camera %d frame %d was overwritten while encoding", cam_info.type, extra.frame_id);
+      }
       encode_idx++;
     }
 
@@ -156,6 +191,7 @@ void encoder_thread(LoggerdState *s, const LogCameraInfo &cam_info) {
 }
 
 void logger_rotate(LoggerdState *s) {
+  const double start_tms = millis_since_boot();
   {
     std::unique_lock lk(s->rotate_lock);
     int segment = -1;
@@ -166,7 +202,13 @@ void logger_rotate(LoggerdState *s) {
     s->last_rotate_tms = millis_since_boot();
   }
   s->rotate_cv.notify_all();
-  LOGW((s->logger.part == 0) ? "logging to %s" : "rotated to %s", s->segment_path);
+  // the encoders and the message loop are held up for this long
+  const double pause_ms = millis_since_boot() - start_tms;
+  LOGW((s->logger.part == 0) ? "logging to %s, took %.2f ms" : "rotated to %s, took %.2f ms", s->segment_path, pause_ms);
+
+  LogWriterStats ws = logger_writer_stats(&s->logger);
+  LOG("log writer: %zu bytes queued, max %zu, longest write %.1f ms, blocked %.1f ms",
+      ws.depth, ws.max_depth, ws.max_write_ms, ws.blocked_ms);
 }
 
 void rotate_if_needed(LoggerdState *s) {
@@ -185,11 +227,7 @@ void rotate_if_needed(LoggerdState *s) {
 
 void loggerd_thread() {
   // setup messaging
-  typedef struct QlogState {
-    std::string name;
-    int counter, freq;
-  } QlogState;
-  std::unordered_map<SubSocket*, QlogState> qlog_states;
+  std::unordered_map<SubSocket*, QlogPolicy> qlog_policies;
 
   std::unique_ptr<Context> ctx(Context::create());
   std::unique_ptr<Poller> poller(Poller::create());
@@ -202,16 +240,14 @@ void loggerd_thread() {
     SubSocket * sock = SubSocket::create(ctx.get(), it.name);
     assert(sock != NULL);
     poller->registerSocket(sock);
-    qlog_states[sock] = {
-      .name = it.name,
-      .counter = 0,
-      .freq = it.decimation,
-    };
+    qlog_policies.emplace(sock, QlogPolicy(it));
   }
 
   LoggerdState s;
   // init logger
-  logger_init(&s.logger, "rlog", true);
+  // e.g. LOGGERD_RLOG_CODEC=zstd:3:2 for zstd level 3 on two threads, bz2 by default
+  logger_init(&s.logger, "rlog", true, log_codec_from_string(util::getenv("LOGGERD_RLOG_CODEC")),
+              log_codec_from_string(util::getenv("LOGGERD_QLOG_CODEC")));
   logger_rotate(&s);
   Params().put("CurrentRoute", s.logger.route_name);
 
@@ -234,15 +270,19 @@ void loggerd_thread() {
 
       // drain socket
       int count = 0;
-      QlogState &qs = qlog_states[sock];
+      QlogPolicy &qlog = qlog_policies.at(sock);
       Message *msg = nullptr;
       while (!do_exit && (msg = sock->receive(true))) {
-        const bool in_qlog = qs.freq != -1 && (qs.counter++ % qs.freq == 0);
+        const bool in_qlog = qlog.keep(msg->getData(), msg->getSize(), nanos_since_boot());
         logger_log(&s.logger, (uint8_t *)msg->getData(), msg->getSize(), in_qlog);
         bytes_count += msg->getSize();
         delete msg;
 
+        const int part = s.logger.part;
         rotate_if_needed(&s);
+        if (s.logger.part != part) {
+          for (auto &[_, p] : qlog_policies) p.reset();
+        }
 
         if ((++msg_count % 1000) == 0) {
           double seconds = (millis_since_boot() - start_ts) / 1000.0;
@@ -251,7 +291,7 @@ void loggerd_thread() {
 
         count++;
         if (count >= 200) {
-          LOGD("large volume of '%s' messages", qs.name.c_str());
+          LOGD("large volume of '%s' messages", qlog.name.c_str());
           break;
         }
       }
@@ -272,5 +312,5 @@ void loggerd_thread() {
   }
 
   // messaging cleanup
-  for (auto &[sock, qs] : qlog_states) delete sock;
+  for (auto &[sock, qlog] : qlog_policies) delete sock;
 }
@@ -424,8 +424,7 @@ void OmxEncoder::handle_out_buf(OmxEncoder *e, OmxBuffer *out_buf) {
 
   if (e->of) {
     //printf("write %d flags 0x%x\n", out_buf->nFilledLen, out_buf->nFlags);
-    size_t written = util::safe_fwrite(out_buf->data, 1, out_buf->header.nFilledLen, e->of);
-    if (written != out_buf->header.nFilledLen) {
+    if (!e->of->write(out_buf->data, out_buf->header.nFilledLen)) {
       LOGE("failed to write file.errno=%d", errno);
     }
   }
@@ -571,11 +570,10 @@ void OmxEncoder::encoder_open(const char* path) {
     this->wrote_codec_config = false;
   } else {
     if (this->write) {
-      this->of = util::safe_fopen(this->vid_path, "wb");
-      assert(this->of);
+      this->of = std::make_unique<DirectFile>(this->vid_path);
 #ifndef QCOM2
       if (this->codec_config_len > 0) {
-        util::safe_fwrite(this->codec_config, 1, this->codec_config_len, this->of);
+        this->of->write(this->codec_config, this->codec_config_len);
       }
 #endif
     }
@@ -620,11 +618,8 @@ void OmxEncoder::encoder_close() {
       avio_closep(&this->ofmt_ctx->pb);
       avformat_free_context(this->ofmt_ctx);
     } else {
-      if (this->of) {
-        util::safe_fflush(this->of);
-        fclose(this->of);
-        this->of = nullptr;
-      }
+      // Writes out what's left
+      this->of.reset();
     }
     unlink(this->lock_path);
   }
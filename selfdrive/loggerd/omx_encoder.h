@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <memory>
 #include <vector>
 #include <thread>
 
@@ -11,6 +12,7 @@ extern "C" {
 }
 
 #include "selfdrive/common/queue.h"
+#include "selfdrive/loggerd/direct_file.h"
 #include "selfdrive/loggerd/encoder.h"
 
 struct OmxBuffer {
@@ -55,7 +57,7 @@ private:
   std::thread write_handler_thread;
 
   const char* filename;
-  FILE *of = nullptr;
+  std::unique_ptr<DirectFile> of;
   CameraType type;
 
   size_t codec_config_len;
@@ -0,0 +1,98 @@
+#include "selfdrive/loggerd/qlog_policy.h"
+
+#include <string_view>
+
+QlogPolicy::QlogPolicy(const service &srv)
+  : name(srv.name), in_qlog(srv.decimation != -1), decimation(srv.decimation), on_change(srv.qlog_on_change) {
+  if (srv.qlog_hz > 0) {
+    period_ns = 1e9 / srv.qlog_hz;
+  }
+  always_keep = always_keep_predicate(name);
+}
+
+QlogPolicy::Predicate QlogPolicy::always_keep_predicate(const std::string &name) {
+  if (name == "controlsState") {
+    // alerts and engagement changes. The alert type is only hashed, so nothing is copied
+    bool enabled = false, active = false;
+    auto alert_status = cereal::ControlsState::AlertStatus::NORMAL;
+    auto alert_size = cereal::ControlsState::AlertSize::NONE;
+    size_t alert_type = std::hash<std::string_view>{}({});
+    return [=](cereal::Event::Reader event) mutable {
+      auto cs = event.getControlsState();
+      auto type = cs.getAlertType();
+      size_t cur_alert_type = std::hash<std::string_view>{}(std::string_view(type.begin(), type.size()));
+      bool changed = cs.getEnabled() != enabled || cs.getActive() != active || cs.getAlertStatus() != alert_status ||
+                     cs.getAlertSize() != alert_size || cur_alert_type != alert_type;
+      enabled = cs.getEnabled();
+      active = cs.getActive();
+      alert_status = cs.getAlertStatus();
+      alert_size = cs.getAlertSize();
+      alert_type = cur_alert_type;
+      return changed;
+    };
+  }
+  return nullptr;
+}
+
+void QlogPolicy::reset() {
+  segment_start = true;
+}
+
+bool QlogPolicy::keep(const char *data, size_t size, uint64_t tns) {
+  if (!in_qlog && !always_keep) return false;
+
+  bool kept = false, scheduled = false;
+  size_t hash = 0;
+  if (always_keep || on_change) {
+    try {
+      // Messages from msgq are word aligned, only the others are copied
+      kj::ArrayPtr<const capnp::word> words;
+      if ((uintptr_t)data % alignof(capnp::word) == 0 && size % sizeof(capnp::word) == 0) {
+        words = kj::ArrayPtr<const capnp::word>((const capnp::word *)data, size / sizeof(capnp::word));
+      } else {
+        words = aligned_buf.align(data, size);
+      }
+      capnp::FlatArrayMessageReader reader(words);
+      if (always_keep) {
+        kept = always_keep(reader.getRoot<cereal::Event>());
+      }
+      if (on_change) {
+        // everything but the data section of the event, which holds logMonoTime and valid
+        auto ds = reader.getRoot<capnp::AnyStruct>().getDataSection();
+        const char *msg = (const char *)words.begin();
+        size_t ds_begin = (const char *)ds.begin() - msg, ds_end = (const char *)ds.end() - msg;
+        hash = std::hash<std::string_view>{}(std::string_view(msg, ds_begin)) ^
+               std::hash<std::string_view>{}(std::string_view(msg + ds_end, size - ds_end));
+      }
+    } catch (const kj::Exception &) {
+      // kept by the rate limit alone
+    }
+  }
+
+  if (in_qlog && !kept) {
+    if (segment_start) {
+      // and the rate limit or decimation go on from here
+      kept = scheduled = true;
+      counter = 1;
+    } else if (on_change && hash == last_hash) {
+      kept = false;
+    } else if (period_ns > 0) {
+      kept = scheduled = tns >= next_ns;
+    } else if (decimation > 1) {
+      kept = counter++ % decimation == 0;
+    } else {
+      kept = true;
+    }
+  }
+
+  if (kept) {
+    segment_start = false;
+    last_hash = hash;
+  }
+  // Messages kept by the predicate come on top of the rate limit, they don't move its schedule.
+  // It stays on the nominal schedule, unless it's more than a period behind
+  if (scheduled && period_ns > 0) {
+    next_ns = tns < next_ns + period_ns ? next_ns + period_ns : tns + period_ns;
+  }
+  return kept;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
+
+// Decides which messages of a service go in the qlog, see the qlog settings in cereal/services.py.
+//  - qlog_hz: at most this many messages per second, by receive time
+//  - decimation: every nth message, for services without a frequency
+//  - qlog_on_change: only messages with different content than the last one kept
+// The first message of a segment is always kept, as are messages matching the always keep
+// predicate of the service (e.g. alert and engagement changes in controlsState).
+class QlogPolicy {
+ public:
+  QlogPolicy(const service &srv);
+  bool keep(const char *data, size_t size, uint64_t tns);
+  // Called on a new segment, so each segment has the latest message of every service
+  void reset();
+
+  const std::string name;
+
+ private:
+  typedef std::function<bool(cereal::Event::Reader event)> Predicate;
+  static Predicate always_keep_predicate(const std::string &name);
+
+  bool in_qlog;
+  int decimation;
+  uint64_t period_ns = 0;
+  bool on_change;
+  Predicate always_keep;
+
+  bool segment_start = true;
+  int counter = 0;
+  uint64_t next_ns = 0;
+  size_t last_hash = 0;
+  AlignedBuffer aligned_buf;
+};
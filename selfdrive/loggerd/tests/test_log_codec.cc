@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/util.h"
+#include "cereal/messaging/block_codec.h"
+#include "selfdrive/loggerd/log_codec.h"
+#include "selfdrive/ui/replay/util.h"
+
+// Alternates random and repeated runs, so it compresses somewhat like a log
+static std::string random_data(size_t size, uint32_t seed) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (i / 64) % 2 ? (char)(seed >> 16) : 'a';
+  }
+  return data;
+}
+
+static std::string make_event(uint64_t mono_time, size_t size) {
+  MessageBuilder msg;
+  auto event = msg.initEvent();
+  event.setLogMonoTime(mono_time);
+  std::string dat = random_data(size, mono_time);
+  event.initCan(1)[0].setDat(kj::arrayPtr((const capnp::byte *)dat.data(), dat.size()));
+  auto bytes = msg.toBytes();
+  return std::string((const char *)bytes.begin(), bytes.size());
+}
+
+// The whole log, or an empty string if it doesn't decompress
+static std::string decompress_log(const std::string &in) {
+  std::string out;
+  bool ok = decompressLogStream((const std::byte *)in.data(), in.size(), [&](const char *data, size_t size) {
+    out.append(data, size);
+    return true;
+  });
+  return ok ? out : "";
+}
+
+TEST_CASE("block compressors roundtrip") {
+  LogCodec codec = GENERATE(LogCodec::ZSTD, LogCodec::LZ4);
+  int threads = GENERATE(0, 2);  // only used by zstd
+  auto compressor = block_compressor_create(codec, 1, threads);
+  REQUIRE(compressor != nullptr);
+
+  std::string raw = random_data(LOG_BLOCK_SIZE, 1), compressed, out;
+  REQUIRE(compressor->compress(raw, compressed));
+  REQUIRE(compressed.size() < raw.size());
+  REQUIRE(block_decompress(codec, compressed.data(), compressed.size(), raw.size(), out));
+  REQUIRE(out == raw);
+
+  SECTION("the compressor can be reused") {
+    std::string small = random_data(1000, 2);
+    REQUIRE(compressor->compress(small, compressed));
+    REQUIRE(block_decompress(codec, compressed.data(), compressed.size(), small.size(), out));
+    REQUIRE(out == small);
+  }
+  SECTION("a frame that doesn't decode to the raw size fails") {
+    REQUIRE_FALSE(block_decompress(codec, compressed.data(), compressed.size(), raw.size() - 1, out));
+    REQUIRE_FALSE(block_decompress(codec, compressed.data(), compressed.size(), raw.size() + 1, out));
+  }
+  SECTION("a truncated frame fails") {
+    REQUIRE_FALSE(block_decompress(codec, compressed.data(), compressed.size() - 1, raw.size(), out));
+  }
+  SECTION("a corrupt frame fails") {
+    compressed[compressed.size() / 2] ^= 0xff;
+    REQUIRE_FALSE(block_decompress(codec, compressed.data(), compressed.size(), raw.size(), out));
+  }
+  SECTION("a frame of the other codec fails") {
+    LogCodec other = codec == LogCodec::ZSTD ? LogCodec::LZ4 : LogCodec::ZSTD;
+    REQUIRE_FALSE(block_decompress(other, compressed.data(), compressed.size(), raw.size(), out));
+  }
+}
+
+TEST_CASE("bz2 has no block compressor") {
+  REQUIRE(block_compressor_create(LogCodec::BZ2, 9) == nullptr);
+}
+
+TEST_CASE("log_codec_from_string") {
+  LogCodecConfig config = log_codec_from_string("zstd:5:2");
+  REQUIRE((config.codec == LogCodec::ZSTD && config.level == 5 && config.threads == 2));
+  config = log_codec_from_string("lz4");
+  REQUIRE((config.codec == LogCodec::LZ4 && config.level == 0 && config.threads == 0));
+  config = log_codec_from_string("");
+  REQUIRE((config.codec == LogCodec::BZ2 && config.level == 9));
+  config = log_codec_from_string("gzip", {.codec = LogCodec::LZ4});
+  REQUIRE(config.codec == LogCodec::LZ4);
+
+  REQUIRE(std::string(log_codec_extension(LogCodec::BZ2)) == "bz2");
+  REQUIRE(std::string(log_codec_extension(LogCodec::ZSTD)) == "zst");
+  REQUIRE(std::string(log_codec_extension(LogCodec::LZ4)) == "lz4");
+}
+
+TEST_CASE("log files roundtrip") {
+  std::string spec = GENERATE("bz2", "zstd:1", "zstd:1:2", "lz4");
+  LogCodecConfig config = log_codec_from_string(spec);
+
+  char dir[] = "/tmp/test_log_codec_XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  const std::string path = std::string(dir) + "/rlog." + log_codec_extension(config.codec);
+  const std::string index_path = path + ".idx";
+
+  // A few blocks worth of messages, the event at i has logMonoTime 1000 + i
+  const uint64_t start_time = 1000;
+  std::vector<std::string> events;
+  std::string raw;
+  {
+    auto log = log_file_open(path.c_str(), config, index_path.c_str());
+    for (int i = 0; raw.size() < LOG_BLOCK_SIZE * 3 + 1000; ++i) {
+      events.push_back(make_event(start_time + i, (i * 7919) % 20000));
+      log->write((void *)events.back().data(), events.back().size());
+      raw += events.back();
+    }
+  }
+
+  std::string compressed = util::read_file(path);
+  REQUIRE(decompress_log(compressed) == raw);
+
+  // A corrupt log is an error, not a shorter log
+  std::string corrupt = compressed;
+  corrupt[corrupt.size() / 2] ^= 0xff;
+  REQUIRE(decompress_log(corrupt).empty());
+  REQUIRE(decompress_log(raw).empty());
+
+  if (config.codec == LogCodec::BZ2) {
+    REQUIRE_FALSE(util::file_exists(index_path));
+  } else {
+    // Unlike bz2, where a log cut short decodes up to where it ends
+    REQUIRE(decompress_log(compressed.substr(0, compressed.size() - 1)).empty());
+
+    std::string index = util::read_file(index_path);
+    REQUIRE(index.size() > sizeof(LogIndexHeader));
+    REQUIRE((index.size() - sizeof(LogIndexHeader)) % sizeof(LogIndexBlock) == 0);
+    auto header = (const LogIndexHeader *)index.data();
+    REQUIRE(header->magic == LOG_INDEX_MAGIC);
+    REQUIRE(header->version == LOG_INDEX_VERSION);
+
+    auto blocks = (const LogIndexBlock *)(index.data() + sizeof(LogIndexHeader));
+    size_t num_blocks = (index.size() - sizeof(LogIndexHeader)) / sizeof(LogIndexBlock);
+    REQUIRE(num_blocks >= 3);
+
+    // The blocks are contiguous, hold whole messages and decode on their own
+    uint64_t offset = 0;
+    size_t raw_offset = 0, event_idx = 0;
+    for (size_t i = 0; i < num_blocks; ++i) {
+      const LogIndexBlock &b = blocks[i];
+      REQUIRE(b.offset == offset);
+      std::string block;
+      REQUIRE(block_decompress(config.codec, compressed.data() + b.offset, b.size, b.raw_size, block));
+      REQUIRE(block == raw.substr(raw_offset, b.raw_size));
+
+      size_t first_event = event_idx, end = raw_offset + b.raw_size, pos = raw_offset;
+      while (pos < end) pos += events[event_idx++].size();
+      REQUIRE(pos == end);
+      REQUIRE(b.start_mono_time == start_time + first_event);
+      REQUIRE(b.end_mono_time == start_time + event_idx - 1);
+      REQUIRE(b.has((int)cereal::Event::CAN));
+      REQUIRE_FALSE(b.has((int)cereal::Event::CONTROLS_STATE));
+
+      offset += b.size;
+      raw_offset = end;
+    }
+    REQUIRE(offset == compressed.size());
+    REQUIRE(raw_offset == raw.size());
+    unlink(index_path.c_str());
+  }
+
+  unlink(path.c_str());
+  rmdir(dir);
+}
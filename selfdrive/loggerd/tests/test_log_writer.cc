@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/loggerd/logger.h"
+
+// Keeps what the writer thread wrote, in order
+class MemoryLogFile : public LogFile {
+ public:
+  MemoryLogFile(int write_delay_ms = 0) : delay(write_delay_ms) {}
+  void write(void* data, size_t size) override {
+    if (delay > 0) std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    if (on_write) on_write();
+    messages.emplace_back((const char *)data, size);
+  }
+  using LogFile::write;
+
+  int delay;
+  std::function<void()> on_write;
+  std::vector<std::string> messages;
+};
+
+static MemoryLogFile *init_handle(LoggerHandle &h, int refcnt, int write_delay_ms = 0) {
+  pthread_mutex_init(&h.lock, NULL);
+  h.refcnt = refcnt;
+  h.log = std::make_unique<MemoryLogFile>(write_delay_ms);
+  return (MemoryLogFile *)h.log.get();
+}
+
+static std::string make_message(int i, size_t size) {
+  std::string msg(size, '\0');
+  for (size_t j = 0; j < size; ++j) msg[j] = (char)(i * 31 + j);
+  return msg;
+}
+
+TEST_CASE("LogWriter wraps around the ring without corrupting messages") {
+  LoggerHandle h = {};
+  MemoryLogFile *log = init_handle(h, 1, 1);
+
+  // With the 16 byte header, the records take 224 or 320 bytes. Every few records the
+  // next one doesn't fit before the end of the ring, and a PAD record skips the rest
+  size_t size = GENERATE(200, 300);
+  std::vector<std::string> sent;
+  {
+    LogWriter writer(1024);
+    for (int i = 0; i < 50; ++i) {
+      sent.push_back(make_message(i, size));
+      writer.push(&h, (const uint8_t *)sent.back().data(), size, false);
+    }
+    // The writer is slower than the pushes, so the producer had to wait for room
+    REQUIRE(writer.stats().blocked_ms > 0);
+  }
+  REQUIRE(log->messages == sent);
+}
+
+TEST_CASE("LogWriter handles records that end exactly at the end of the ring") {
+  LoggerHandle h = {};
+  MemoryLogFile *log = init_handle(h, 1);
+
+  std::vector<std::string> sent;
+  {
+    LogWriter writer(1024);
+    // With the header, four of these fill the ring exactly, so no PAD is needed
+    for (int i = 0; i < 20; ++i) {
+      sent.push_back(make_message(i, 240));
+      writer.push(&h, (const uint8_t *)sent.back().data(), 240, false);
+    }
+    // Then empty messages and sizes that aren't a multiple of the record alignment
+    for (int i = 0; i < 200; ++i) {
+      size_t size = i % 2 == 0 ? 0 : 37 + i;
+      sent.push_back(make_message(i, size));
+      writer.push(&h, (const uint8_t *)sent.back().data(), size, false);
+    }
+  }
+  REQUIRE(log->messages == sent);
+}
+
+TEST_CASE("LogWriter writes qlog messages to both files") {
+  LoggerHandle h = {};
+  MemoryLogFile *log = init_handle(h, 1);
+  h.q_log = std::make_unique<MemoryLogFile>();
+  MemoryLogFile *qlog = (MemoryLogFile *)h.q_log.get();
+
+  {
+    LogWriter writer(1024);
+    writer.push(&h, (const uint8_t *)"rlog", 4, false);
+    writer.push(&h, (const uint8_t *)"qlog", 4, true);
+  }
+  REQUIRE(log->messages == std::vector<std::string>{"rlog", "qlog"});
+  REQUIRE(qlog->messages == std::vector<std::string>{"qlog"});
+}
+
+TEST_CASE("LogWriter drains the queue when it's destroyed") {
+  LoggerHandle prev = {}, next = {};
+  MemoryLogFile *prev_log = init_handle(prev, 2, 1);
+  MemoryLogFile *next_log = init_handle(next, 1);
+
+  // Closed in order, after everything pushed to the previous segment
+  int refcnt_at_next_write = -1;
+  next_log->on_write = [&]() {
+    if (refcnt_at_next_write < 0) refcnt_at_next_write = prev.refcnt;
+  };
+
+  std::vector<std::string> sent;
+  {
+    LogWriter writer(1 << 16);
+    for (int i = 0; i < 100; ++i) {
+      sent.push_back(make_message(i, 100));
+      writer.push(&prev, (const uint8_t *)sent.back().data(), sent.back().size(), false);
+    }
+    writer.push_close(&prev);
+    writer.push(&next, (const uint8_t *)"next", 4, false);
+    // Only a fraction is written by now
+    REQUIRE(writer.stats().depth > 0);
+  }
+  REQUIRE(prev_log->messages == sent);
+  REQUIRE(prev.refcnt == 1);
+  REQUIRE(refcnt_at_next_write == 1);
+  REQUIRE(next_log->messages == std::vector<std::string>{"next"});
+}
+
+TEST_CASE("Rotating the logger doesn't hold up logging") {
+  char dir[] = "/tmp/test_log_writer_XXXXXX";
+  REQUIRE(mkdtemp(dir) != nullptr);
+  const std::string root = std::string(dir) + "/realdata";
+  REQUIRE(util::create_directories(root, 0775));
+
+  // Left prepared by a logger that didn't close
+  const std::string stale = root + ".next/2021-01-01--00-00-00--1";
+  REQUIRE(util::create_directories(stale, 0775));
+  REQUIRE(util::write_file((stale + "/rlog.bz2.lock").c_str(), "", 0, O_WRONLY | O_CREAT) == 0);
+
+  LoggerState logger = {};
+  logger_init(&logger, "rlog", true);
+  char segment_path[4096];
+  int part = -1;
+  REQUIRE(logger_next(&logger, root.c_str(), segment_path, sizeof(segment_path), &part) == 0);
+  REQUIRE_FALSE(util::file_exists(stale));
+
+  // Logs a message every 100us, like the poll loop in loggerd
+  std::atomic<bool> exit = false;
+  std::atomic<uint64_t> max_gap_ns = 0;
+  std::thread producer([&]() {
+    MessageBuilder msg;
+    msg.initEvent().setLogMessage(std::string(1000, 'x'));
+    auto bytes = msg.toBytes();
+    uint64_t last = nanos_since_boot();
+    while (!exit) {
+      logger_log(&logger, bytes.begin(), bytes.size(), false);
+      uint64_t now = nanos_since_boot();
+      update_max_atomic(max_gap_ns, now - last);
+      last = now;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+
+  std::vector<double> pauses, gaps;
+  for (int i = 0; i < 5; i++) {
+    // Time to prepare the next segment
+    util::sleep_for(300);
+    const std::string next_path = root + "/" + logger.route_name + "--" + std::to_string(part + 1);
+    REQUIRE_FALSE(util::file_exists(next_path));
+
+    max_gap_ns = 0;
+    double start = millis_since_boot();
+    REQUIRE(logger_next(&logger, root.c_str(), segment_path, sizeof(segment_path), &part) == 0);
+    pauses.push_back(millis_since_boot() - start);
+    util::sleep_for(50);
+    gaps.push_back(max_gap_ns / 1e6);
+
+    // The prepared segment is moved into the log root with its lock file
+    REQUIRE(std::string(segment_path) == next_path);
+    REQUIRE(util::file_exists(logger.cur_handle->lock_path));
+    REQUIRE(util::file_exists(logger.cur_handle->log_path));
+  }
+
+  exit = true;
+  producer.join();
+  logger_close(&logger);
+  REQUIRE_FALSE(util::file_exists(root + ".next"));
+  REQUIRE_FALSE(util::file_exists(root + "/" + logger.route_name + "--" + std::to_string(part + 1)));
+
+  // Opening the segment isn't part of the rotation, so it's far below a frame at 20 fps.
+  // Loose bounds, other tests may be running
+  std::sort(pauses.begin(), pauses.end());
+  INFO("rotation pauses " << pauses[pauses.size() / 2] << " ms median, " << pauses.back() << " ms max");
+  REQUIRE(pauses[pauses.size() / 2] < 5);
+  REQUIRE(pauses.back() < 50);
+  REQUIRE(*std::max_element(gaps.begin(), gaps.end()) < 50);
+}
@@ -0,0 +1,137 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "selfdrive/loggerd/qlog_policy.h"
+
+static service make_service(const char *name, int decimation, float qlog_hz, bool qlog_on_change = false) {
+  service srv = {};
+  strncpy(srv.name, name, sizeof(srv.name) - 1);
+  srv.should_log = true;
+  srv.decimation = decimation;
+  srv.qlog_hz = qlog_hz;
+  srv.qlog_on_change = qlog_on_change;
+  return srv;
+}
+
+static bool keep(QlogPolicy &policy, MessageBuilder &msg, uint64_t tns) {
+  auto bytes = msg.toBytes();
+  return policy.keep((const char *)bytes.begin(), bytes.size(), tns);
+}
+
+static bool keep_can(QlogPolicy &policy, uint32_t address, uint64_t tns) {
+  MessageBuilder msg;
+  msg.initEvent().initCan(1)[0].setAddress(address);
+  return keep(policy, msg, tns);
+}
+
+static bool keep_controls_state(QlogPolicy &policy, bool enabled, const char *alert_type, uint64_t tns) {
+  MessageBuilder msg;
+  auto cs = msg.initEvent().initControlsState();
+  cs.setEnabled(enabled);
+  cs.setAlertType(alert_type);
+  return keep(policy, msg, tns);
+}
+
+// Times of the kept messages, for messages every period_ns
+static std::vector<uint64_t> kept_times(QlogPolicy &policy, uint64_t start_ns, uint64_t period_ns, int count) {
+  std::vector<uint64_t> kept;
+  for (int i = 0; i < count; ++i) {
+    uint64_t tns = start_ns + i * period_ns;
+    if (keep_can(policy, 0, tns)) kept.push_back(tns);
+  }
+  return kept;
+}
+
+TEST_CASE("QlogPolicy limits the rate by time") {
+  QlogPolicy policy(make_service("can", 100, 1.));
+
+  SECTION("on a steady stream") {
+    // 100 Hz for 10 s
+    auto kept = kept_times(policy, 1e9, 1e7, 1000);
+    REQUIRE(kept.size() == 10);
+    for (size_t i = 0; i < kept.size(); ++i) {
+      REQUIRE(kept[i] == 1e9 + i * 1e9);
+    }
+  }
+  SECTION("with bursts and gaps") {
+    REQUIRE(keep_can(policy, 0, 1e9));
+    // a burst right after isn't kept
+    REQUIRE(kept_times(policy, 1e9 + 1, 1, 100).empty());
+    // on schedule
+    REQUIRE(keep_can(policy, 0, 2e9));
+    // after a gap of several periods, the schedule starts over instead of catching up
+    REQUIRE(keep_can(policy, 0, 10e9 + 5e8));
+    REQUIRE_FALSE(keep_can(policy, 0, 11e9));
+    REQUIRE(keep_can(policy, 0, 11e9 + 5e8));
+  }
+}
+
+TEST_CASE("QlogPolicy decimates services without a rate") {
+  QlogPolicy policy(make_service("can", 5, 0));
+  std::vector<bool> kept;
+  for (int i = 0; i < 12; ++i) {
+    kept.push_back(keep_can(policy, 0, i));
+  }
+  // the first message of the segment, then every 5th
+  REQUIRE(kept == std::vector<bool>{true, false, false, false, false, true, false, false, false, false, true, false});
+}
+
+TEST_CASE("QlogPolicy keeps services that aren't in the qlog out") {
+  QlogPolicy policy(make_service("can", -1, 0));
+  REQUIRE_FALSE(keep_can(policy, 0, 0));
+  REQUIRE_FALSE(keep_can(policy, 1, 1e9));
+}
+
+TEST_CASE("QlogPolicy on change") {
+  QlogPolicy policy(make_service("can", 1, 0, true));
+  REQUIRE(keep_can(policy, 1, 0));
+  // logMonoTime is different, but the content isn't
+  REQUIRE_FALSE(keep_can(policy, 1, 1e9));
+  REQUIRE(keep_can(policy, 2, 2e9));
+  REQUIRE_FALSE(keep_can(policy, 2, 3e9));
+  REQUIRE(keep_can(policy, 1, 4e9));
+}
+
+TEST_CASE("QlogPolicy keeps the first message of each segment") {
+  QlogPolicy policy(make_service("can", 1, 0, true));
+  REQUIRE(keep_can(policy, 1, 0));
+  REQUIRE_FALSE(keep_can(policy, 1, 1e9));
+  policy.reset();
+  REQUIRE(keep_can(policy, 1, 2e9));
+  REQUIRE_FALSE(keep_can(policy, 1, 3e9));
+}
+
+TEST_CASE("QlogPolicy always keeps controlsState changes") {
+  QlogPolicy policy(make_service("controlsState", 10, 10.));
+
+  // on schedule every 100 ms
+  REQUIRE(keep_controls_state(policy, false, "", 1e9));
+  REQUIRE_FALSE(keep_controls_state(policy, false, "", 1e9 + 5e7));
+
+  // an engagement and an alert are kept right away
+  REQUIRE(keep_controls_state(policy, true, "", 1e9 + 6e7));
+  REQUIRE(keep_controls_state(policy, true, "steerSaturated/warning", 1e9 + 7e7));
+  REQUIRE_FALSE(keep_controls_state(policy, true, "steerSaturated/warning", 1e9 + 8e7));
+  // another alert, with the same status and size
+  REQUIRE(keep_controls_state(policy, true, "fcw/critical", 1e9 + 9e7));
+
+  // and don't move the schedule
+  REQUIRE(keep_controls_state(policy, true, "fcw/critical", 1e9 + 1e8));
+  REQUIRE_FALSE(keep_controls_state(policy, true, "fcw/critical", 1e9 + 1.5e8));
+  REQUIRE(keep_controls_state(policy, true, "fcw/critical", 1e9 + 2e8));
+}
+
+TEST_CASE("QlogPolicy reads unaligned messages") {
+  QlogPolicy policy(make_service("can", 1, 0, true));
+  MessageBuilder msg;
+  msg.initEvent().initCan(1)[0].setAddress(1);
+  auto bytes = msg.toBytes();
+
+  std::string buf(bytes.size() + 1, '\0');
+  memcpy(&buf[1], bytes.begin(), bytes.size());
+  REQUIRE(policy.keep(&buf[1], bytes.size(), 0));
+  REQUIRE_FALSE(policy.keep(&buf[1], bytes.size(), 1e9));
+  REQUIRE_FALSE(policy.keep((const char *)bytes.begin(), bytes.size(), 2e9));
+}
@@ -19,7 +19,7 @@ void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client) {
 
   while (!do_exit) {
     VisionIpcBufExtra extra = {};
-    VisionBuf *buf = vipc_client.recv(&extra);
+    VisionBuf *buf = vipc_client.recv_lease(&extra);
     if (buf == nullptr) continue;
 
     sm.update(0);
@@ -33,6 +33,9 @@ void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client) {
     double t1 = millis_since_boot();
     DMonitoringResult res = dmonitoring_eval_frame(&model, buf->addr, buf->width, buf->height, calib);
     double t2 = millis_since_boot();
+    if (!vipc_client.release(buf)) {
+      LOGE("driver frame %d was overwritten while running the model", extra.frame_id);
+    }
 
     // send dm packet
     dmonitoring_publish(pm, extra.frame_id, res, (t2 - t1) / 1000.0, model.output);
@@ -6,6 +6,7 @@
 #include <eigen3/Eigen/Dense>
 
 #include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
 #include "cereal/visionipc/visionipc_client.h"
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/params.h"
@@ -59,7 +60,7 @@ static uint64_t get_ts(const VisionIpcBufExtra &extra) {
 void run_model(ModelState &model, VisionIpcClient &vipc_client_main, VisionIpcClient &vipc_client_extra, bool main_wide_camera, bool use_extra_client) {
   // messaging
   PubMaster pm({"modelV2", "cameraOdometry"});
-  SubMaster sm({"lateralPlan", "roadCameraState", "liveCalibration"});
+  SubMaster sm({ServiceId::lateralPlan, ServiceId::roadCameraState, ServiceId::liveCalibration});
 
   // setup filter to track dropped frames
   FirstOrderFilter frame_dropped_filter(0., 10., 1. / MODEL_FREQ);
@@ -114,10 +115,10 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client_main, VisionIpcCl
 
     // TODO: path planner timeout?
     sm.update(0);
-    int desire = ((int)sm["lateralPlan"].getLateralPlan().getDesire());
-    frame_id = sm["roadCameraState"].getRoadCameraState().getFrameId();
-    if (sm.updated("liveCalibration")) {
-      auto extrinsic_matrix = sm["liveCalibration"].getLiveCalibration().getExtrinsicMatrix();
+    int desire = ((int)sm[ServiceId::lateralPlan].getLateralPlan().getDesire());
+    frame_id = sm[ServiceId::roadCameraState].getRoadCameraState().getFrameId();
+    if (sm.updated(ServiceId::liveCalibration)) {
+      auto extrinsic_matrix = sm[ServiceId::liveCalibration].getLiveCalibration().getExtrinsicMatrix();
       Eigen::Matrix<float, 3, 4> extrinsic_matrix_eigen;
       for (int i = 0; i < 4*3; i++) {
         extrinsic_matrix_eigen(i / 4, i % 4) = extrinsic_matrix[i];
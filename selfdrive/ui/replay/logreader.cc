@@ -1,6 +1,11 @@
 #include "selfdrive/ui/replay/logreader.h"
 
 #include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "selfdrive/common/queue.h"
+
 #include "selfdrive/ui/replay/util.h"
 
 Event::Event(const kj::ArrayPtr<const capnp::word> &amsg, bool frame) : reader(amsg), frame(frame) {
@@ -24,6 +29,34 @@ Event::Event(const kj::ArrayPtr<const capnp::word> &amsg, bool frame) : reader(a
   }
 }
 
+// class LogIndex
+
+bool LogIndex::load(const std::string &data) {
+  blocks.clear();
+
+  LogIndexHeader header;
+  if (data.size() < sizeof(header)) return false;
+  memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != LOG_INDEX_MAGIC || header.version != LOG_INDEX_VERSION) return false;
+
+  // A partial entry at the end is from a log that was cut short
+  size_t num_blocks = (data.size() - sizeof(header)) / sizeof(LogIndexBlock);
+  blocks.resize(num_blocks);
+  memcpy(blocks.data(), data.data() + sizeof(header), num_blocks * sizeof(LogIndexBlock));
+  return true;
+}
+
+std::vector<LogIndexBlock> LogIndex::find(uint64_t start_mono_time, uint64_t end_mono_time, int which) const {
+  std::vector<LogIndexBlock> result;
+  for (const auto &block : blocks) {
+    if (block.end_mono_time >= start_mono_time && block.start_mono_time <= end_mono_time &&
+        (which < 0 || block.has(which))) {
+      result.push_back(block);
+    }
+  }
+  return result;
+}
+
 // class LogReader
 
 LogReader::LogReader(size_t memory_pool_block_size) {
@@ -54,19 +87,140 @@ bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool loca
   return load((std::byte*)data.data(), data.size(), abort);
 }
 
+bool LogReader::load(const std::string &url, const std::string &index_url, uint64_t start_mono_time,
+                     std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
+  FileReader f(local_cache, chunk_size, retries);
+  LogIndex index;
+  if (index_url.empty() || !index.load(f.read(index_url, abort))) {
+    if (!(abort && *abort)) rWarning("no valid log index for %s, loading all of it", url.c_str());
+    return load(url, abort, local_cache, chunk_size, retries);
+  }
+
+  std::string data = f.read(url, abort);
+  if (data.empty()) return false;
+
+  // The index is flushed after each block is handed to the writer, so after a crash it can be ahead of the log
+  if (!index.blocks.empty() && index.blocks.back().offset + index.blocks.back().size > data.size()) {
+    rWarning("log index of %s is ahead of the log, loading all of it", url.c_str());
+    return load((std::byte*)data.data(), data.size(), abort);
+  }
+  return load((std::byte*)data.data(), data.size(), index, start_mono_time, UINT64_MAX, abort);
+}
+
 bool LogReader::load(const std::byte *data, size_t size, std::atomic<bool> *abort) {
-  raw_ = decompressBZ2(data, size, abort);
-  if (raw_.empty()) {
-    if (!(abort && *abort)) {
-      rWarning("failed to decompress log");
+  // The complete messages are handed over as they're decompressed, an empty span marks the end.
+  // The spans point into the chunks, the bound keeps decompression from running far ahead of parsing
+  SafeQueue<kj::ArrayPtr<const capnp::word>> messages(4);
+  bool decompressed = false;
+  std::thread decompress_thread([&]() {
+    decompressed = decompressLogStream(data, size, [&](const char *piece, size_t piece_size) {
+      feed(piece, piece_size, [&](kj::ArrayPtr<const capnp::word> words) { messages.push(words); });
+      return !corrupt_;
+    }, abort);
+    messages.push({});
+  });
+
+  // corrupt_ can be set by the decompression thread after it handed over the messages before the corruption
+  bool parsed = true;
+  for (auto words = messages.pop(); words.size() > 0; words = messages.pop()) {
+    if (parsed && !(abort && *abort)) {
+      parsed = parse(words);
     }
-    return false;
   }
+  decompress_thread.join();
 
-  try {
-    kj::ArrayPtr<const capnp::word> words((const capnp::word *)raw_.data(), raw_.size() / sizeof(capnp::word));
-    while (words.size() > 0 && !(abort && *abort)) {
+  if (!decompressed && !corrupt_ && !(abort && *abort)) {
+    rWarning("failed to decompress log");
+    if (events.empty()) return false;
+  }
+  return finish(abort);
+}
 
+bool LogReader::load(const std::byte *data, size_t size, const LogIndex &index, uint64_t start_mono_time,
+                     uint64_t end_mono_time, std::atomic<bool> *abort) {
+  // Every block is a complete frame ending on a message boundary
+  for (const auto &block : index.find(start_mono_time, end_mono_time)) {
+    if (abort && *abort) return false;
+    if (block.offset + block.size > size) {
+      rWarning("log index doesn't match the log");
+      return false;
+    }
+
+    size_t raw_size = 0;
+    bool ok = decompressLogStream(data + block.offset, block.size, [&](const char *piece, size_t piece_size) {
+      raw_size += piece_size;
+      feed(piece, piece_size, [this](auto words) { parse(words); });
+      return !corrupt_;
+    }, abort);
+    if (!ok || raw_size != block.raw_size) {
+      if (!(abort && *abort)) {
+        rWarning("failed to decompress log block at %lu", (unsigned long)block.offset);
+      }
+      return false;
+    }
+  }
+
+  // Blocks written after the index was last flushed, e.g. at the end of a segment cut short by a crash
+  const uint64_t indexed_size = index.blocks.empty() ? 0 : index.blocks.back().offset + index.blocks.back().size;
+  if (end_mono_time == UINT64_MAX && indexed_size < size && !corrupt_) {
+    bool ok = decompressLogStream(data + indexed_size, size - indexed_size, [&](const char *piece, size_t piece_size) {
+      feed(piece, piece_size, [this](auto words) { parse(words); });
+      return !corrupt_;
+    }, abort);
+    if (!ok && !(abort && *abort)) {
+      rWarning("failed to decompress the end of the log after the index");
+    }
+  }
+  return finish(abort);
+}
+
+void LogReader::feed(const char *data, size_t size, const MessagesHandler &messages) {
+  // A bigger message couldn't be read with the default ReaderOptions, the size comes from a corrupt log
+  static const size_t max_msg_words = capnp::ReaderOptions().traversalLimitInWords;
+
+  while (size > 0 && !corrupt_) {
+    if (cur_size_ == cur_.size() * sizeof(capnp::word)) {
+      // Moves the message cut off at the end into a new chunk, big enough to hold all of it
+      size_t tail_words = cur_size_ / sizeof(capnp::word) - complete_words_;
+      kj::Array<capnp::word> next = kj::heapArray<capnp::word>(std::max({LOG_CHUNK_SIZE / sizeof(capnp::word), next_msg_words_, tail_words + 1}));
+      if (cur_.size() > 0) {
+        memcpy(next.begin(), cur_.begin() + complete_words_, tail_words * sizeof(capnp::word));
+        chunks_.push_back(std::move(cur_));
+      }
+      cur_size_ = tail_words * sizeof(capnp::word);
+      complete_words_ = 0;
+      cur_ = std::move(next);
+    }
+
+    size_t n = std::min(size, cur_.size() * sizeof(capnp::word) - cur_size_);
+    memcpy((char *)cur_.begin() + cur_size_, data, n);
+    cur_size_ += n;
+    data += n;
+    size -= n;
+
+    // Hands over the messages that are all there now
+    const size_t begin = complete_words_, end = cur_size_ / sizeof(capnp::word);
+    bool too_big = false;
+    while (complete_words_ < end) {
+      next_msg_words_ = capnp::expectedSizeInWordsFromPrefix(kj::arrayPtr(cur_.begin() + complete_words_, cur_.begin() + end));
+      too_big = next_msg_words_ > max_msg_words;
+      if (too_big || next_msg_words_ > end - complete_words_) break;
+      complete_words_ += next_msg_words_;
+    }
+    if (complete_words_ > begin) {
+      messages(kj::arrayPtr(cur_.begin() + begin, cur_.begin() + complete_words_));
+    }
+    if (too_big) {
+      rWarning("failed to parse log : message of %zu words", next_msg_words_);
+      corrupt_ = true;
+    }
+  }
+}
+
+bool LogReader::parse(kj::ArrayPtr<const capnp::word> words) {
+  new_events_.clear();
+  try {
+    while (words.size() > 0) {
 #ifdef HAS_MEMORY_RESOURCE
       Event *evt = new (mbr_) Event(words);
 #else
@@ -84,17 +238,30 @@ bool LogReader::load(const std::byte *data, size_t size, std::atomic<bool> *abor
         Event *frame_evt = new Event(words, true);
 #endif
 
-        events.push_back(frame_evt);
+        new_events_.push_back(frame_evt);
       }
 
       words = kj::arrayPtr(evt->reader.getEnd(), words.end());
-      events.push_back(evt);
+      new_events_.push_back(evt);
     }
   } catch (const kj::Exception &e) {
     rWarning("failed to parse log : %s", e.getDescription().cStr());
-    if (!events.empty()) {
-      rWarning("read %zu events from corrupt log", events.size());
-    }
+    corrupt_ = true;
+  }
+
+  events.insert(events.end(), new_events_.begin(), new_events_.end());
+  if (on_events && !new_events_.empty()) {
+    on_events(new_events_);
+  }
+  return words.size() == 0;
+}
+
+bool LogReader::finish(std::atomic<bool> *abort) {
+  if (cur_size_ > complete_words_ * sizeof(capnp::word) && !corrupt_) {
+    rWarning("log ends with an incomplete message");
+  }
+  if (corrupt_ && !events.empty()) {
+    rWarning("read %zu events from corrupt log", events.size());
   }
 
   if (!events.empty() && !(abort && *abort)) {
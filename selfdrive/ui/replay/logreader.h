@@ -5,13 +5,18 @@
 #include <memory_resource>
 #endif
 
+#include <functional>
+#include <vector>
+
 #include "cereal/gen/cpp/log.capnp.h"
 #include "selfdrive/camerad/cameras/camera_common.h"
+#include "selfdrive/loggerd/log_index.h"
 #include "selfdrive/ui/replay/filereader.h"
 
 const CameraType ALL_CAMERAS[] = {RoadCam, DriverCam, WideRoadCam};
 const int MAX_CAMERAS = std::size(ALL_CAMERAS);
 const int DEFAULT_EVENT_MEMORY_POOL_BLOCK_SIZE = 65000;
+const size_t LOG_CHUNK_SIZE = 8 << 20;
 
 class Event {
 public:
@@ -46,17 +51,55 @@ public:
   bool frame;
 };
 
+// Side-car index of the zstd/lz4 logs, <log>.idx
+class LogIndex {
+public:
+  bool load(const std::string &data);
+  // Blocks that can hold events between start and end mono time, only those with events of type which if given
+  std::vector<LogIndexBlock> find(uint64_t start_mono_time, uint64_t end_mono_time, int which = -1) const;
+
+  std::vector<LogIndexBlock> blocks;
+};
+
+// The log is decompressed on a background thread straight into the chunks the events point into,
+// and parsed as the messages complete, so the decompressed log is held once and parsing overlaps decompression.
 class LogReader {
 public:
   LogReader(size_t memory_pool_block_size = DEFAULT_EVENT_MEMORY_POOL_BLOCK_SIZE);
   ~LogReader();
   bool load(const std::string &url, std::atomic<bool> *abort = nullptr, bool local_cache = false, int chunk_size = -1, int retries = 0);
+  // Only decodes the log from the block holding start_mono_time on, falls back to the whole log without a valid index
+  bool load(const std::string &url, const std::string &index_url, uint64_t start_mono_time,
+            std::atomic<bool> *abort = nullptr, bool local_cache = false, int chunk_size = -1, int retries = 0);
   bool load(const std::byte *data, size_t size, std::atomic<bool> *abort = nullptr);
+  // Only decodes the blocks of an indexed log that can hold events between start and end mono time.
+  // Without an end, the part of the log written after the last indexed block is decoded too
+  bool load(const std::byte *data, size_t size, const LogIndex &index, uint64_t start_mono_time,
+            uint64_t end_mono_time = UINT64_MAX, std::atomic<bool> *abort = nullptr);
 
+  // Optional, called during load with the events of each batch as soon as it's parsed, in log order.
+  // The events stay valid for the lifetime of the LogReader. Segments hand them to Replay while they
+  // load, and the timeline is built from them
+  std::function<void(const std::vector<Event*> &events)> on_events;
+  // Sorted by mono time once load returns
   std::vector<Event*> events;
 
 private:
-  std::string raw_;
+  typedef std::function<void(kj::ArrayPtr<const capnp::word> messages)> MessagesHandler;
+  // Copies decompressed data into the chunks, messages is called with the messages it completes
+  void feed(const char *data, size_t size, const MessagesHandler &messages);
+  // Returns false if the log is corrupt
+  bool parse(kj::ArrayPtr<const capnp::word> words);
+  bool finish(std::atomic<bool> *abort);
+
+  // Events point into the chunks, a message cut off at the end of a chunk is moved to the next one
+  std::vector<kj::Array<capnp::word>> chunks_;
+  kj::Array<capnp::word> cur_;
+  size_t cur_size_ = 0;        // bytes filled in cur_
+  size_t complete_words_ = 0;  // words of cur_ holding complete messages
+  size_t next_msg_words_ = 0;
+  std::atomic<bool> corrupt_ = false;
+  std::vector<Event*> new_events_;
 #ifdef HAS_MEMORY_RESOURCE
   std::pmr::monotonic_buffer_resource *mbr_ = nullptr;
   void *pool_buffer_ = nullptr;
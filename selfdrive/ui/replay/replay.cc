@@ -15,10 +15,12 @@ Replay::Replay(QString route, QStringList allow, QStringList block, SubMaster *s
   std::vector<const char *> s;
   auto event_struct = capnp::Schema::from<cereal::Event>().asStruct();
   sockets_.resize(event_struct.getUnionFields().size());
+  service_ids_.resize(sockets_.size());
   for (const auto &it : services) {
     if ((allow.empty() || allow.contains(it.name)) && !block.contains(it.name)) {
       uint16_t which = event_struct.getFieldByName(it.name).getProto().getDiscriminantValue();
       sockets_[which] = it.name;
+      service_ids_[which] = (ServiceId)(&it - services);
       s.push_back(it.name);
     }
   }
@@ -104,6 +106,14 @@ void Replay::seekTo(int seconds, bool relative) {
     rInfo("seeking to %d s, segment %d", seconds, seg);
     current_segment_ = seg;
     cur_mono_time_ = route_start_ts_ + seconds * 1e9;
+
+    // The segment was only decoded from a later point on, so it's loaded again from here
+    auto &segment = segments_[seg];
+    if (segment && segment->start_mono_time > cur_mono_time_) {
+      events_->clear();
+      segments_merged_.clear();
+      segment.reset(nullptr);
+    }
     return isSegmentMerged(seg);
   });
   queueSegment();
@@ -122,35 +132,37 @@ void Replay::buildTimeline() {
 
   for (int i = 0; i < segments_.size() && !exit_; ++i) {
     LogReader log;
-    if (!log.load(route_->at(i).qlog.toStdString(), &exit_, !hasFlag(REPLAY_FLAG_NO_FILE_CACHE), 0, 3)) continue;
-
-    for (const Event *e : log.events) {
-      if (e->which == cereal::Event::Which::CONTROLS_STATE) {
-        auto cs = e->event.getControlsState();
-
-        if (!engaged_begin && cs.getEnabled()) {
-          engaged_begin = e->mono_time;
-        } else if (engaged_begin && !cs.getEnabled()) {
-          std::lock_guard lk(timeline_lock);
-          timeline.push_back({toSeconds(engaged_begin), toSeconds(e->mono_time), TimelineType::Engaged});
-          engaged_begin = 0;
-        }
+    // controlsState comes in time order, so the timeline is built while the qlog decodes
+    log.on_events = [&](const std::vector<Event *> &events) {
+      for (const Event *e : events) {
+        if (e->which == cereal::Event::Which::CONTROLS_STATE) {
+          auto cs = e->event.getControlsState();
+
+          if (!engaged_begin && cs.getEnabled()) {
+            engaged_begin = e->mono_time;
+          } else if (engaged_begin && !cs.getEnabled()) {
+            std::lock_guard lk(timeline_lock);
+            timeline.push_back({toSeconds(engaged_begin), toSeconds(e->mono_time), TimelineType::Engaged});
+            engaged_begin = 0;
+          }
 
-        if (!alert_begin && cs.getAlertType().size() > 0) {
-          alert_begin = e->mono_time;
-          alert_type = TimelineType::AlertInfo;
-          if (cs.getAlertStatus() != cereal::ControlsState::AlertStatus::NORMAL) {
-            alert_type = cs.getAlertStatus() == cereal::ControlsState::AlertStatus::USER_PROMPT
-                             ? TimelineType::AlertWarning
-                             : TimelineType::AlertCritical;
+          if (!alert_begin && cs.getAlertType().size() > 0) {
+            alert_begin = e->mono_time;
+            alert_type = TimelineType::AlertInfo;
+            if (cs.getAlertStatus() != cereal::ControlsState::AlertStatus::NORMAL) {
+              alert_type = cs.getAlertStatus() == cereal::ControlsState::AlertStatus::USER_PROMPT
+                               ? TimelineType::AlertWarning
+                               : TimelineType::AlertCritical;
+            }
+          } else if (alert_begin && cs.getAlertType().size() == 0) {
+            std::lock_guard lk(timeline_lock);
+            timeline.push_back({toSeconds(alert_begin), toSeconds(e->mono_time), alert_type});
+            alert_begin = 0;
           }
-        } else if (alert_begin && cs.getAlertType().size() == 0) {
-          std::lock_guard lk(timeline_lock);
-          timeline.push_back({toSeconds(alert_begin), toSeconds(e->mono_time), alert_type});
-          alert_begin = 0;
         }
       }
-    }
+    };
+    log.load(route_->at(i).qlog.toStdString(), &exit_, !hasFlag(REPLAY_FLAG_NO_FILE_CACHE), 0, 3);
   }
 }
 
@@ -186,6 +198,14 @@ void Replay::segmentLoadFinished(bool success) {
   if (!success) {
     Segment *seg = qobject_cast<Segment *>(sender());
     rWarning("failed to load segment %d, removing it from current replay list", seg->seg_num);
+    if (isSegmentMerged(seg->seg_num)) {
+      // merged while it was loading, its events go with it
+      updateEvents([&]() {
+        events_->clear();
+        segments_merged_.clear();
+        return true;
+      });
+    }
     segments_.erase(seg->seg_num);
   }
   queueSegment();
@@ -205,7 +225,10 @@ void Replay::queueSegment() {
     if ((seg && !seg->isLoaded()) || !seg) {
       if (!seg) {
         rDebug("loading segment %d...", n);
-        seg = std::make_unique<Segment>(n, route_->at(n), flags_);
+        // Once the stream runs, the segment seeked to is only decoded from the seek time on
+        uint64_t start_mono_time = it == cur && route_start_ts_ > 0 ? cur_mono_time_ : 0;
+        seg = std::make_unique<Segment>(n, route_->at(n), flags_, start_mono_time);
+        QObject::connect(seg.get(), &Segment::eventsAvailable, this, &Replay::queueSegment);
         QObject::connect(seg.get(), &Segment::loadFinished, this, &Replay::segmentLoadFinished);
       }
       break;
@@ -224,23 +247,33 @@ void Replay::queueSegment() {
   std::for_each(segments_.begin(), begin, [](auto &e) { e.second.reset(nullptr); });
   std::for_each(end, segments_.end(), [](auto &e) { e.second.reset(nullptr); });
 
-  // start stream thread
-  if (stream_thread_ == nullptr && cur_segment->isLoaded()) {
+  // start stream thread, the current segment may still be loading
+  if (stream_thread_ == nullptr && isSegmentMerged(cur_segment->seg_num)) {
     startStream(cur_segment.get());
     emit streamStarted();
   }
 }
 
 void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end) {
-  // merge 3 segments in sequence.
+  // merge 3 segments in sequence. The first one that's still loading is merged with the events decoded so far,
+  // so the stream doesn't wait for all of the log
   std::vector<int> segments_need_merge;
+  std::vector<Event *> partial_events;
   size_t new_events_size = 0;
-  for (auto it = begin; it != end && it->second && it->second->isLoaded() && segments_need_merge.size() < 3; ++it) {
+  for (auto it = begin; it != end && it->second && segments_need_merge.size() < 3; ++it) {
+    if (!it->second->isLoaded()) {
+      partial_events = it->second->decodedEvents();
+      if (!partial_events.empty()) {
+        segments_need_merge.push_back(it->first);
+        new_events_size += partial_events.size();
+      }
+      break;
+    }
     segments_need_merge.push_back(it->first);
     new_events_size += it->second->log->events.size();
   }
 
-  if (segments_need_merge != segments_merged_) {
+  if (segments_need_merge != segments_merged_ || partial_events.size() != partial_events_merged_) {
     std::string s;
     for (int i = 0; i < segments_need_merge.size(); ++i) {
       s += std::to_string(segments_need_merge[i]);
@@ -250,7 +283,7 @@ void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::
     new_events_->clear();
     new_events_->reserve(new_events_size);
     for (int n : segments_need_merge) {
-      const auto &e = segments_[n]->log->events;
+      const auto &e = !partial_events.empty() && n == segments_need_merge.back() ? partial_events : segments_[n]->log->events;
       auto middle = new_events_->insert(new_events_->end(), e.begin(), e.end());
       std::inplace_merge(new_events_->begin(), middle, new_events_->end(), Event::lessThan());
     }
@@ -258,13 +291,14 @@ void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::
     updateEvents([&]() {
       events_.swap(new_events_);
       segments_merged_ = segments_need_merge;
+      partial_events_merged_ = partial_events.size();
       return true;
     });
   }
 }
 
 void Replay::startStream(const Segment *cur_segment) {
-  const auto &events = cur_segment->log->events;
+  const auto events = cur_segment->decodedEvents();
 
   // get route start time from initData
   auto it = std::find_if(events.begin(), events.end(), [](auto e) { return e->which == cereal::Event::Which::INIT_DATA; });
@@ -310,7 +344,7 @@ void Replay::publishMessage(const Event *e) {
       sockets_[e->which] = nullptr;
     }
   } else {
-    sm->update_msgs(nanos_since_boot(), {{sockets_[e->which], e->event}});
+    sm->update_msgs(nanos_since_boot(), {{service_ids_[e->which], e->event}});
   }
 }
 
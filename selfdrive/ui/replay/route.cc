@@ -7,7 +7,9 @@
 #include <QRegExp>
 #include <QtConcurrent>
 
+#include <algorithm>
 #include <array>
+#include <iterator>
 
 #include "selfdrive/hardware/hw.h"
 #include "selfdrive/ui/qt/api.h"
@@ -78,10 +80,14 @@ bool Route::loadFromLocal() {
 
 void Route::addFileToSegment(int n, const QString &file) {
   const QString name = QUrl(file).fileName();
-  if (name == "rlog.bz2") {
+  if (name == "rlog.bz2" || name == "rlog.zst" || name == "rlog.lz4") {
     segments_[n].rlog = file;
-  } else if (name == "qlog.bz2") {
+  } else if (name == "qlog.bz2" || name == "qlog.zst" || name == "qlog.lz4") {
     segments_[n].qlog = file;
+  } else if (name == "rlog.zst.idx" || name == "rlog.lz4.idx") {
+    segments_[n].rlog_index = file;
+  } else if (name == "qlog.zst.idx" || name == "qlog.lz4.idx") {
+    segments_[n].qlog_index = file;
   } else if (name == "fcamera.hevc") {
     segments_[n].road_cam = file;
   } else if (name == "dcamera.hevc") {
@@ -95,7 +101,15 @@ void Route::addFileToSegment(int n, const QString &file) {
 
 // class Segment
 
-Segment::Segment(int n, const SegmentFile &files, uint32_t flags) : seg_num(n), flags(flags) {
+static QString logIndex(const SegmentFile &files) {
+  const QString &log = files.rlog.isEmpty() ? files.qlog : files.rlog;
+  const QString &index = files.rlog.isEmpty() ? files.qlog_index : files.rlog_index;
+  // the index has to be the one of the log, e.g. not of a zst log next to a bz2 log
+  return QUrl(index).fileName() == QUrl(log).fileName() + ".idx" ? index : "";
+}
+
+Segment::Segment(int n, const SegmentFile &files, uint32_t flags, uint64_t start_mono_time)
+    : seg_num(n), start_mono_time(logIndex(files).isEmpty() ? 0 : start_mono_time), flags(flags) {
   // [RoadCam, DriverCam, WideRoadCam, log]. fallback to qcamera/qlog
   const std::array file_list = {
       (flags & REPLAY_FLAG_QCAMERA) || files.road_cam.isEmpty() ? files.qcamera : files.road_cam,
@@ -103,9 +117,15 @@ Segment::Segment(int n, const SegmentFile &files, uint32_t flags) : seg_num(n),
       flags & REPLAY_FLAG_ECAM ? files.wide_road_cam : "",
       files.rlog.isEmpty() ? files.qlog : files.rlog,
   };
+  log_index_ = logIndex(files).toStdString();
   for (int i = 0; i < file_list.size(); ++i) {
     if (!file_list[i].isEmpty() && (!(flags & REPLAY_FLAG_NO_VIPC) || i >= MAX_CAMERAS)) {
       ++loading_;
+      if (i < MAX_CAMERAS) {
+        ++frames_loading_;
+      } else {
+        log_loading_ = true;
+      }
       synchronizer_.addFuture(QtConcurrent::run(this, &Segment::loadFile, i, file_list[i].toStdString()));
     }
   }
@@ -126,7 +146,13 @@ void Segment::loadFile(int id, const std::string file) {
     success = frames[id]->load(file, flags & REPLAY_FLAG_NO_HW_DECODER, &abort_, local_cache, 20 * 1024 * 1024, 3);
   } else {
     log = std::make_unique<LogReader>();
-    success = log->load(file, &abort_, local_cache, 0, 3);
+    log->on_events = [this](const std::vector<Event *> &events) { addEvents(events); };
+    if (start_mono_time > 0) {
+      success = log->load(file, log_index_, start_mono_time, &abort_, local_cache, 0, 3);
+    } else {
+      success = log->load(file, &abort_, local_cache, 0, 3);
+    }
+    log_loading_ = false;
   }
 
   if (!success) {
@@ -134,7 +160,50 @@ void Segment::loadFile(int id, const std::string file) {
     abort_ = true;
   }
 
+  if (id < MAX_CAMERAS && --frames_loading_ == 0 && log_loading_ && !abort_) {
+    // the log got ahead of the frames
+    std::unique_lock lk(events_lock_);
+    if (!decoded_events_.empty()) {
+      available_mono_time_ = decoded_mono_time_;
+      lk.unlock();
+      emit eventsAvailable();
+    }
+  }
+
   if (--loading_ == 0) {
+    {
+      // all of them are in log->events now
+      std::lock_guard lk(events_lock_);
+      decoded_events_ = {};
+    }
     emit loadFinished(!abort_);
   }
 }
+
+void Segment::addEvents(const std::vector<Event *> &events) {
+  std::unique_lock lk(events_lock_);
+  decoded_events_.insert(decoded_events_.end(), events.begin(), events.end());
+  for (const Event *e : events) {
+    // frames are sent at their start of frame time, which is before they're logged
+    if (!e->frame) decoded_mono_time_ = std::max(decoded_mono_time_, e->mono_time);
+  }
+  if (frames_loading_ == 0 && decoded_mono_time_ >= available_mono_time_ + SEGMENT_EVENTS_INTERVAL_NS) {
+    available_mono_time_ = decoded_mono_time_;
+    lk.unlock();
+    emit eventsAvailable();
+  }
+}
+
+std::vector<Event *> Segment::decodedEvents() const {
+  std::lock_guard lk(events_lock_);
+  if (isLoaded()) return log->events;
+
+  std::vector<Event *> events;
+  if (frames_loading_ > 0 || abort_ || decoded_mono_time_ < SEGMENT_EVENTS_MARGIN_NS) return events;
+
+  const uint64_t end_mono_time = decoded_mono_time_ - SEGMENT_EVENTS_MARGIN_NS;
+  std::copy_if(decoded_events_.begin(), decoded_events_.end(), std::back_inserter(events),
+               [=](const Event *e) { return e->mono_time <= end_mono_time; });
+  std::sort(events.begin(), events.end(), Event::lessThan());
+  return events;
+}
@@ -2,6 +2,8 @@
 
 #include <QFutureSynchronizer>
 
+#include <mutex>
+
 #include "selfdrive/ui/replay/framereader.h"
 #include "selfdrive/ui/replay/logreader.h"
 #include "selfdrive/ui/replay/util.h"
@@ -16,6 +18,8 @@ struct RouteIdentifier {
 struct SegmentFile {
   QString rlog;
   QString qlog;
+  QString rlog_index;
+  QString qlog_index;
   QString road_cam;
   QString driver_cam;
   QString wide_road_cam;
@@ -43,26 +47,49 @@ protected:
   std::map<int, SegmentFile> segments_;
 };
 
+// While the log loads, eventsAvailable is emitted every this much decoded log time
+const uint64_t SEGMENT_EVENTS_INTERVAL_NS = 5e9;
+// Events are logged out of order by less than this, so the last of the decoded log isn't handed out yet
+const uint64_t SEGMENT_EVENTS_MARGIN_NS = 1e9;
+
 class Segment : public QObject {
   Q_OBJECT
 
 public:
-  Segment(int n, const SegmentFile &files, uint32_t flags);
+  // With start_mono_time and an indexed log, only the events from about that time on are decoded
+  Segment(int n, const SegmentFile &files, uint32_t flags, uint64_t start_mono_time = 0);
   ~Segment();
   inline bool isLoaded() const { return !loading_ && !abort_; }
+  // The events decoded so far in mono time order, all of the log once it's loaded. While it loads, only
+  // once the frames are loaded, and up to a margin before the latest one. Valid for the lifetime of the segment
+  std::vector<Event *> decodedEvents() const;
 
   const int seg_num = 0;
+  // 0 if the whole log is decoded
+  const uint64_t start_mono_time = 0;
   std::unique_ptr<LogReader> log;
   std::unique_ptr<FrameReader> frames[MAX_CAMERAS] = {};
 
 signals:
+  // Emitted from the loading thread while the log loads, when decodedEvents has more events
+  void eventsAvailable();
   void loadFinished(bool success);
 
 protected:
   void loadFile(int id, const std::string file);
+  void addEvents(const std::vector<Event *> &events);
 
   std::atomic<bool> abort_ = false;
   std::atomic<int> loading_ = 0;
+  std::atomic<int> frames_loading_ = 0;
+  std::atomic<bool> log_loading_ = false;
+
+  // Events handed over by the LogReader while it loads
+  mutable std::mutex events_lock_;
+  std::vector<Event *> decoded_events_;
+  uint64_t decoded_mono_time_ = 0;   // latest mono time of the decoded messages
+  uint64_t available_mono_time_ = 0;  // decoded_mono_time_ at the last eventsAvailable
   QFutureSynchronizer<void> synchronizer_;
   uint32_t flags;
+  std::string log_index_;
 };
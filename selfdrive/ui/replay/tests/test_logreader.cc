@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/block_codec.h"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/log_codec.h"
+#include "selfdrive/ui/replay/logreader.h"
+#include "selfdrive/ui/replay/replay.h"
+#include "selfdrive/ui/replay/route.h"
+
+const std::string TEST_ROUTE_TIME = "2021-09-29--13-46-36";
+const uint64_t TEST_START_TIME = 1000;
+
+struct TestSegment {
+  TestSegment() {
+    char tmpl[] = "/tmp/test_logreader_XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    root = tmpl;
+    dir = root + "/" + TEST_ROUTE_TIME + "--0";
+    REQUIRE(util::create_directories(dir, 0775));
+  }
+  ~TestSegment() {
+    for (const std::string &f : files) unlink(f.c_str());
+    rmdir(dir.c_str());
+    rmdir(root.c_str());
+  }
+  std::string add(const std::string &name) {
+    files.push_back(dir + "/" + name);
+    return files.back();
+  }
+
+  std::string root, dir;
+  std::vector<std::string> files;
+};
+
+// Writes a few blocks of can events with an index, the event at i has logMonoTime TEST_START_TIME + i * interval
+static int write_log(const std::string &path, const std::string &index_path, size_t log_size = LOG_BLOCK_SIZE * 3 + LOG_BLOCK_SIZE / 2,
+                     uint64_t interval = 1) {
+  auto log = log_file_open(path.c_str(), log_codec_from_string("zstd:1"), index_path.c_str());
+  std::string dat(4000, '\0');
+  size_t size = 0;
+  int i = 0;
+  for (; size < log_size; ++i) {
+    for (size_t j = 0; j < dat.size(); ++j) dat[j] = (char)(i * 7 + j / 16);
+    MessageBuilder msg;
+    auto event = msg.initEvent();
+    event.setLogMonoTime(TEST_START_TIME + i * interval);
+    event.initCan(1)[0].setDat(kj::arrayPtr((const capnp::byte *)dat.data(), dat.size()));
+    auto bytes = msg.toBytes();
+    log->write(bytes);
+    size += bytes.size();
+  }
+  return i;
+}
+
+TEST_CASE("Route finds the index of a log") {
+  TestSegment seg;
+  for (const char *name : {"rlog.zst", "rlog.zst.idx", "qlog.bz2"}) {
+    REQUIRE(util::write_file(seg.add(name).c_str(), "", 0, O_WRONLY | O_CREAT) == 0);
+  }
+
+  Route route("0000000000000000|" + QString::fromStdString(TEST_ROUTE_TIME), QString::fromStdString(seg.root));
+  REQUIRE(route.load());
+  REQUIRE(route.segments().size() == 1);
+  const SegmentFile &files = route.segments().at(0);
+  REQUIRE(files.rlog.toStdString() == seg.dir + "/rlog.zst");
+  REQUIRE(files.rlog_index.toStdString() == seg.dir + "/rlog.zst.idx");
+  REQUIRE(files.qlog.toStdString() == seg.dir + "/qlog.bz2");
+  REQUIRE(files.qlog_index.isEmpty());
+}
+
+TEST_CASE("LogReader only decodes the log from the seek time on") {
+  TestSegment seg;
+  const std::string path = seg.add("rlog.zst"), index_path = seg.add("rlog.zst.idx");
+  const size_t num_events = write_log(path, index_path);
+
+  LogReader full;
+  REQUIRE(full.load(path));
+  REQUIRE(full.events.size() == num_events);
+
+  // Every event from the seek time on, and the rest of the block it's in
+  auto require_from = [&](const LogReader &log, uint64_t seek_time) {
+    REQUIRE(log.events.size() > 0);
+    REQUIRE(log.events.front()->mono_time <= seek_time);
+    REQUIRE(log.events.back()->mono_time == TEST_START_TIME + num_events - 1);
+    size_t skipped = log.events.front()->mono_time - TEST_START_TIME;
+    REQUIRE(log.events.size() == num_events - skipped);
+    for (size_t i = 0; i < log.events.size(); ++i) {
+      REQUIRE(log.events[i]->mono_time == full.events[skipped + i]->mono_time);
+    }
+  };
+
+  const uint64_t seek_time = TEST_START_TIME + num_events * 2 / 3;
+  SECTION("with the index") {
+    LogReader log;
+    REQUIRE(log.load(path, index_path, seek_time));
+    require_from(log, seek_time);
+    REQUIRE(log.events.size() < full.events.size() / 2);
+  }
+  SECTION("with blocks written after the index was last flushed") {
+    std::string index = util::read_file(index_path);
+    REQUIRE(truncate(index_path.c_str(), index.size() - sizeof(LogIndexBlock)) == 0);
+    LogReader log;
+    REQUIRE(log.load(path, index_path, seek_time));
+    require_from(log, seek_time);
+  }
+  SECTION("seeking past the last event") {
+    LogReader log;
+    REQUIRE_FALSE(log.load(path, index_path, TEST_START_TIME + num_events));
+  }
+  SECTION("without a valid index") {
+    REQUIRE(util::write_file(index_path.c_str(), "not an index", 12, O_WRONLY | O_TRUNC) == 0);
+    LogReader log;
+    REQUIRE(log.load(path, index_path, seek_time));
+    REQUIRE(log.events.size() == full.events.size());
+  }
+  SECTION("with an index ahead of the log") {
+    std::string data = util::read_file(path);
+    REQUIRE(truncate(path.c_str(), data.size() - 1000) == 0);
+    LogReader log;
+    REQUIRE(log.load(path, index_path, seek_time));
+    REQUIRE(log.events.front()->mono_time == TEST_START_TIME);
+  }
+}
+
+TEST_CASE("Segment hands out the decoded events while the log loads") {
+  TestSegment seg;
+  const std::string path = seg.add("rlog.zst"), index_path = seg.add("rlog.zst.idx");
+  // 10 ms apart, a few SEGMENT_EVENTS_INTERVAL_NS of log
+  const uint64_t interval = 10 * 1e6;
+  const size_t num_events = write_log(path, index_path, LOG_BLOCK_SIZE * 3 + LOG_BLOCK_SIZE / 2, interval);
+  REQUIRE(num_events * interval > 3 * SEGMENT_EVENTS_INTERVAL_NS);
+
+  std::vector<std::vector<Event *>> available;
+  Segment segment(0, {.rlog = QString::fromStdString(path)}, REPLAY_FLAG_NO_VIPC);
+  // emitted on the loading thread, as the events come in
+  QObject::connect(&segment, &Segment::eventsAvailable, [&]() { available.push_back(segment.decodedEvents()); });
+  while (!segment.isLoaded()) {
+    util::sleep_for(10);
+  }
+
+  const auto events = segment.decodedEvents();
+  REQUIRE(events.size() == num_events);
+  REQUIRE(available.size() >= 2);
+  for (size_t i = 0; i < available.size(); ++i) {
+    // the log is in order, so what's decoded is the start of it, up to the margin before the latest event
+    const auto &decoded = available[i];
+    REQUIRE(decoded.size() > (i == 0 ? 0 : available[i - 1].size()));
+    REQUIRE(decoded.size() < num_events);
+    REQUIRE(std::equal(decoded.begin(), decoded.end(), events.begin()));
+    // handed out every SEGMENT_EVENTS_INTERVAL_NS of decoded log
+    REQUIRE(decoded.back()->mono_time + SEGMENT_EVENTS_MARGIN_NS + interval >= (i + 1) * SEGMENT_EVENTS_INTERVAL_NS);
+  }
+}
+
+TEST_CASE("LogReader reads a log spanning several chunks") {
+  TestSegment seg;
+  const std::string path = seg.add("rlog.zst"), index_path = seg.add("rlog.zst.idx");
+  const size_t num_events = write_log(path, index_path, LOG_CHUNK_SIZE * 2 + LOG_CHUNK_SIZE / 3);
+
+  LogReader log;
+  size_t streamed = 0;
+  uint64_t last_mono_time = 0;
+  log.on_events = [&](const std::vector<Event *> &events) {
+    for (const Event *e : events) {
+      REQUIRE(e->mono_time == last_mono_time + 1);
+      last_mono_time = e->mono_time;
+    }
+    streamed += events.size();
+  };
+  last_mono_time = TEST_START_TIME - 1;
+  REQUIRE(log.load(path));
+  REQUIRE(log.events.size() == num_events);
+  REQUIRE(streamed == num_events);
+  for (size_t i = 0; i < log.events.size(); ++i) {
+    REQUIRE(log.events[i]->mono_time == TEST_START_TIME + i);
+    REQUIRE(log.events[i]->event.getCan()[0].getDat().size() == 4000);
+  }
+}
+
+TEST_CASE("LogReader stops at a message too big for capnp") {
+  MessageBuilder msg;
+  msg.initEvent().setLogMonoTime(TEST_START_TIME);
+  auto bytes = msg.toBytes();
+  std::string raw((const char *)bytes.begin(), bytes.size());
+  // A segment table of one segment of 2^32 - 1 words
+  const uint32_t table[2] = {0, UINT32_MAX};
+  raw.append((const char *)table, sizeof(table));
+  raw.append(raw);
+
+  std::string compressed;
+  REQUIRE(block_compressor_create(LogCodec::ZSTD, 1)->compress(raw, compressed));
+  LogReader log;
+  REQUIRE(log.load((const std::byte *)compressed.data(), compressed.size()));
+  REQUIRE(log.events.size() == 1);
+}
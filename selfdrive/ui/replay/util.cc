@@ -2,10 +2,13 @@
 
 #include <bzlib.h>
 #include <curl/curl.h>
+#include <lz4frame.h>
 #include <openssl/sha.h>
+#include <zstd.h>
 
 #include <cstring>
 #include <cassert>
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <iostream>
@@ -292,6 +295,89 @@ std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool>
   return {};
 }
 
+bool decompressLogStream(const std::byte *in, size_t in_size, const DecompressOutputHandler &output, std::atomic<bool> *abort) {
+  auto has_magic = [=](const std::initializer_list<uint8_t> &magic) {
+    return in_size >= magic.size() && std::equal(magic.begin(), magic.end(), (const uint8_t *)in);
+  };
+  const size_t piece_size = 1 << 20;
+  std::string out(piece_size, '\0');
+  bool ok = true;
+
+  if (has_magic({'B', 'Z', 'h'})) {
+    bz_stream strm = {};
+    int bzerror = BZ2_bzDecompressInit(&strm, 0, 0);
+    assert(bzerror == BZ_OK);
+    strm.next_in = (char *)in;
+    strm.avail_in = in_size;
+    do {
+      strm.next_out = out.data();
+      strm.avail_out = out.size();
+      bzerror = BZ2_bzDecompress(&strm);
+      size_t size = out.size() - strm.avail_out;
+      if (bzerror == BZ_OK && size == 0 && strm.avail_in == 0) {
+        rWarning("decompressBZ2 error : content is truncated");
+        bzerror = BZ_UNEXPECTED_EOF;
+      }
+      ok = (bzerror == BZ_OK || bzerror == BZ_STREAM_END) && (size == 0 || output(out.data(), size));
+    } while (ok && bzerror == BZ_OK && !(abort && *abort));
+    BZ2_bzDecompressEnd(&strm);
+
+  } else if (has_magic({0x28, 0xb5, 0x2f, 0xfd})) {
+    ZSTD_DStream *dstream = ZSTD_createDStream();
+    ZSTD_inBuffer input = {in, in_size, 0};
+    size_t ret = 0;
+    while (ok && input.pos < input.size && !(abort && *abort)) {
+      ZSTD_outBuffer output_buf = {out.data(), out.size(), 0};
+      ret = ZSTD_decompressStream(dstream, &output_buf, &input);
+      if (ZSTD_isError(ret)) {
+        rWarning("decompressZSTD error : %s", ZSTD_getErrorName(ret));
+        ok = false;
+      } else if (output_buf.pos > 0) {
+        ok = output(out.data(), output_buf.pos);
+      }
+    }
+    // flush what the decoder still holds back, no progress means the last frame was cut short
+    while (ok && ret > 0 && !(abort && *abort)) {
+      ZSTD_outBuffer output_buf = {out.data(), out.size(), 0};
+      ret = ZSTD_decompressStream(dstream, &output_buf, &input);
+      if (ZSTD_isError(ret) || output_buf.pos == 0) {
+        rWarning("decompressZSTD error : content is truncated");
+        ok = false;
+      } else {
+        ok = output(out.data(), output_buf.pos);
+      }
+    }
+    ZSTD_freeDStream(dstream);
+
+  } else if (has_magic({0x04, 0x22, 0x4d, 0x18})) {
+    LZ4F_dctx *dctx = nullptr;
+    size_t ret = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    assert(!LZ4F_isError(ret));
+    size_t total_in = 0;
+    while (ok && (total_in < in_size || ret > 0) && !(abort && *abort)) {
+      size_t src_size = in_size - total_in;
+      size_t dst_size = out.size();
+      ret = LZ4F_decompress(dctx, out.data(), &dst_size, in + total_in, &src_size, nullptr);
+      total_in += src_size;
+      if (LZ4F_isError(ret)) {
+        rWarning("decompressLZ4 error : %s", LZ4F_getErrorName(ret));
+        ok = false;
+      } else if (dst_size == 0 && src_size == 0) {
+        rWarning("decompressLZ4 error : content is truncated");
+        ok = false;
+      } else if (dst_size > 0) {
+        ok = output(out.data(), dst_size);
+      }
+    }
+    LZ4F_freeDecompressionContext(dctx);
+
+  } else {
+    rWarning("decompressLog error : unknown compression");
+    ok = false;
+  }
+  return ok && !(abort && *abort);
+}
+
 void precise_nano_sleep(long sleep_ns) {
   const long estimate_ns = 1 * 1e6;  // 1ms
   struct timespec req = {.tv_nsec = estimate_ns};
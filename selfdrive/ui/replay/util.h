@@ -24,6 +24,10 @@ std::string sha256(const std::string &str);
 void precise_nano_sleep(long sleep_ns);
 std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort = nullptr);
 std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
+// Decompresses a bz2, zstd or lz4 log, picked from the magic number. output is called with each piece as soon
+// as it's decompressed. Returns false on corrupt or unknown input, on abort, or if output returned false
+typedef std::function<bool(const char *data, size_t size)> DecompressOutputHandler;
+bool decompressLogStream(const std::byte *in, size_t in_size, const DecompressOutputHandler &output, std::atomic<bool> *abort = nullptr);
 std::string getUrlWithoutQuery(const std::string &url);
 size_t getRemoteFileSize(const std::string &url, std::atomic<bool> *abort = nullptr);
 std::string httpGet(const std::string &url, size_t chunk_size = 0, std::atomic<bool> *abort = nullptr);